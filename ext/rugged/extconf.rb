@@ -86,8 +86,18 @@ else
   dir_config('git2', "#{LIBGIT2_DIR}/include", "#{LIBGIT2_DIR}/build")
 end
 
+# Long-running native operations release the GVL when the running Ruby
+# allows it; fall back to the 1.9 blocking region API otherwise.
+have_header('ruby/thread.h') and have_func('rb_thread_call_without_gvl', 'ruby/thread.h')
+have_func('rb_thread_blocking_region')
+
 unless have_library 'git2' and have_header 'git2.h'
   abort "ERROR: Failed to build libgit2"
 end
 
+# Repository#sniff inflates the start of objects itself, so rugged links
+# zlib directly instead of relying on libgit2 to pull it in. Without it,
+# sniffing falls back to reading whole objects.
+have_header('zlib.h') and have_library('z', 'inflateInit_', 'zlib.h')
+
 create_makefile("rugged/rugged")
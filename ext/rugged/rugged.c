@@ -487,12 +487,19 @@ void Init_rugged(void)
 	Init_rugged_object();
 	Init_rugged_commit();
 	Init_rugged_tree();
+	Init_rugged_tree_entry();
+	Init_rugged_tree_language_stats();
+	Init_rugged_tree_counts();
+	Init_rugged_tree_paths();
+	Init_rugged_tree_last_commits();
 	Init_rugged_tag();
 	Init_rugged_tag_collection();
 	Init_rugged_blob();
 
 	Init_rugged_index();
 	Init_rugged_repo();
+	Init_rugged_repo_sniff();
+	Init_rugged_repo_hash_files();
 	Init_rugged_revwalk();
 	Init_rugged_branch();
 	Init_rugged_branch_collection();
@@ -512,6 +519,10 @@ void Init_rugged(void)
 	Init_rugged_cred();
 	Init_rugged_backend();
 	Init_rugged_commit_stat();
+	Init_rugged_commit_graph();
+	Init_rugged_commit_fork();
+	Init_rugged_thread_pool();
+	Init_rugged_commit_stats_cache();
 
 	/*
 	 * Sort the repository contents in no particular ordering;
@@ -37,6 +37,10 @@
 #include <ruby/encoding.h>
 #endif
 
+#ifdef HAVE_RUBY_THREAD_H
+#include <ruby/thread.h>
+#endif
+
 #include <assert.h>
 #include <git2.h>
 #include <git2/odb_backend.h>
@@ -52,6 +56,11 @@ void Init_rugged_branch(void);
 void Init_rugged_branch_collection(void);
 void Init_rugged_commit(void);
 void Init_rugged_tree(void);
+void Init_rugged_tree_entry(void);
+void Init_rugged_tree_language_stats(void);
+void Init_rugged_tree_counts(void);
+void Init_rugged_tree_paths(void);
+void Init_rugged_tree_last_commits(void);
 void Init_rugged_tag(void);
 void Init_rugged_tag_collection(void);
 void Init_rugged_blob(void);
@@ -76,6 +85,12 @@ void Init_rugged_blame(void);
 void Init_rugged_cred(void);
 void Init_rugged_backend(void);
 void Init_rugged_commit_stat(void);
+void Init_rugged_commit_graph(void);
+void Init_rugged_commit_fork(void);
+void Init_rugged_repo_sniff(void);
+void Init_rugged_repo_hash_files(void);
+void Init_rugged_thread_pool(void);
+void Init_rugged_commit_stats_cache(void);
 
 VALUE rb_git_object_init(git_otype type, int argc, VALUE *argv, VALUE self);
 
@@ -95,8 +110,8 @@ VALUE rugged_diff_delta_new(VALUE owner, const git_diff_delta *delta);
 VALUE rugged_diff_hunk_new(VALUE owner, size_t hunk_idx, const git_diff_hunk *hunk, size_t lines_in_hunk);
 VALUE rugged_diff_line_new(const git_diff_line *line);
 VALUE rugged_remote_new(VALUE owner, git_remote *remote);
-VALUE rugged_commit_stats_of(git_repository *repo, git_commit *commit, const char *path_only);
 VALUE rb_git_delta_file_fromC(const git_diff_file *file);
+VALUE rb_git_delta_status_fromC(git_delta_t status);
 
 void rugged_parse_diff_options(git_diff_options *opts, VALUE rb_options);
 void rugged_parse_merge_options(git_merge_options *opts, VALUE rb_options);
@@ -139,6 +154,25 @@ static inline int rugged_parse_bool(VALUE boolean)
 	return boolean ? 1 : 0;
 }
 
+/*
+ * Run +func+ with the GVL released, so other Ruby threads can make progress
+ * while we're busy inside libgit2. +func+ must not touch any Ruby object.
+ * +ubf+ is called from another thread when the call should be interrupted.
+ */
+static inline void *rugged_without_gvl(void *(*func)(void *), void *data,
+	void (*ubf)(void *), void *ubf_data)
+{
+#if defined(HAVE_RB_THREAD_CALL_WITHOUT_GVL)
+	return rb_thread_call_without_gvl(func, data, ubf, ubf_data);
+#elif defined(HAVE_RB_THREAD_BLOCKING_REGION)
+	return (void *)rb_thread_blocking_region((rb_blocking_function_t *)func, data, ubf, ubf_data);
+#else
+	(void)ubf;
+	(void)ubf_data;
+	return func(data);
+#endif
+}
+
 extern VALUE rb_cRuggedRepo;
 
 VALUE rugged__block_yield_splat(VALUE args);
@@ -181,14 +215,123 @@ static inline VALUE rugged_create_oid(const git_oid *oid)
 #include <pthread.h>
 #include <errno.h>
 
+struct rugged_diff_budget {
+	size_t max_files, max_lines, max_bytes;
+};
+
+void rugged_parse_diff_budget(struct rugged_diff_budget *budget, VALUE rb_options);
+
+static inline int rugged_diff_budget_files_exceeded(const struct rugged_diff_budget *budget, size_t files)
+{
+	return budget && budget->max_files && files > budget->max_files;
+}
+
+static inline int rugged_diff_budget_lines_exceeded(const struct rugged_diff_budget *budget, size_t lines, size_t bytes)
+{
+	return budget && ((budget->max_lines && lines > budget->max_lines) ||
+		(budget->max_bytes && bytes > budget->max_bytes));
+}
+
 struct commit_stats {
-    size_t adds, dels;
+    size_t adds, dels, files;
+    int truncated;
     git_signature *committer, *author;
     git_oid oid;
 };
 VALUE rugged_commit_stats_new(struct commit_stats *stats);
 int git_commit_stats_of(git_repository *repo, git_tree *tree, git_tree *parent_tree,
-                        const char *path_only, size_t *adds, size_t *dels);
+                        const char *path_only, const struct rugged_diff_budget *budget,
+                        struct commit_stats *stats);
+
+typedef struct rugged_stats_cache rugged_stats_cache;
+rugged_stats_cache *rugged_repo_stats_cache(VALUE rb_repo);
+int rugged_stats_cache_lookup(rugged_stats_cache *cache, const git_oid *commit,
+	const git_oid *parent, struct commit_stats *stats);
+void rugged_stats_cache_add(rugged_stats_cache *cache, const git_oid *commit,
+	const git_oid *parent, const struct commit_stats *stats);
+void rugged_stats_cache_flush(rugged_stats_cache *cache);
+
+typedef struct rugged_pool_group {
+	size_t pending;
+	int interrupted;
+	pthread_cond_t cond;
+} rugged_pool_group;
+
+typedef struct rugged_pool_task {
+	void (*run)(void *payload);
+	void *payload;
+	rugged_pool_group *group;
+	struct rugged_pool_task *next;
+} rugged_pool_task;
+
+void rugged_pool_group_init(rugged_pool_group *group);
+void rugged_pool_group_free(rugged_pool_group *group);
+int rugged_pool_submit(rugged_pool_group *group, rugged_pool_task *task,
+	void (*run)(void *payload), void *payload);
+size_t rugged_pool_cancel(rugged_pool_group *group);
+int rugged_pool_wait(rugged_pool_group *group);
+void rugged_pool_drain(rugged_pool_group *group);
+void rugged_pool_interrupt(rugged_pool_group *group);
+/* Larger pool sizes are capped to this */
+#define RUGGED_POOL_MAX_SIZE 256
+
+void rugged_pool_set_size(size_t size);
+void rugged_pool_stats(size_t *size, size_t *workers, size_t *busy, size_t *queued);
+
+/*
+ * Header of the tasks run with rugged_pool_run_tasks(), which has to be
+ * the first member of the caller's task struct.
+ */
+typedef struct rugged_batch_task {
+	rugged_pool_task task;
+	int done, error, error_class;
+	char *error_message;
+} rugged_batch_task;
+
+#define RUGGED_BATCH_TASK_AT(tasks, stride, i) \
+	((rugged_batch_task *)((char *)(tasks) + (i) * (stride)))
+
+void rugged_batch_task_set_error(rugged_batch_task *task, int error);
+int rugged_pool_run_tasks(void *tasks, size_t stride, size_t count,
+	void (*run)(void *payload), int *exception);
+int rugged_batch_tasks_error(void *tasks, size_t stride, size_t count);
+void rugged_batch_tasks_raise(int os_errno, int exception, int error);
+
+VALUE rugged_tree_entry_new(const git_tree_entry *entry);
+int rugged_tree_entry_fields(VALUE rb_entry,
+	const char **name, const git_oid **oid, git_filemode_t *filemode);
+
+struct rugged_tree_counts {
+	size_t files;
+	size_t dirs;
+	uint64_t bytes;
+};
+
+int rugged_tree_counts_cached(VALUE rb_tree, struct rugged_tree_counts *out);
+void rugged_tree_counts(VALUE rb_tree, struct rugged_tree_counts *out);
+
+struct rugged_text_scan {
+	const unsigned char *data;
+	size_t size;
+
+	size_t loc, sloc, longest_line;
+	size_t lf, crlf, cr;
+	int high_bytes, utf8_valid;
+};
+
+void rugged_text_scan(struct rugged_text_scan *scan);
+
+typedef struct rugged_commit_graph rugged_commit_graph;
+rugged_commit_graph *rugged_repo_commit_graph(VALUE rb_repo);
+int rugged_commit_graph_find(const rugged_commit_graph *graph, const git_oid *oid, uint32_t *pos);
+int rugged_commit_graph_descendant_of(const rugged_commit_graph *graph, const git_oid *commit, const git_oid *ancestor);
+int rugged_commit_graph_ahead_behind(size_t *ahead, size_t *behind,
+	const rugged_commit_graph *graph, const git_oid *local, const git_oid *upstream);
+int rugged_commit_graph_count(size_t *out, const rugged_commit_graph *graph,
+	const git_oid *show, const git_oid *hide);
+int rugged_commit_graph_merge_base(git_oid *out, const rugged_commit_graph *graph,
+	const git_oid *one, const git_oid *two);
+int rugged_commit_graph_first_parent(git_oid *out, const rugged_commit_graph *graph, const git_oid *oid);
 
 typedef struct _rugged_backend {
   int (* odb_backend)(git_odb_backend **backend_out, struct _rugged_backend *backend, const char* path);
@@ -24,6 +24,12 @@
 
 #include "rugged.h"
 #include <ctype.h>
+#include <errno.h>
+#include <ruby/io.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
 #include <git2/sys/hashsig.h>
 
 extern VALUE rb_mRugged;
@@ -34,6 +40,20 @@ static ID id_read;
 VALUE rb_cRuggedBlob;
 VALUE rb_cRuggedBlobSig;
 
+static inline void put_u32_le(unsigned char *out, uint32_t value)
+{
+	out[0] = value & 0xff;
+	out[1] = (value >> 8) & 0xff;
+	out[2] = (value >> 16) & 0xff;
+	out[3] = (value >> 24) & 0xff;
+}
+
+static inline uint32_t get_u32_le(const unsigned char *in)
+{
+	return (uint32_t)in[0] | ((uint32_t)in[1] << 8) |
+		((uint32_t)in[2] << 16) | ((uint32_t)in[3] << 24);
+}
+
 /*
  *  call-seq:
  *    blob.text(max_lines = -1, encoding = Encoding.default_external) -> string
@@ -141,6 +161,138 @@ static VALUE rb_git_blob_rawsize(VALUE self)
 	return INT2FIX(git_blob_rawsize(blob));
 }
 
+#define BLOB_DEFAULT_CHUNK_SIZE (64 * 1024)
+
+static size_t blob_chunk_size(VALUE rb_size)
+{
+	long size;
+
+	if (NIL_P(rb_size))
+		return BLOB_DEFAULT_CHUNK_SIZE;
+
+	size = NUM2LONG(rb_size);
+	if (size <= 0)
+		rb_raise(rb_eArgError, "chunk size must be positive");
+
+	return (size_t)size;
+}
+
+/*
+ *  call-seq:
+ *    blob.each_chunk(size = 65536) { |chunk| block } -> blob
+ *    blob.each_chunk(size = 65536) -> enumerator
+ *
+ *  Yield the contents of the blob as binary +String+s of at most +size+
+ *  bytes, so that the whole blob never has to be copied into a single
+ *  Ruby string.
+ */
+static VALUE rb_git_blob_each_chunk(int argc, VALUE *argv, VALUE self)
+{
+	git_blob *blob;
+	const char *content;
+	size_t size, chunk_size, offset;
+	VALUE rb_size;
+
+	RETURN_ENUMERATOR(self, argc, argv);
+
+	rb_scan_args(argc, argv, "01", &rb_size);
+	chunk_size = blob_chunk_size(rb_size);
+	Data_Get_Struct(self, git_blob, blob);
+
+	content = git_blob_rawcontent(blob);
+	size = (size_t)git_blob_rawsize(blob);
+
+	for (offset = 0; offset < size; offset += chunk_size) {
+		size_t len = size - offset < chunk_size ? size - offset : chunk_size;
+		rb_yield(rb_str_new(content + offset, len));
+	}
+
+	return self;
+}
+
+struct blob_write_chunk {
+	int fd;
+	const char *data;
+	size_t len;
+	ssize_t written;
+	int os_errno;
+};
+
+static void *blob_write_chunk(void *payload)
+{
+	struct blob_write_chunk *w = payload;
+
+	w->written = write(w->fd, w->data, w->len);
+	w->os_errno = w->written < 0 ? errno : 0;
+	return NULL;
+}
+
+/*
+ *  call-seq:
+ *    blob.write_to(io, chunk_size = 65536) -> bytes_written
+ *
+ *  Write the contents of the blob to +io+, at most +chunk_size+ bytes at
+ *  a time, and return the number of bytes written.
+ *
+ *  When +io+ is an +IO+ (a file, pipe or socket) or converts to one with
+ *  +to_io+ (like a +Tempfile+), its buffer is flushed
+ *  and the blob is written straight to its file descriptor, as-is and
+ *  without holding the GVL, without creating any Ruby string. Any other
+ *  object gets one +write+ call per chunk.
+ */
+static VALUE rb_git_blob_write_to(int argc, VALUE *argv, VALUE self)
+{
+	git_blob *blob;
+	const char *content;
+	size_t size, chunk_size, offset = 0;
+	VALUE rb_io, rb_size, rb_file;
+
+	rb_scan_args(argc, argv, "11", &rb_io, &rb_size);
+	chunk_size = blob_chunk_size(rb_size);
+	Data_Get_Struct(self, git_blob, blob);
+
+	content = git_blob_rawcontent(blob);
+	size = (size_t)git_blob_rawsize(blob);
+
+	/* Objects that wrap an IO (e.g. Tempfile) expose it through #to_io */
+	rb_file = rb_io_check_io(rb_io);
+
+	if (!NIL_P(rb_file)) {
+		struct blob_write_chunk w;
+
+		rb_io_flush(rb_file);
+		w.fd = NUM2INT(rb_funcall(rb_file, rb_intern("fileno"), 0));
+
+		while (offset < size) {
+			w.data = content + offset;
+			w.len = size - offset < chunk_size ? size - offset : chunk_size;
+
+			rugged_without_gvl(blob_write_chunk, &w, RUBY_UBF_IO, NULL);
+
+			if (w.written >= 0) {
+				offset += (size_t)w.written;
+			} else if (w.os_errno == EINTR) {
+				rb_thread_check_ints();
+			} else if (w.os_errno == EAGAIN || w.os_errno == EWOULDBLOCK) {
+				/* sockets are non-blocking by default */
+				rb_io_wait_writable(w.fd);
+			} else {
+				VALUE rb_errno = INT2FIX(w.os_errno);
+				rb_exc_raise(rb_class_new_instance(1, &rb_errno, rb_eSystemCallError));
+			}
+		}
+	} else {
+		for (; offset < size; offset += chunk_size) {
+			size_t len = size - offset < chunk_size ? size - offset : chunk_size;
+			rb_funcall(rb_io, rb_intern("write"), 1, rb_str_new(content + offset, len));
+		}
+		offset = size;
+	}
+
+	RB_GC_GUARD(self);
+	return SIZET2NUM(offset);
+}
+
 /*
  *  call-seq:
  *    Blob.from_buffer(repository, buffer) -> oid
@@ -317,6 +469,170 @@ static VALUE rb_git_blob_from_io(int argc, VALUE *argv, VALUE klass)
 	return rugged_create_oid(&oid);
 }
 
+#define SWAR_ONES ((uint64_t)0x0101010101010101ULL)
+#define SWAR_HIGHS (SWAR_ONES * 0x80)
+
+/* Non-zero if any byte of +word+ is +c+ */
+static inline uint64_t swar_has_byte(uint64_t word, unsigned char c)
+{
+	word ^= SWAR_ONES * c;
+	return (word - SWAR_ONES) & ~word & SWAR_HIGHS;
+}
+
+/* Length of the valid UTF-8 sequence at +p+, or 0 if it isn't one */
+static size_t utf8_sequence_length(const unsigned char *p, const unsigned char *end)
+{
+	size_t len, i;
+
+	if (p[0] < 0xC2)
+		return 0;
+	else if (p[0] < 0xE0)
+		len = 2;
+	else if (p[0] < 0xF0)
+		len = 3;
+	else if (p[0] < 0xF5)
+		len = 4;
+	else
+		return 0;
+
+	if ((size_t)(end - p) < len)
+		return 0;
+
+	for (i = 1; i < len; ++i) {
+		if ((p[i] & 0xC0) != 0x80)
+			return 0;
+	}
+
+	/* overlong forms, surrogates and code points past U+10FFFF */
+	if ((p[0] == 0xE0 && p[1] < 0xA0) || (p[0] == 0xED && p[1] > 0x9F) ||
+		(p[0] == 0xF0 && p[1] < 0x90) || (p[0] == 0xF4 && p[1] > 0x8F))
+		return 0;
+
+	return len;
+}
+
+/*
+ * Gather everything Blob#loc, Blob#sloc and Blob#text_stats need in a
+ * single pass over +scan->data+. Doesn't touch the Ruby VM.
+ */
+void rugged_text_scan(struct rugged_text_scan *scan)
+{
+	const unsigned char *p = scan->data, *end = p + scan->size, *line = p;
+	int skip_space = 0, crlf = 0;
+	uint64_t word;
+	size_t len;
+
+	scan->utf8_valid = 1;
+
+	while (p < end) {
+		/*
+		 * Plain ASCII without line breaks needs no attention: skip it
+		 * a word at a time. sloc has to look at the bytes following a
+		 * newline one by one, though.
+		 */
+		if (!skip_space) {
+			while (end - p >= 8) {
+				memcpy(&word, p, 8);
+				if ((word & SWAR_HIGHS) || swar_has_byte(word, '\n') || swar_has_byte(word, '\r'))
+					break;
+				p += 8;
+			}
+			if (p == end)
+				break;
+		}
+
+		/* sloc: a newline counts unless it's in the blank run after the previous one */
+		if (skip_space && isspace(*p)) {
+			/* still blank */
+		} else if (*p == '\n') {
+			scan->sloc++;
+			skip_space = 1;
+		} else {
+			skip_space = 0;
+		}
+
+		switch (*p) {
+		case '\n':
+			if (crlf) {
+				crlf = 0;
+			} else {
+				scan->lf++;
+				scan->loc++;
+				len = (size_t)(p - line);
+				if (len > scan->longest_line)
+					scan->longest_line = len;
+			}
+			line = p + 1;
+			break;
+
+		case '\r':
+			if (p + 1 < end && p[1] == '\n') {
+				scan->crlf++;
+				crlf = 1;
+			} else {
+				scan->cr++;
+			}
+			scan->loc++;
+			len = (size_t)(p - line);
+			if (len > scan->longest_line)
+				scan->longest_line = len;
+			line = p + 1;
+			break;
+
+		default:
+			if (*p >= 0x80) {
+				scan->high_bytes = 1;
+				if (scan->utf8_valid) {
+					len = utf8_sequence_length(p, end);
+					if (len == 0) {
+						scan->utf8_valid = 0;
+					} else {
+						/* continuation bytes are neither blank nor line breaks */
+						p += len;
+						continue;
+					}
+				}
+			}
+			break;
+		}
+
+		p++;
+	}
+
+	len = (size_t)(end - line);
+	if (len > scan->longest_line)
+		scan->longest_line = len;
+
+	/* last line without a line break? */
+	if (scan->size > 0) {
+		if (end[-1] != '\n' && end[-1] != '\r')
+			scan->loc++;
+		if (end[-1] != '\n')
+			scan->sloc++;
+	}
+}
+
+static void *blob_text_scan(void *scan)
+{
+	rugged_text_scan(scan);
+	return NULL;
+}
+
+/* Scanning a few megabytes is worth letting other threads run meanwhile */
+#define BLOB_TEXT_SCAN_WITHOUT_GVL (64 * 1024)
+
+static void rugged_blob_text_scan(struct rugged_text_scan *scan, git_blob *blob)
+{
+	memset(scan, 0, sizeof(*scan));
+	scan->data = git_blob_rawcontent(blob);
+	scan->size = (size_t)git_blob_rawsize(blob);
+
+	if (scan->size >= BLOB_TEXT_SCAN_WITHOUT_GVL)
+		rugged_without_gvl(blob_text_scan, scan, NULL, NULL);
+	else
+		rugged_text_scan(scan);
+}
+
 /*
  *  call-seq:
  *    blob.loc -> int
@@ -327,72 +643,320 @@ static VALUE rb_git_blob_from_io(int argc, VALUE *argv, VALUE klass)
 static VALUE rb_git_blob_loc(VALUE self)
 {
 	git_blob *blob;
-	const char *data, *data_end;
-	size_t loc = 0;
+	struct rugged_text_scan scan;
 
 	Data_Get_Struct(self, git_blob, blob);
+	rugged_blob_text_scan(&scan, blob);
 
-	data = git_blob_rawcontent(blob);
-	data_end = data + git_blob_rawsize(blob);
+	return INT2FIX(scan.loc);
+}
 
-	if (data == data_end)
-		return INT2FIX(0);
 
-	for (; data < data_end; ++data) {
-		if (data[0] == '\n') {
-			loc++;
-		}
-		else if (data[0] == '\r') {
-			if (data + 1 < data_end && data[1] == '\n')
-				data++;
-			loc++;
-		}
+/*
+ *  call-seq:
+ *    blob.sloc -> int
+ *
+ *  Return the number of non-empty code lines for the blob,
+ *  assuming the blob is plaintext (i.e. not binary)
+ */
+static VALUE rb_git_blob_sloc(VALUE self)
+{
+	git_blob *blob;
+	struct rugged_text_scan scan;
+
+	Data_Get_Struct(self, git_blob, blob);
+	rugged_blob_text_scan(&scan, blob);
+
+	return INT2FIX(scan.sloc);
+}
+
+/*
+ *  call-seq:
+ *    blob.text_stats -> hash
+ *
+ *  Return the text statistics of the blob, gathered in a single pass:
+ *
+ *  :loc ::
+ *    The number of lines, as returned by Blob#loc.
+ *
+ *  :sloc ::
+ *    The number of non-empty lines, as returned by Blob#sloc.
+ *
+ *  :binary ::
+ *    Whether the blob is binary, as returned by Blob#binary?.
+ *
+ *  :line_endings ::
+ *    +:lf+, +:crlf+ or +:cr+ if all the lines end the same way, +:mixed+
+ *    otherwise, or +nil+ if the blob has no line breaks.
+ *
+ *  :longest_line ::
+ *    The length in bytes of the longest line, without its line break.
+ *
+ *  :encoding ::
+ *    A guess of the content's encoding: US-ASCII, UTF-8, UTF-16LE or
+ *    UTF-16BE (when the blob starts with their byte order mark), or
+ *    ASCII-8BIT for binary content and anything that isn't valid UTF-8.
+ */
+static VALUE rb_git_blob_text_stats(VALUE self)
+{
+	git_blob *blob;
+	struct rugged_text_scan scan;
+	VALUE rb_stats = rb_hash_new(), rb_endings = Qnil;
+	rb_encoding *encoding;
+	int binary, nr_styles;
+
+	Data_Get_Struct(self, git_blob, blob);
+	rugged_blob_text_scan(&scan, blob);
+
+	/* Only looks at the start of the blob */
+	binary = git_blob_is_binary(blob);
+
+	nr_styles = (scan.lf > 0) + (scan.crlf > 0) + (scan.cr > 0);
+	if (nr_styles > 1)
+		rb_endings = CSTR2SYM("mixed");
+	else if (scan.lf > 0)
+		rb_endings = CSTR2SYM("lf");
+	else if (scan.crlf > 0)
+		rb_endings = CSTR2SYM("crlf");
+	else if (scan.cr > 0)
+		rb_endings = CSTR2SYM("cr");
+
+	if (scan.size >= 2 && scan.data[0] == 0xFF && scan.data[1] == 0xFE)
+		encoding = rb_enc_find("UTF-16LE");
+	else if (scan.size >= 2 && scan.data[0] == 0xFE && scan.data[1] == 0xFF)
+		encoding = rb_enc_find("UTF-16BE");
+	else if (binary)
+		encoding = rb_ascii8bit_encoding();
+	else if (!scan.high_bytes)
+		encoding = rb_usascii_encoding();
+	else if (scan.utf8_valid)
+		encoding = rb_utf8_encoding();
+	else
+		encoding = rb_ascii8bit_encoding();
+
+	rb_hash_aset(rb_stats, CSTR2SYM("loc"), SIZET2NUM(scan.loc));
+	rb_hash_aset(rb_stats, CSTR2SYM("sloc"), SIZET2NUM(scan.sloc));
+	rb_hash_aset(rb_stats, CSTR2SYM("binary"), binary ? Qtrue : Qfalse);
+	rb_hash_aset(rb_stats, CSTR2SYM("line_endings"), rb_endings);
+	rb_hash_aset(rb_stats, CSTR2SYM("longest_line"), SIZET2NUM(scan.longest_line));
+	rb_hash_aset(rb_stats, CSTR2SYM("encoding"), rb_enc_from_encoding(encoding));
+
+	return rb_stats;
+}
+
+#define LINE_INDEX_CACHE_IVAR "__line_index_cache"
+#define LINE_INDEX_CACHE_BYTES_IVAR "__line_index_cache_bytes"
+#define LINE_INDEX_CACHE_BYTES (32 * 1024 * 1024)
+
+struct blob_line_index {
+	const char *data;
+	size_t size;
+	size_t nr_lines;
+	unsigned char *offsets;
+};
+
+/*
+ * Return where the line after the one at +scan+ starts, or +end+. Lines
+ * end in LF, CRLF or a bare CR, like in rugged_text_scan().
+ */
+static const char *blob_line_next(const char *scan, const char *end)
+{
+	for (; scan < end; ++scan) {
+		if (*scan == '\n')
+			return scan + 1;
+		if (*scan == '\r')
+			return (scan + 1 < end && scan[1] == '\n') ? scan + 2 : scan + 1;
+	}
+
+	return end;
+}
+
+/*
+ * A line starts at the beginning of the blob and after every line ending,
+ * except for the one at the very end: this matches Blob#loc.
+ */
+static void *blob_line_index_count(void *payload)
+{
+	struct blob_line_index *idx = payload;
+	const char *scan = idx->data, *end = idx->data + idx->size;
+
+	idx->nr_lines = idx->size ? 1 : 0;
+	while ((scan = blob_line_next(scan, end)) < end)
+		idx->nr_lines++;
+
+	return NULL;
+}
+
+static void *blob_line_index_fill(void *payload)
+{
+	struct blob_line_index *idx = payload;
+	const char *scan = idx->data, *end = idx->data + idx->size;
+	unsigned char *out = idx->offsets;
+
+	if (idx->size) {
+		put_u32_le(out, 0);
+		out += 4;
 	}
 
-	if (data[-1] != '\n' && data[-1] != '\r')
-		loc++;
+	while ((scan = blob_line_next(scan, end)) < end) {
+		put_u32_le(out, (uint32_t)(scan - idx->data));
+		out += 4;
+	}
 
-	return INT2FIX(loc);
+	put_u32_le(out, (uint32_t)idx->size);
+	return NULL;
 }
 
+static VALUE blob_line_index_build(git_blob *blob)
+{
+	struct blob_line_index idx;
+	VALUE rb_index;
+	int without_gvl;
+
+	idx.data = git_blob_rawcontent(blob);
+	idx.size = (size_t)git_blob_rawsize(blob);
+
+	if (idx.size > UINT32_MAX)
+		rb_raise(rb_eRangeError, "blob is too large to be indexed");
+
+	without_gvl = idx.size >= BLOB_TEXT_SCAN_WITHOUT_GVL;
+
+	if (without_gvl)
+		rugged_without_gvl(blob_line_index_count, &idx, NULL, NULL);
+	else
+		blob_line_index_count(&idx);
+
+	/* Nobody else can see the string yet, so it's safe to fill it without the GVL */
+	rb_index = rb_str_new(NULL, 4 * (idx.nr_lines + 1));
+	idx.offsets = (unsigned char *)RSTRING_PTR(rb_index);
+
+	if (without_gvl)
+		rugged_without_gvl(blob_line_index_fill, &idx, NULL, NULL);
+	else
+		blob_line_index_fill(&idx);
+
+	return rb_obj_freeze(rb_index);
+}
 
 /*
  *  call-seq:
- *    blob.sloc -> int
+ *    blob.line_index -> string
  *
- *  Return the number of non-empty code lines for the blob,
- *  assuming the blob is plaintext (i.e. not binary)
+ *  Return the line index of the blob: a frozen binary string holding the
+ *  byte offset where each line starts, followed by the size of the blob,
+ *  all as little-endian 32-bit integers. Lines are split the same way as
+ *  in Blob#loc, so the index has <tt>blob.loc + 1</tt> entries.
+ *
+ *  The index is built once per blob and cached by blob OID in the owning
+ *  repository, which keeps up to 32MB worth of the most recently used
+ *  indexes. It can also be stored elsewhere and passed back to
+ *  Blob#lines.
  */
-static VALUE rb_git_blob_sloc(VALUE self)
+static VALUE rb_git_blob_line_index(VALUE self)
 {
+	VALUE rb_repo = rugged_owner(self);
+	VALUE rb_cache, rb_bytes, rb_key, rb_index;
 	git_blob *blob;
-	const char *data, *data_end;
-	size_t sloc = 0;
+	long bytes;
 
 	Data_Get_Struct(self, git_blob, blob);
 
-	data = git_blob_rawcontent(blob);
-	data_end = data + git_blob_rawsize(blob);
+	rb_cache = rb_iv_get(rb_repo, LINE_INDEX_CACHE_IVAR);
+	if (NIL_P(rb_cache)) {
+		rb_cache = rb_hash_new();
+		rb_iv_set(rb_repo, LINE_INDEX_CACHE_IVAR, rb_cache);
+		rb_iv_set(rb_repo, LINE_INDEX_CACHE_BYTES_IVAR, INT2FIX(0));
+	}
+
+	rb_key = rugged_create_oid(git_blob_id(blob));
+	rb_index = rb_hash_aref(rb_cache, rb_key);
+	if (!NIL_P(rb_index)) {
+		/* Hashes keep insertion order: move it to the back, last to be evicted */
+		rb_hash_delete(rb_cache, rb_key);
+		rb_hash_aset(rb_cache, rb_key, rb_index);
+		return rb_index;
+	}
 
-	if (data == data_end)
-		return INT2FIX(0);
+	rb_index = blob_line_index_build(blob);
+	if (RSTRING_LEN(rb_index) > LINE_INDEX_CACHE_BYTES)
+		return rb_index;
 
-	/* go through the whole blob, counting lines
-	 * that are not empty */
-	while (data < data_end) {
-		if (*data++ == '\n') {
-			while (data < data_end && isspace(*data))
-				data++;
+	/* Evict the least recently used indexes until the new one fits */
+	rb_bytes = rb_iv_get(rb_repo, LINE_INDEX_CACHE_BYTES_IVAR);
+	bytes = NIL_P(rb_bytes) ? 0 : FIX2LONG(rb_bytes);
 
-			sloc++;
-		}
+	while (bytes + RSTRING_LEN(rb_index) > LINE_INDEX_CACHE_BYTES && RHASH_SIZE(rb_cache) > 0) {
+		VALUE rb_oldest = rb_funcall(rb_cache, rb_intern("shift"), 0);
+		bytes -= RSTRING_LEN(rb_ary_entry(rb_oldest, 1));
+	}
+
+	rb_hash_aset(rb_cache, rb_key, rb_index);
+	rb_iv_set(rb_repo, LINE_INDEX_CACHE_BYTES_IVAR, LONG2FIX(bytes + RSTRING_LEN(rb_index)));
+
+	return rb_index;
+}
+
+/*
+ *  call-seq:
+ *    blob.lines(from, to, line_index = nil) -> string or nil
+ *
+ *  Return the lines +from+ to +to+ (both included, counting from 1) of the
+ *  blob as a single +String+ with their line endings, created with
+ *  Encoding.default_external like Blob#text. +to+ is capped at the last
+ *  line of the blob; +nil+ is returned if +from+ is past it.
+ *
+ *  The lines are found through the line index of the blob (see
+ *  Blob#line_index), so once it exists this only takes time proportional
+ *  to the size of the range. A +line_index+ previously returned for the
+ *  same blob can be given to skip the cache lookup.
+ */
+static VALUE rb_git_blob_lines(int argc, VALUE *argv, VALUE self)
+{
+	VALUE rb_from, rb_to, rb_index;
+	const unsigned char *offsets;
+	const char *content;
+	git_blob *blob;
+	size_t size, nr_lines, start, end;
+	long from, to;
+
+	rb_scan_args(argc, argv, "21", &rb_from, &rb_to, &rb_index);
+	Data_Get_Struct(self, git_blob, blob);
+
+	from = NUM2LONG(rb_from);
+	to = NUM2LONG(rb_to);
+	if (from < 1)
+		rb_raise(rb_eArgError, "line numbers start at 1");
+
+	content = git_blob_rawcontent(blob);
+	size = (size_t)git_blob_rawsize(blob);
+
+	if (NIL_P(rb_index)) {
+		rb_index = rb_git_blob_line_index(self);
+	} else {
+		Check_Type(rb_index, T_STRING);
+		if (RSTRING_LEN(rb_index) < 4 || RSTRING_LEN(rb_index) % 4 != 0 ||
+			get_u32_le((const unsigned char *)RSTRING_END(rb_index) - 4) != size)
+			rb_raise(rb_eArgError, "the line index doesn't belong to this blob");
 	}
 
-	/* last line without trailing '\n'? */
-	if (data[-1] != '\n')
-		sloc++;
+	offsets = (const unsigned char *)RSTRING_PTR(rb_index);
+	nr_lines = RSTRING_LEN(rb_index) / 4 - 1;
+
+	if ((size_t)from > nr_lines)
+		return Qnil;
+	if (to < from)
+		return rb_external_str_new("", 0);
+	if ((size_t)to > nr_lines)
+		to = (long)nr_lines;
+
+	start = get_u32_le(offsets + 4 * (from - 1));
+	end = get_u32_le(offsets + 4 * to);
+	if (start > end || end > size)
+		rb_raise(rb_eArgError, "the line index doesn't belong to this blob");
+
+	RB_GC_GUARD(rb_index);
 
-	return INT2FIX(sloc);
+	return rb_external_str_new(content + start, end - start);
 }
 
 /*
@@ -560,6 +1124,179 @@ static VALUE rb_git_blob_to_buffer(int argc, VALUE *argv, VALUE self)
 	return rb_ret;
 }
 
+#define BLOB_BUFFERS_BATCH 64
+
+struct blob_buffer {
+	git_oid oid;
+	git_blob *blob;
+};
+
+typedef struct {
+	rugged_batch_task base;
+	git_repository *repo;
+	struct blob_buffer *buffers;
+	size_t count;
+} blob_buffers_task;
+
+static int blob_buffer_cmp(const void *a, const void *b)
+{
+	return git_oid_cmp(&((const struct blob_buffer *)a)->oid,
+		&((const struct blob_buffer *)b)->oid);
+}
+
+static void blob_buffers_task_run(void *payload)
+{
+	blob_buffers_task *task = payload;
+	size_t i;
+
+	for (i = 0; i < task->count; ++i) {
+		struct blob_buffer *buffer = &task->buffers[i];
+		int error;
+
+		if (buffer->blob)
+			continue;
+
+		/* Missing objects and objects that aren't blobs are both ENOTFOUND */
+		error = git_blob_lookup(&buffer->blob, task->repo, &buffer->oid);
+		if (error == GIT_ENOTFOUND) {
+			buffer->blob = NULL;
+			giterr_clear();
+		} else if (error < 0) {
+			rugged_batch_task_set_error(&task->base, error);
+			break;
+		}
+	}
+
+	task->base.done = 1;
+}
+
+/*
+ *  call-seq:
+ *    Blob.to_buffers(repository, oids, max_bytes: nil) -> array
+ *
+ *  Batched version of Blob.to_buffer. Looks up and inflates all the blobs
+ *  in +oids+ in a single call, on the thread pool and without holding the
+ *  GVL, and returns an array with a <tt>[content, size]</tt> pair for each
+ *  of them, in the same order as +oids+.
+ *
+ *  +content+ is cut to at most +max_bytes+ bytes when given; +size+ is
+ *  always the full size of the blob. Objects that don't exist or that
+ *  aren't blobs are returned as +nil+. Repeated OIDs are only read once.
+ */
+static VALUE rb_git_blob_to_buffers(int argc, VALUE *argv, VALUE self)
+{
+	VALUE rb_repo, rb_oids, rb_options, rb_max_bytes = Qnil;
+	VALUE rb_result = Qnil;
+	git_repository *repo;
+	struct blob_buffer *buffers;
+	size_t *slots;
+	blob_buffers_task *tasks;
+	size_t i, count, nr_buffers = 0, nr_tasks, max_bytes = SIZE_MAX;
+	int error = GIT_OK, os_errno, exception = 0;
+
+	rb_scan_args(argc, argv, "2:", &rb_repo, &rb_oids, &rb_options);
+
+	rugged_check_repo(rb_repo);
+	Data_Get_Struct(rb_repo, git_repository, repo);
+	Check_Type(rb_oids, T_ARRAY);
+
+	if (!NIL_P(rb_options))
+		rb_max_bytes = rb_hash_aref(rb_options, CSTR2SYM("max_bytes"));
+
+	if (!NIL_P(rb_max_bytes)) {
+		Check_Type(rb_max_bytes, T_FIXNUM);
+		if (FIX2LONG(rb_max_bytes) >= 0)
+			max_bytes = (size_t)FIX2LONG(rb_max_bytes);
+	}
+
+	count = RARRAY_LEN(rb_oids);
+	for (i = 0; i < count; ++i) {
+		VALUE rb_oid = rb_ary_entry(rb_oids, i);
+
+		Check_Type(rb_oid, T_STRING);
+		if (RSTRING_LEN(rb_oid) != GIT_OID_HEXSZ)
+			rb_raise(rb_eArgError, "invalid OID: %s", StringValueCStr(rb_oid));
+	}
+
+	buffers = xcalloc(count ? count : 1, sizeof(struct blob_buffer));
+	slots = xmalloc((count ? count : 1) * sizeof(size_t));
+
+	for (i = 0; i < count; ++i) {
+		VALUE rb_oid = rb_ary_entry(rb_oids, i);
+
+		if (git_oid_fromstr(&buffers[i].oid, RSTRING_PTR(rb_oid)) < 0) {
+			xfree(buffers);
+			xfree(slots);
+			rb_raise(rb_eArgError, "invalid OID: %s", StringValueCStr(rb_oid));
+		}
+	}
+
+	/*
+	 * Read every OID once, in sorted order: neighbouring tasks then share
+	 * the same fanout ranges of the pack indexes.
+	 */
+	if (count) {
+		qsort(buffers, count, sizeof(struct blob_buffer), blob_buffer_cmp);
+		for (i = 0; i < count; ++i) {
+			if (nr_buffers == 0 || !git_oid_equal(&buffers[nr_buffers - 1].oid, &buffers[i].oid))
+				git_oid_cpy(&buffers[nr_buffers++].oid, &buffers[i].oid);
+		}
+	}
+
+	for (i = 0; i < count; ++i) {
+		struct blob_buffer key, *found;
+
+		git_oid_fromstr(&key.oid, RSTRING_PTR(rb_ary_entry(rb_oids, i)));
+		found = bsearch(&key, buffers, nr_buffers, sizeof(struct blob_buffer), blob_buffer_cmp);
+		slots[i] = found - buffers;
+	}
+
+	nr_tasks = (nr_buffers + BLOB_BUFFERS_BATCH - 1) / BLOB_BUFFERS_BATCH;
+	tasks = xcalloc(nr_tasks ? nr_tasks : 1, sizeof(blob_buffers_task));
+	for (i = 0; i < nr_tasks; ++i) {
+		tasks[i].repo = repo;
+		tasks[i].buffers = buffers + i * BLOB_BUFFERS_BATCH;
+		tasks[i].count = i + 1 < nr_tasks ? BLOB_BUFFERS_BATCH : nr_buffers - i * BLOB_BUFFERS_BATCH;
+	}
+
+	os_errno = rugged_pool_run_tasks(tasks, sizeof(blob_buffers_task), nr_tasks, blob_buffers_task_run, &exception);
+	if (!os_errno && !exception)
+		error = rugged_batch_tasks_error(tasks, sizeof(blob_buffers_task), nr_tasks);
+
+	if (!os_errno && !exception && error == GIT_OK) {
+		rb_result = rb_ary_new2(count);
+
+		for (i = 0; i < count; ++i) {
+			git_blob *blob = buffers[slots[i]].blob;
+			VALUE rb_pair;
+			size_t size;
+
+			if (!blob) {
+				rb_ary_push(rb_result, Qnil);
+				continue;
+			}
+
+			size = (size_t)git_blob_rawsize(blob);
+			rb_pair = rb_ary_new2(2);
+			rb_ary_push(rb_pair, rb_str_new(git_blob_rawcontent(blob), size < max_bytes ? size : max_bytes));
+			rb_ary_push(rb_pair, SIZET2NUM(size));
+			rb_ary_push(rb_result, rb_pair);
+		}
+	}
+
+	for (i = 0; i < nr_tasks; ++i)
+		free(tasks[i].base.error_message);
+	for (i = 0; i < nr_buffers; ++i)
+		git_blob_free(buffers[i].blob);
+	xfree(tasks);
+	xfree(slots);
+	xfree(buffers);
+
+	rugged_batch_tasks_raise(os_errno, exception, error);
+
+	return rb_result;
+}
+
 static VALUE rb_git_blob_sig_new(int argc, VALUE *argv, VALUE klass)
 {
 	int error, opts = 0;
@@ -611,6 +1348,461 @@ static VALUE rb_git_blob_sig_compare(VALUE self, VALUE rb_sig_a, VALUE rb_sig_b)
 	return INT2FIX(result);
 }
 
+#define SIG_MATRIX_BUILD_BATCH 32
+#define SIG_MATRIX_COMPARE_BATCH 32768
+
+struct sig_matrix_entry {
+	git_hashsig *sig;
+	const char *data;
+	size_t size;
+	int owned;
+};
+
+struct sig_matrix_pair {
+	size_t a, b;
+	int score;
+};
+
+struct sig_matrix {
+	struct sig_matrix_entry *a, *b;
+	size_t nr_a, nr_b;
+	int self;
+	int threshold;
+	git_hashsig_option_t opts;
+};
+
+typedef struct {
+	rugged_batch_task base;
+	struct sig_matrix *matrix;
+	struct sig_matrix_entry *entries;
+	size_t start, end;
+	struct sig_matrix_pair *pairs;
+	size_t nr_pairs, alloc_pairs;
+} sig_matrix_task;
+
+static void sig_matrix_build_run(void *payload)
+{
+	sig_matrix_task *task = payload;
+	size_t i;
+
+	for (i = task->start; i < task->end; ++i) {
+		struct sig_matrix_entry *entry = &task->entries[i];
+		int error;
+
+		if (!entry->owned || entry->sig)
+			continue;
+
+		/* Files too small to have a signature never match anything */
+		error = git_hashsig_create(&entry->sig, entry->data, entry->size, task->matrix->opts);
+		if (error == GIT_EBUFS) {
+			entry->sig = NULL;
+			giterr_clear();
+		} else if (error < 0) {
+			rugged_batch_task_set_error(&task->base, error);
+			break;
+		}
+	}
+
+	task->base.done = 1;
+}
+
+static int sig_matrix_push(sig_matrix_task *task, size_t a, size_t b, int score)
+{
+	if (task->nr_pairs == task->alloc_pairs) {
+		size_t alloc = task->alloc_pairs ? task->alloc_pairs * 2 : 64;
+		struct sig_matrix_pair *pairs = realloc(task->pairs, alloc * sizeof(struct sig_matrix_pair));
+
+		if (pairs == NULL) {
+			giterr_set_oom();
+			return GIT_ERROR;
+		}
+		task->pairs = pairs;
+		task->alloc_pairs = alloc;
+	}
+
+	task->pairs[task->nr_pairs].a = a;
+	task->pairs[task->nr_pairs].b = b;
+	task->pairs[task->nr_pairs].score = score;
+	task->nr_pairs++;
+	return GIT_OK;
+}
+
+static void sig_matrix_compare_run(void *payload)
+{
+	sig_matrix_task *task = payload;
+	const struct sig_matrix *matrix = task->matrix;
+	size_t i, j;
+	int score, error = GIT_OK;
+
+	/* A resubmitted task starts over */
+	task->nr_pairs = 0;
+
+	for (i = task->start; i < task->end && error == GIT_OK; ++i) {
+		if (!matrix->a[i].sig)
+			continue;
+
+		for (j = matrix->self ? i + 1 : 0; j < matrix->nr_b; ++j) {
+			if (!matrix->b[j].sig)
+				continue;
+
+			score = git_hashsig_compare(matrix->a[i].sig, matrix->b[j].sig);
+			if (score < 0)
+				error = score;
+			else if (score >= matrix->threshold)
+				error = sig_matrix_push(task, i, j, score);
+
+			if (error < 0)
+				break;
+		}
+	}
+
+	if (error < 0)
+		rugged_batch_task_set_error(&task->base, error);
+	task->base.done = 1;
+}
+
+static void sig_matrix_entry_init(struct sig_matrix_entry *entry, VALUE rb_sig)
+{
+	if (rb_obj_is_kind_of(rb_sig, rb_cRuggedBlobSig)) {
+		Data_Get_Struct(rb_sig, git_hashsig, entry->sig);
+	} else if (rb_obj_is_kind_of(rb_sig, rb_cRuggedBlob)) {
+		git_blob *blob;
+		Data_Get_Struct(rb_sig, git_blob, blob);
+
+		entry->data = git_blob_rawcontent(blob);
+		entry->size = (size_t)git_blob_rawsize(blob);
+		entry->owned = 1;
+	} else {
+		entry->data = RSTRING_PTR(rb_sig);
+		entry->size = RSTRING_LEN(rb_sig);
+		entry->owned = 1;
+	}
+}
+
+/*
+ * Check the items of +rb_sigs+ and return a copy of it that keeps them
+ * alive while the signatures are built; strings are frozen so that they
+ * can be read without the GVL.
+ */
+static VALUE sig_matrix_check(VALUE rb_sigs)
+{
+	VALUE rb_items;
+	long i;
+
+	Check_Type(rb_sigs, T_ARRAY);
+	rb_items = rb_ary_new2(RARRAY_LEN(rb_sigs));
+
+	for (i = 0; i < RARRAY_LEN(rb_sigs); ++i) {
+		VALUE rb_sig = rb_ary_entry(rb_sigs, i);
+
+		if (TYPE(rb_sig) == T_STRING) {
+			rb_sig = rb_str_new_frozen(rb_sig);
+		} else if (!rb_obj_is_kind_of(rb_sig, rb_cRuggedBlobSig) &&
+			!rb_obj_is_kind_of(rb_sig, rb_cRuggedBlob)) {
+			rb_raise(rb_eTypeError,
+				"wrong argument type %s (expected Rugged::Blob::HashSignature, Rugged::Blob or String)",
+				rb_obj_classname(rb_sig));
+		}
+
+		rb_ary_push(rb_items, rb_sig);
+	}
+
+	return rb_items;
+}
+
+/*
+ *  call-seq:
+ *    HashSignature.similarity_matrix(sigs_a, sigs_b = nil, threshold: 50, options: 0) -> array
+ *
+ *  Compare every item of +sigs_a+ with every item of +sigs_b+ and return
+ *  the pairs whose similarity score is at least +threshold+, as an array
+ *  of <tt>[index_a, index_b, score]</tt> triples ordered by +index_a+ and
+ *  then +index_b+.
+ *
+ *  The items can be Rugged::Blob::HashSignature instances, or Rugged::Blob
+ *  instances and strings, whose signatures are then built with +options+
+ *  (see HashSignature.new). Blobs and strings that are too small to have a
+ *  signature don't match anything.
+ *
+ *  When +sigs_b+ is omitted, +sigs_a+ is compared with itself and only the
+ *  pairs with <tt>index_a < index_b</tt> are returned.
+ *
+ *  Both the signatures and the comparisons are computed on the thread pool,
+ *  without holding the GVL.
+ */
+static VALUE rb_git_blob_sig_similarity_matrix(int argc, VALUE *argv, VALUE klass)
+{
+	VALUE rb_sigs_a, rb_sigs_b, rb_options, rb_value, rb_result = Qnil;
+	struct sig_matrix matrix;
+	struct sig_matrix_entry *entries;
+	sig_matrix_task *tasks = NULL;
+	size_t i, j, nr_entries, nr_tasks, rows;
+	int error = GIT_OK, os_errno = 0, exception = 0;
+
+	rb_scan_args(argc, argv, "11:", &rb_sigs_a, &rb_sigs_b, &rb_options);
+
+	memset(&matrix, 0, sizeof(matrix));
+	matrix.threshold = 50;
+
+	if (!NIL_P(rb_options)) {
+		rb_value = rb_hash_aref(rb_options, CSTR2SYM("threshold"));
+		if (!NIL_P(rb_value)) {
+			matrix.threshold = NUM2INT(rb_value);
+			if (matrix.threshold < 0 || matrix.threshold > 100)
+				rb_raise(rb_eArgError, "threshold must be between 0 and 100");
+		}
+
+		rb_value = rb_hash_aref(rb_options, CSTR2SYM("options"));
+		if (!NIL_P(rb_value)) {
+			Check_Type(rb_value, T_FIXNUM);
+			matrix.opts = FIX2INT(rb_value);
+		}
+	}
+
+	matrix.self = NIL_P(rb_sigs_b);
+	rb_sigs_a = sig_matrix_check(rb_sigs_a);
+	rb_sigs_b = matrix.self ? rb_sigs_a : sig_matrix_check(rb_sigs_b);
+
+	matrix.nr_a = RARRAY_LEN(rb_sigs_a);
+	matrix.nr_b = RARRAY_LEN(rb_sigs_b);
+	nr_entries = matrix.nr_a + (matrix.self ? 0 : matrix.nr_b);
+
+	entries = xcalloc(nr_entries ? nr_entries : 1, sizeof(struct sig_matrix_entry));
+	matrix.a = entries;
+	matrix.b = matrix.self ? entries : entries + matrix.nr_a;
+
+	for (i = 0; i < matrix.nr_a; ++i)
+		sig_matrix_entry_init(&matrix.a[i], rb_ary_entry(rb_sigs_a, i));
+	for (i = 0; !matrix.self && i < matrix.nr_b; ++i)
+		sig_matrix_entry_init(&matrix.b[i], rb_ary_entry(rb_sigs_b, i));
+
+	/* Build the missing signatures first */
+	nr_tasks = (nr_entries + SIG_MATRIX_BUILD_BATCH - 1) / SIG_MATRIX_BUILD_BATCH;
+	if (nr_tasks) {
+		tasks = xcalloc(nr_tasks, sizeof(sig_matrix_task));
+		for (i = 0; i < nr_tasks; ++i) {
+			tasks[i].matrix = &matrix;
+			tasks[i].entries = entries;
+			tasks[i].start = i * SIG_MATRIX_BUILD_BATCH;
+			tasks[i].end = i + 1 < nr_tasks ? tasks[i].start + SIG_MATRIX_BUILD_BATCH : nr_entries;
+		}
+
+		os_errno = rugged_pool_run_tasks(tasks, sizeof(sig_matrix_task), nr_tasks, sig_matrix_build_run, &exception);
+		if (!os_errno && !exception)
+			error = rugged_batch_tasks_error(tasks, sizeof(sig_matrix_task), nr_tasks);
+
+		for (i = 0; i < nr_tasks; ++i)
+			free(tasks[i].base.error_message);
+		xfree(tasks);
+		tasks = NULL;
+	}
+
+	if (os_errno || exception || error < 0)
+		goto cleanup;
+
+	/* Then split the rows of the matrix so that every task does about the same work */
+	rows = matrix.nr_b ? SIG_MATRIX_COMPARE_BATCH / matrix.nr_b : matrix.nr_a;
+	if (rows == 0)
+		rows = 1;
+
+	nr_tasks = matrix.nr_b ? (matrix.nr_a + rows - 1) / rows : 0;
+	if (nr_tasks) {
+		tasks = xcalloc(nr_tasks, sizeof(sig_matrix_task));
+		for (i = 0; i < nr_tasks; ++i) {
+			tasks[i].matrix = &matrix;
+			tasks[i].start = i * rows;
+			tasks[i].end = i + 1 < nr_tasks ? tasks[i].start + rows : matrix.nr_a;
+		}
+
+		os_errno = rugged_pool_run_tasks(tasks, sizeof(sig_matrix_task), nr_tasks, sig_matrix_compare_run, &exception);
+		if (!os_errno && !exception)
+			error = rugged_batch_tasks_error(tasks, sizeof(sig_matrix_task), nr_tasks);
+	}
+
+	if (!os_errno && !exception && error == GIT_OK) {
+		rb_result = rb_ary_new();
+
+		for (i = 0; i < nr_tasks; ++i) {
+			for (j = 0; j < tasks[i].nr_pairs; ++j) {
+				const struct sig_matrix_pair *pair = &tasks[i].pairs[j];
+				VALUE rb_pair = rb_ary_new2(3);
+
+				rb_ary_push(rb_pair, SIZET2NUM(pair->a));
+				rb_ary_push(rb_pair, SIZET2NUM(pair->b));
+				rb_ary_push(rb_pair, INT2FIX(pair->score));
+				rb_ary_push(rb_result, rb_pair);
+			}
+		}
+	}
+
+	for (i = 0; i < nr_tasks; ++i) {
+		free(tasks[i].pairs);
+		free(tasks[i].base.error_message);
+	}
+	xfree(tasks);
+
+cleanup:
+	for (i = 0; i < nr_entries; ++i) {
+		if (entries[i].owned)
+			git_hashsig_free(entries[i].sig);
+	}
+	xfree(entries);
+
+	RB_GC_GUARD(rb_sigs_a);
+	RB_GC_GUARD(rb_sigs_b);
+
+	rugged_batch_tasks_raise(os_errno, exception, error);
+
+	return rb_result;
+}
+
+/*
+ * libgit2 doesn't expose the contents of a git_hashsig, so dumping and
+ * loading one relies on the layout of `struct git_hashsig` in the
+ * libgit2 version we build against (src/hashsig.c). The layout is
+ * checked against a known signature before it is used.
+ */
+#define HASHSIG_HEAP_SIZE ((1 << 7) - 1)
+
+struct rugged_hashsig_heap {
+	int size, asize;
+	int (*cmp)(const void *a, const void *b, void *payload);
+	uint32_t values[HASHSIG_HEAP_SIZE];
+};
+
+struct rugged_hashsig {
+	struct rugged_hashsig_heap mins;
+	struct rugged_hashsig_heap maxs;
+	git_hashsig_option_t opt;
+	int considered;
+};
+
+#define HASHSIG_DUMP_MAGIC "HSIG"
+#define HASHSIG_DUMP_VERSION 1
+#define HASHSIG_DUMP_HEADER 12
+
+static const char hashsig_probe[] = "a\nb\nc\nd\ne\n";
+
+static int hashsig_layout_ok(void)
+{
+	static int checked = 0, ok = 0;
+	struct rugged_hashsig *sig;
+	git_hashsig *probe;
+
+	if (checked)
+		return ok;
+	checked = 1;
+
+	if (git_hashsig_create(&probe, hashsig_probe, sizeof(hashsig_probe) - 1, GIT_HASHSIG_ALLOW_SMALL_FILES) < 0) {
+		giterr_clear();
+		return 0;
+	}
+
+	sig = (struct rugged_hashsig *)probe;
+	ok = sig->mins.size == 5 && sig->maxs.size == 5 &&
+		sig->mins.asize == HASHSIG_HEAP_SIZE && sig->maxs.asize == HASHSIG_HEAP_SIZE &&
+		sig->mins.cmp != NULL && sig->maxs.cmp != NULL && sig->mins.cmp != sig->maxs.cmp &&
+		sig->opt == GIT_HASHSIG_ALLOW_SMALL_FILES && sig->considered == 5;
+
+	git_hashsig_free(probe);
+	return ok;
+}
+
+static void hashsig_check_layout(void)
+{
+	if (!hashsig_layout_ok())
+		rb_raise(rb_eNotImpError, "HashSignature serialization is not supported by this libgit2");
+}
+
+/*
+ *  call-seq:
+ *    sig.dump -> string
+ *
+ *  Serialize the signature into a compact binary string, that can be
+ *  stored and turned back into a signature with HashSignature.load,
+ *  without reading the original content again.
+ *
+ *  The format is stable across processes and machines, but only between
+ *  builds of Rugged against the same libgit2 version.
+ */
+static VALUE rb_git_blob_sig_dump(VALUE self)
+{
+	struct rugged_hashsig *sig;
+	unsigned char *out;
+	VALUE rb_dump;
+	int i;
+
+	hashsig_check_layout();
+	Data_Get_Struct(self, struct rugged_hashsig, sig);
+
+	rb_dump = rb_str_new(NULL, HASHSIG_DUMP_HEADER + 4 * (sig->mins.size + sig->maxs.size));
+	out = (unsigned char *)RSTRING_PTR(rb_dump);
+
+	memcpy(out, HASHSIG_DUMP_MAGIC, 4);
+	out[4] = HASHSIG_DUMP_VERSION;
+	out[5] = (unsigned char)sig->opt;
+	out[6] = (unsigned char)sig->mins.size;
+	out[7] = (unsigned char)sig->maxs.size;
+	put_u32_le(out + 8, (uint32_t)sig->considered);
+	out += HASHSIG_DUMP_HEADER;
+
+	for (i = 0; i < sig->mins.size; ++i, out += 4)
+		put_u32_le(out, sig->mins.values[i]);
+	for (i = 0; i < sig->maxs.size; ++i, out += 4)
+		put_u32_le(out, sig->maxs.values[i]);
+
+	return rb_dump;
+}
+
+/*
+ *  call-seq:
+ *    HashSignature.load(string) -> sig
+ *
+ *  Create a signature from the output of HashSignature#dump. Raises
+ *  ArgumentError if +string+ isn't a valid dump.
+ */
+static VALUE rb_git_blob_sig_load(VALUE klass, VALUE rb_dump)
+{
+	struct rugged_hashsig *sig;
+	const unsigned char *in;
+	git_hashsig *out;
+	int i, nr_mins, nr_maxs;
+
+	hashsig_check_layout();
+	Check_Type(rb_dump, T_STRING);
+
+	in = (const unsigned char *)RSTRING_PTR(rb_dump);
+	if (RSTRING_LEN(rb_dump) < HASHSIG_DUMP_HEADER || memcmp(in, HASHSIG_DUMP_MAGIC, 4) != 0)
+		rb_raise(rb_eArgError, "invalid HashSignature dump");
+	if (in[4] != HASHSIG_DUMP_VERSION)
+		rb_raise(rb_eArgError, "unsupported HashSignature dump version %d", in[4]);
+
+	nr_mins = in[6];
+	nr_maxs = in[7];
+	if (nr_mins > HASHSIG_HEAP_SIZE || nr_maxs > HASHSIG_HEAP_SIZE ||
+		RSTRING_LEN(rb_dump) != HASHSIG_DUMP_HEADER + 4 * (nr_mins + nr_maxs))
+		rb_raise(rb_eArgError, "invalid HashSignature dump");
+
+	/* Start from a real signature so the heaps get libgit2's comparators */
+	rugged_exception_check(
+		git_hashsig_create(&out, hashsig_probe, sizeof(hashsig_probe) - 1, GIT_HASHSIG_ALLOW_SMALL_FILES)
+	);
+
+	sig = (struct rugged_hashsig *)out;
+	sig->opt = (git_hashsig_option_t)in[5];
+	sig->mins.size = nr_mins;
+	sig->maxs.size = nr_maxs;
+	sig->considered = (int)get_u32_le(in + 8);
+	in += HASHSIG_DUMP_HEADER;
+
+	for (i = 0; i < nr_mins; ++i, in += 4)
+		sig->mins.values[i] = get_u32_le(in);
+	for (i = 0; i < nr_maxs; ++i, in += 4)
+		sig->maxs.values[i] = get_u32_le(in);
+
+	return Data_Wrap_Struct(klass, NULL, &git_hashsig_free, out);
+}
+
 void Init_rugged_blob(void)
 {
 	id_read = rb_intern("read");
@@ -620,9 +1812,14 @@ void Init_rugged_blob(void)
 	rb_define_method(rb_cRuggedBlob, "size", rb_git_blob_rawsize, 0);
 	rb_define_method(rb_cRuggedBlob, "content", rb_git_blob_content_GET, -1);
 	rb_define_method(rb_cRuggedBlob, "text", rb_git_blob_text_GET, -1);
+	rb_define_method(rb_cRuggedBlob, "each_chunk", rb_git_blob_each_chunk, -1);
+	rb_define_method(rb_cRuggedBlob, "write_to", rb_git_blob_write_to, -1);
 	rb_define_method(rb_cRuggedBlob, "sloc", rb_git_blob_sloc, 0);
 	rb_define_method(rb_cRuggedBlob, "loc", rb_git_blob_loc, 0);
 	rb_define_method(rb_cRuggedBlob, "binary?", rb_git_blob_is_binary, 0);
+	rb_define_method(rb_cRuggedBlob, "text_stats", rb_git_blob_text_stats, 0);
+	rb_define_method(rb_cRuggedBlob, "line_index", rb_git_blob_line_index, 0);
+	rb_define_method(rb_cRuggedBlob, "lines", rb_git_blob_lines, -1);
 	rb_define_method(rb_cRuggedBlob, "diff", rb_git_blob_diff, -1);
 
 	rb_define_singleton_method(rb_cRuggedBlob, "from_buffer", rb_git_blob_from_buffer, 2);
@@ -631,8 +1828,12 @@ void Init_rugged_blob(void)
 	rb_define_singleton_method(rb_cRuggedBlob, "from_io", rb_git_blob_from_io, -1);
 
 	rb_define_singleton_method(rb_cRuggedBlob, "to_buffer", rb_git_blob_to_buffer, -1);
+	rb_define_singleton_method(rb_cRuggedBlob, "to_buffers", rb_git_blob_to_buffers, -1);
 
 	rb_cRuggedBlobSig = rb_define_class_under(rb_cRuggedBlob, "HashSignature", rb_cObject);
 	rb_define_singleton_method(rb_cRuggedBlobSig, "new", rb_git_blob_sig_new, -1);
 	rb_define_singleton_method(rb_cRuggedBlobSig, "compare", rb_git_blob_sig_compare, 2);
+	rb_define_singleton_method(rb_cRuggedBlobSig, "similarity_matrix", rb_git_blob_sig_similarity_matrix, -1);
+	rb_define_singleton_method(rb_cRuggedBlobSig, "load", rb_git_blob_sig_load, 1);
+	rb_define_method(rb_cRuggedBlobSig, "dump", rb_git_blob_sig_dump, 0);
 }
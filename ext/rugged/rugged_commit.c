@@ -587,66 +587,98 @@ static VALUE rb_git_commit_to_mbox(int argc, VALUE *argv, VALUE self)
 	return rb_email_patch;
 }
 
-typedef struct commit_stat_task {
+/*
+ * Per-commit work for the thread pool. Every task diffs a commit against
+ * its first parent; the trees are looked up with the GVL held, the diff
+ * itself runs on a pool worker.
+ */
+typedef struct commit_task {
+	rugged_batch_task batch;
+	git_repository *repo;
 	git_tree *tree, *parent_tree;
+} commit_task;
+
+static int commit_task_prepare(commit_task *task, git_repository *repo, git_commit *commit) {
+	int error;
+	git_commit *parent_commit;
+
+	task->repo = repo;
+
+	error = git_commit_parent(&parent_commit, commit, 0);
+	if (error == GIT_ENOTFOUND) {
+		parent_commit = NULL;
+		error = GIT_OK;
+	} else if (error != GIT_OK) {
+		return error;
+	}
+
+	if (parent_commit != NULL) {
+		error = git_commit_tree(&task->parent_tree, parent_commit);
+		git_commit_free(parent_commit);
+	}
+	if (error == GIT_OK)
+		error = git_commit_tree(&task->tree, commit);
+
+	return error;
+}
+
+static void commit_task_clear(commit_task *task) {
+	if (task->tree != NULL)
+		git_tree_free(task->tree);
+	if (task->parent_tree != NULL)
+		git_tree_free(task->parent_tree);
+	free(task->batch.error_message);
+}
+
+typedef struct commit_stat_task {
+	commit_task base;
+	const struct rugged_diff_budget *budget;
 	struct commit_stats *stats;
+	int cached;
 } commit_stat_task;
 
-typedef struct commit_stat_tasks {
-	git_repository *repo;
-	pthread_mutex_t mutex;
-	int top; // Make sure the top is thread-safe
-	size_t tasks_nr;
-	struct commit_stat_task *tasks;
-} commit_stat_tasks;
+static void commit_stat_task_run(void *payload) {
+	commit_stat_task *task = payload;
+	int error;
 
-static void* commit_stat_task_proc(void *_payload) {
-	int error = 0;
-	commit_stat_tasks *payload = (commit_stat_tasks *) _payload;
-	commit_stat_task *current_task;
-	struct commit_stats *current_stats;
-	git_repository *repo = payload->repo;
-
-	current_stats = xmalloc(sizeof(struct commit_stats));
-
-	for (;;) {
-	    if ((error = pthread_mutex_lock(&payload->mutex))) {
-	    	giterr_set(GITERR_OS, "Failed to lock mutex");
-	    	error = -1;
-	    	break;
-	    }
-	    if (payload->top >= payload->tasks_nr) {
-		    current_task = NULL;
-	    } else {
-		    current_task = &payload->tasks[payload->top];
-		    payload->top++;
-	    }
-	    if ((error = pthread_mutex_unlock(&payload->mutex))) {
-	    	giterr_set(GITERR_OS, "Failed to unlock mutex");
-	    	error = -1;
-	    	break;
-	    }
-	    if (current_task == NULL)
-	    	break;
-	    error = git_commit_stats_of(repo, current_task->tree, current_task->parent_tree, NULL,
-	    	                        &current_task->stats->adds, &current_task->stats->dels);
-	    if (error != GIT_OK)
-	    	break;
-	}
+	error = git_commit_stats_of(task->base.repo, task->base.tree, task->base.parent_tree, NULL,
+		task->budget, task->stats);
+	if (error != GIT_OK)
+		rugged_batch_task_set_error(&task->base.batch, error);
 
-	xfree(current_stats);
-	return (void *)(long) error;
+	task->base.batch.done = 1;
 }
 
-static VALUE rb_git_commit_stats(VALUE klass, VALUE rb_repo, VALUE rb_commits) {
+/*
+ *  call-seq:
+ *    Commit.stats(repo, commits, options = {}) -> stats
+ *
+ *  Compute the additions and deletions of each commit in +commits+
+ *  against its first parent, and return them as an array of
+ *  Rugged::Commit::Stats in the same order.
+ *
+ *  The +max_files+, +max_lines+ and +max_bytes+ options put a budget on
+ *  each commit's diff. A commit that runs out of budget stops being
+ *  diffed, and its stats report <tt>truncated?</tt> as +true+.
+ *
+ *  The diffs run on Rugged's shared native thread pool (see the
+ *  +thread_pool_size+ option in Rugged::Settings), and other Ruby threads
+ *  keep running while the calling thread waits for them. Commits already
+ *  in the stats cache (see Repository#stats_cache=) are not diffed again.
+ */
+static VALUE rb_git_commit_stats(int argc, VALUE *argv, VALUE klass) {
 	long error = 0;
-	int os_errno;
-	size_t i, j, arrlen, nr_threads;
-	VALUE rb_commit, rb_results = Qnil;
+	int os_errno = 0, exception = 0;
+	size_t i, arrlen;
+	VALUE rb_repo, rb_commits, rb_options, rb_commit, rb_results = Qnil;
 	git_repository *repo;
-	git_commit *commit, *parent_commit;
-	pthread_t *threads;
-	commit_stat_tasks tasks;
+	git_commit *commit;
+	commit_stat_task *tasks;
+	rugged_stats_cache *cache;
+	struct rugged_diff_budget budget;
+
+	rb_scan_args(argc, argv, "20:", &rb_repo, &rb_commits, &rb_options);
+	rugged_parse_diff_budget(&budget, rb_options);
 
 	Check_Type(rb_commits, T_ARRAY);
 	arrlen = RARRAY_LEN(rb_commits);
@@ -654,193 +686,260 @@ static VALUE rb_git_commit_stats(VALUE klass, VALUE rb_repo, VALUE rb_commits) {
 	rugged_check_repo(rb_repo);
 	Data_Get_Struct(rb_repo, git_repository, repo);
 
-	nr_threads = git_online_cpus();
-	nr_threads = arrlen < nr_threads ? arrlen : nr_threads;
-
-	threads = xmalloc(sizeof(pthread_t) * nr_threads);
-
-	tasks.tasks_nr = arrlen;
-	tasks.repo = repo;
-	tasks.top = 0;
-	tasks.tasks = xmalloc(sizeof(commit_stat_task) * arrlen);
-	if ((os_errno = pthread_mutex_init(&tasks.mutex, NULL))) {
-		goto WRONG;
-	}
-	memset(tasks.tasks, 0, sizeof(commit_stat_task) * arrlen);
+	cache = rugged_repo_stats_cache(rb_repo);
+	tasks = xcalloc(arrlen ? arrlen : 1, sizeof(commit_stat_task));
 
 	for (i = 0; i < arrlen; ++i) {
 		rb_commit = rb_ary_entry(rb_commits, i);
 		Data_Get_Struct(rb_commit, git_commit, commit);
 
-		error = git_commit_parent(&parent_commit, commit, 0);
-		if (error == GIT_ENOTFOUND) {
-			parent_commit = NULL;
-			error = GIT_OK;
-		} else if (error != GIT_OK) {
-			goto WRONG;
-		}
-
-		if (parent_commit != NULL) {
-			error = git_commit_tree(&tasks.tasks[i].parent_tree, parent_commit);
-			git_commit_free(parent_commit);
-		}
-		if (error == GIT_OK)
-			error = git_commit_tree(&tasks.tasks[i].tree, commit);
+		tasks[i].budget = &budget;
+		tasks[i].stats = xmalloc(sizeof(struct commit_stats));
+		memset(tasks[i].stats, 0, sizeof(struct commit_stats));
+		error = git_signature_dup(&tasks[i].stats->committer, git_commit_committer(commit));
+		if (error == GIT_OK) error = git_signature_dup(&tasks[i].stats->author, git_commit_author(commit));
 		if (error != GIT_OK)
 			goto WRONG;
 
-		tasks.tasks[i].stats = xmalloc(sizeof(struct commit_stats));
-		memset(tasks.tasks[i].stats, 0, sizeof(struct commit_stats));
-		error = git_signature_dup(&tasks.tasks[i].stats->committer, git_commit_committer(commit));
-		if (error == GIT_OK) error = git_signature_dup(&tasks.tasks[i].stats->author, git_commit_author(commit));
-		if (error != GIT_OK)
-			goto WRONG;
+		git_oid_cpy(&tasks[i].stats->oid, git_commit_id(commit));
 
-		git_oid_cpy(&tasks.tasks[i].stats->oid, git_commit_id(commit));
-	}
+		/* Cached stats need neither the trees nor a worker */
+		if (cache && rugged_stats_cache_lookup(cache, git_commit_id(commit),
+				git_commit_parent_id(commit, 0), tasks[i].stats)) {
+			tasks[i].cached = 1;
+			tasks[i].base.batch.done = 1;
+			continue;
+		}
 
-	for (i = 0; i < nr_threads; ++i) {
-	    if ((os_errno = pthread_create(&threads[i], NULL, commit_stat_task_proc, &tasks))) {
-	    	for (j = 0; j < i; ++j)
-	    		pthread_cancel(threads[j]);
+		if ((error = commit_task_prepare(&tasks[i].base, repo, commit)) != GIT_OK)
 			goto WRONG;
-	    }
 	}
-	for (i = 0; i < nr_threads; ++i) {
-	    if ((os_errno = pthread_join(threads[i], (void *) &error))) {
-	    	for (j = i + 1; j < nr_threads; ++j)
-	    		pthread_cancel(threads[j]);
-			goto WRONG;
-	    }
-	    if (error != GIT_OK) {
-	    	for (j = i + 1; j < nr_threads; ++j)
-	    		pthread_cancel(threads[j]);
-			goto WRONG;
-	    }
+
+	os_errno = rugged_pool_run_tasks(tasks, sizeof(commit_stat_task), arrlen, commit_stat_task_run, &exception);
+	if (os_errno || exception)
+		goto WRONG;
+
+	if ((error = rugged_batch_tasks_error(tasks, sizeof(commit_stat_task), arrlen)) != GIT_OK)
+		goto WRONG;
+
+	if (cache) {
+		for (i = 0; i < arrlen; ++i) {
+			if (tasks[i].cached || tasks[i].stats->truncated)
+				continue;
+			Data_Get_Struct(rb_ary_entry(rb_commits, i), git_commit, commit);
+			rugged_stats_cache_add(cache, &tasks[i].stats->oid, git_commit_parent_id(commit, 0), tasks[i].stats);
+		}
+		rugged_stats_cache_flush(cache);
 	}
 
 	rb_results = rb_ary_new2(arrlen);
 	for (i = 0; i < arrlen; ++i)
-		rb_ary_push(rb_results, rugged_commit_stats_new(tasks.tasks[i].stats));
+		rb_ary_push(rb_results, rugged_commit_stats_new(tasks[i].stats));
 
 	goto CLEAN;
 
 WRONG:
 	for (i = 0; i < arrlen; ++i) {
-		if (tasks.tasks[i].stats != NULL) {
-			if (tasks.tasks[i].stats->committer != NULL)
-				git_signature_free(tasks.tasks[i].stats->committer);
-			if (tasks.tasks[i].stats->author != NULL)
-				git_signature_free(tasks.tasks[i].stats->author);
-			xfree(tasks.tasks[i].stats);
+		if (tasks[i].stats != NULL) {
+			if (tasks[i].stats->committer != NULL)
+				git_signature_free(tasks[i].stats->committer);
+			if (tasks[i].stats->author != NULL)
+				git_signature_free(tasks[i].stats->author);
+			xfree(tasks[i].stats);
 		}
 	}
 CLEAN:
-	for (i = 0; i < arrlen; ++i) {
-		if (tasks.tasks[i].tree != NULL)
-			git_tree_free(tasks.tasks[i].tree);
-		if (tasks.tasks[i].parent_tree != NULL)
-			git_tree_free(tasks.tasks[i].parent_tree);
+	for (i = 0; i < arrlen; ++i)
+		commit_task_clear(&tasks[i].base);
+	xfree(tasks);
+	rugged_batch_tasks_raise(os_errno, exception, error);
+	return rb_results;
+}
+
+typedef struct commit_numstat_row {
+	char *old_path, *new_path;
+	git_delta_t status;
+	size_t adds, dels;
+	int binary;
+} commit_numstat_row;
+
+typedef struct commit_numstat_task {
+	commit_task base;
+	int renames;
+	commit_numstat_row *rows;
+	size_t nr_rows;
+} commit_numstat_task;
+
+static int commit_numstat_collect(commit_numstat_task *task, git_diff *diff) {
+	size_t i, context;
+	int error = GIT_OK;
+
+	task->nr_rows = git_diff_num_deltas(diff);
+	if (task->nr_rows == 0)
+		return GIT_OK;
+
+	if ((task->rows = calloc(task->nr_rows, sizeof(commit_numstat_row))) == NULL) {
+		task->nr_rows = 0;
+		giterr_set_oom();
+		return -1;
+	}
+
+	for (i = 0; i < task->nr_rows; ++i) {
+		commit_numstat_row *row = &task->rows[i];
+		const git_diff_delta *delta;
+		git_patch *patch;
+
+		/* Patches count lines without building anything on the Ruby side */
+		if ((error = git_patch_from_diff(&patch, diff, i)) != GIT_OK)
+			break;
+
+		delta = git_patch_get_delta(patch);
+		row->status = delta->status;
+		row->binary = (delta->flags & GIT_DIFF_FLAG_BINARY) != 0;
+		row->old_path = strdup(delta->old_file.path);
+		row->new_path = strdup(delta->new_file.path);
+
+		if (!row->binary)
+			error = git_patch_line_stats(&context, &row->adds, &row->dels, patch);
+		git_patch_free(patch);
+
+		if (error == GIT_OK && (!row->old_path || !row->new_path)) {
+			giterr_set_oom();
+			error = -1;
+		}
+		if (error != GIT_OK)
+			break;
 	}
-	pthread_mutex_destroy(&tasks.mutex);
-	xfree(tasks.tasks);
-	xfree(threads);
-	if (os_errno) {
-		VALUE rb_errno = INT2FIX(os_errno);
-		rb_exc_raise(rb_class_new_instance(1, &rb_errno, rb_eSystemCallError));
+
+	return error;
+}
+
+static void commit_numstat_task_run(void *payload) {
+	commit_numstat_task *task = payload;
+	git_diff_options diff_opts = GIT_DIFF_OPTIONS_INIT;
+	git_diff_find_options find_opts = GIT_DIFF_FIND_OPTIONS_INIT;
+	git_diff *diff = NULL;
+	int error;
+
+	error = git_diff_tree_to_tree(&diff, task->base.repo, task->base.parent_tree, task->base.tree, &diff_opts);
+
+	if (error == GIT_OK && task->renames) {
+		find_opts.flags = GIT_DIFF_FIND_RENAMES;
+		error = git_diff_find_similar(diff, &find_opts);
 	}
-	rugged_exception_check(error);
-	return rb_results;
+
+	if (error == GIT_OK)
+		error = commit_numstat_collect(task, diff);
+
+	git_diff_free(diff);
+
+	if (error != GIT_OK)
+		rugged_batch_task_set_error(&task->base.batch, error);
+
+	task->base.batch.done = 1;
+}
+
+static void commit_numstat_task_clear(commit_numstat_task *task) {
+	size_t i;
+
+	for (i = 0; i < task->nr_rows; ++i) {
+		free(task->rows[i].old_path);
+		free(task->rows[i].new_path);
+	}
+	free(task->rows);
+
+	commit_task_clear(&task->base);
 }
 
 /*
  *  call-seq:
- *    Commit.diff_between_repos(repo1, commit1, repo2, commit2) -> commit_ids
+ *    Commit.numstat(repo, commits, options = {}) -> numstats
+ *
+ *  Compute a per-file breakdown of each commit in +commits+ against its
+ *  first parent. Returns one array per commit, in the same order, with a
+ *  row for each changed file:
+ *
+ *    [old_path, new_path, status, additions, deletions, binary]
+ *
+ *  +status+ is a symbol such as +:added+, +:modified+ or +:renamed+.
+ *  Additions and deletions are 0 for binary files.
+ *
+ *  The following options can be passed in the +options+ Hash:
  *
- *  Return a list of commit ids which are descendant of commit2 in repo2,
- *  but are not descendant of commit1 in repo1.
+ *  :renames ::
+ *    If +true+ (the default), renamed files are detected and reported as
+ *    a single +:renamed+ row.
  *
+ *  Like Commit.stats, the diffs run on the shared thread pool without
+ *  holding the GVL, and no Rugged::Diff::Line objects are created.
  */
-static VALUE rb_git_commit_diff_between_repos(VALUE klass, VALUE rb_repo1, VALUE rb_commit1, VALUE rb_repo2, VALUE rb_commit2) {
-	int error;
-	VALUE rb_oids;
-	git_commit *commit1;
-	git_oid oids[2], walk_oid;
-	git_oid *oid1 = &oids[0], *oid2 = &oids[1];
-	git_repository *repo1, *repo2;
-	git_odb *odb2;
-	git_revwalk *walk;
-	git_oidarray bases = {NULL, 0};
-
-	rugged_check_repo(rb_repo1);
-	Data_Get_Struct(rb_repo1, git_repository, repo1);
-
-	rugged_check_repo(rb_repo2);
-	Data_Get_Struct(rb_repo2, git_repository, repo2);
-
-	Check_Type(rb_commit1, T_STRING);
-	Check_Type(rb_commit2, T_STRING);
-
-	if (RSTRING_LEN(rb_commit1) < GIT_OID_HEXSZ || RSTRING_LEN(rb_commit2) < GIT_OID_HEXSZ)
-		rb_raise(rb_eArgError, "The given OID is too short");
-	if (RSTRING_LEN(rb_commit1) > GIT_OID_HEXSZ || RSTRING_LEN(rb_commit2) > GIT_OID_HEXSZ)
-		rb_raise(rb_eArgError, "The given OID is too long");
-
-	if ((error = git_oid_fromstr(oid1, RSTRING_PTR(rb_commit1))) != GIT_OK ||
-		(error = git_oid_fromstr(oid2, RSTRING_PTR(rb_commit2))) != GIT_OK)
-		rugged_exception_check(error);
+static VALUE rb_git_commit_numstat(int argc, VALUE *argv, VALUE klass) {
+	long error = 0;
+	int os_errno = 0, exception = 0, renames = 1;
+	size_t i, j, arrlen;
+	VALUE rb_repo, rb_commits, rb_options, rb_commit, rb_rows, rb_results = Qnil;
+	git_repository *repo;
+	git_commit *commit;
+	commit_numstat_task *tasks;
 
-	error = git_repository_odb(&odb2, repo2);
-	rugged_exception_check(error);
+	rb_scan_args(argc, argv, "20:", &rb_repo, &rb_commits, &rb_options);
 
-	while (oid1 != NULL && !git_odb_exists(odb2, oid1)) {
-		git_oid *parent_oid;
-		error = git_commit_lookup(&commit1, repo1, oid1);
-		if (error != GIT_OK) {
-			git_odb_free(odb2);
-			rugged_exception_check(error);
-		}
-		parent_oid = git_commit_parent_id(commit1, 0);
-		if (parent_oid != NULL)
-			git_oid_cpy(oid1, parent_oid);
-		else
-			oid1 = NULL;
-		git_commit_free(commit1);
+	Check_Type(rb_commits, T_ARRAY);
+	arrlen = RARRAY_LEN(rb_commits);
+
+	rugged_check_repo(rb_repo);
+	Data_Get_Struct(rb_repo, git_repository, repo);
+
+	if (!NIL_P(rb_options)) {
+		VALUE rb_value = rb_hash_lookup2(rb_options, CSTR2SYM("renames"), Qtrue);
+		renames = RTEST(rb_value);
 	}
-	git_odb_free(odb2);
-
-	if (oid1 != NULL) {
-		error = git_merge_bases_many(&bases, repo2, 2, oids);
-		if (error == GIT_ENOTFOUND)
-			oid1 = NULL;
-		else if (error != GIT_OK)
-			rugged_exception_check(error);
-		else {
-			git_oid_cpy(oid1, &bases.ids[0]);
-			git_oidarray_free(&bases);
-		}
+
+	tasks = xcalloc(arrlen ? arrlen : 1, sizeof(commit_numstat_task));
+
+	for (i = 0; i < arrlen; ++i) {
+		rb_commit = rb_ary_entry(rb_commits, i);
+		Data_Get_Struct(rb_commit, git_commit, commit);
+
+		tasks[i].renames = renames;
+		if ((error = commit_task_prepare(&tasks[i].base, repo, commit)) != GIT_OK)
+			goto CLEAN;
 	}
 
-	error = git_revwalk_new(&walk, repo2);
-	rugged_exception_check(error);
-	git_revwalk_sorting(walk, GIT_SORT_TIME);
-	error = git_revwalk_push(walk, oid2);
-	if (error == GIT_OK && oid1 != NULL)
-		error = git_revwalk_hide(walk, oid1);
-	if (error != GIT_OK) {
-		git_revwalk_free(walk);
-		rugged_exception_check(error);
+	os_errno = rugged_pool_run_tasks(tasks, sizeof(commit_numstat_task), arrlen, commit_numstat_task_run, &exception);
+	if (os_errno || exception)
+		goto CLEAN;
+
+	if ((error = rugged_batch_tasks_error(tasks, sizeof(commit_numstat_task), arrlen)) != GIT_OK)
+		goto CLEAN;
+
+	rb_results = rb_ary_new2(arrlen);
+	for (i = 0; i < arrlen; ++i) {
+		rb_rows = rb_ary_new2(tasks[i].nr_rows);
+
+		for (j = 0; j < tasks[i].nr_rows; ++j) {
+			commit_numstat_row *row = &tasks[i].rows[j];
+			VALUE rb_row = rb_ary_new2(6);
+
+			rb_ary_push(rb_row, rb_str_new_utf8(row->old_path));
+			rb_ary_push(rb_row, rb_str_new_utf8(row->new_path));
+			rb_ary_push(rb_row, rb_git_delta_status_fromC(row->status));
+			rb_ary_push(rb_row, SIZET2NUM(row->adds));
+			rb_ary_push(rb_row, SIZET2NUM(row->dels));
+			rb_ary_push(rb_row, row->binary ? Qtrue : Qfalse);
+
+			rb_ary_push(rb_rows, rb_row);
+		}
+
+		rb_ary_push(rb_results, rb_rows);
 	}
-	rb_oids = rb_ary_new();
-	while ((error = git_revwalk_next(&walk_oid, walk)) == GIT_OK)
-		rb_ary_push(rb_oids, rugged_create_oid(&walk_oid));
-
-	git_revwalk_free(walk);
-	if (error == GIT_ITEROVER)
-		return rb_oids;
-	else
-		rugged_exception_check(error);
-	return Qnil;
+
+CLEAN:
+	for (i = 0; i < arrlen; ++i)
+		commit_numstat_task_clear(&tasks[i]);
+	xfree(tasks);
+	rugged_batch_tasks_raise(os_errno, exception, error);
+	return rb_results;
 }
 
 void Init_rugged_commit(void)
@@ -848,8 +947,8 @@ void Init_rugged_commit(void)
 	rb_cRuggedCommit = rb_define_class_under(rb_mRugged, "Commit", rb_cRuggedObject);
 
 	rb_define_singleton_method(rb_cRuggedCommit, "create", rb_git_commit_create, 2);
-	rb_define_singleton_method(rb_cRuggedCommit, "diff_between_repos", rb_git_commit_diff_between_repos, 4);
-	rb_define_singleton_method(rb_cRuggedCommit, "stats", rb_git_commit_stats, 2);
+	rb_define_singleton_method(rb_cRuggedCommit, "stats", rb_git_commit_stats, -1);
+	rb_define_singleton_method(rb_cRuggedCommit, "numstat", rb_git_commit_numstat, -1);
 
 	rb_define_method(rb_cRuggedCommit, "message", rb_git_commit_message_GET, 0);
 	rb_define_method(rb_cRuggedCommit, "epoch_time", rb_git_commit_epoch_time_GET, 0);
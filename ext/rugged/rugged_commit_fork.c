@@ -0,0 +1,959 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2014 GitHub, Inc
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "rugged.h"
+#include <git2/sys/odb_backend.h>
+
+extern VALUE rb_cRuggedCommit;
+
+/*
+ * Comparing a fork against its upstream happens in three steps:
+ *
+ *  1. walk the first-parent chain of the fork's commit until we reach a
+ *     commit that also exists in the upstream repository (the fork point);
+ *  2. find the merge base of the fork point and the upstream commit;
+ *  3. list (or count) the upstream commits that aren't reachable from
+ *     the merge base.
+ *
+ * The first step used to cost one git_odb_exists() per commit, and every
+ * miss makes libgit2 rescan the upstream's pack directory. Instead, the
+ * chain is walked in growing batches, the pack directory is rescanned
+ * once per comparison, and each batch is checked straight against the
+ * ODB backends.
+ *
+ * Commits found missing from the upstream are remembered for the rest of
+ * the call, so a walk restarted after an interrupt doesn't probe them
+ * again. They are never kept across calls: the upstream may receive the
+ * fork's objects at any time without its head moving.
+ */
+#define FORK_BATCH_MIN 16
+#define FORK_BATCH_MAX 256
+#define FORK_MISSING_MAX (1 << 18)
+
+struct fork_missing {
+	/* open-addressing table of OIDs, the zero OID is empty */
+	git_oid *table;
+	size_t nr_oids, table_size;
+};
+
+static inline size_t fork_missing_hash(const git_oid *oid)
+{
+	/* OIDs are already uniformly distributed */
+	return ((size_t)oid->id[0] << 24) | ((size_t)oid->id[1] << 16) |
+		((size_t)oid->id[2] << 8) | (size_t)oid->id[3];
+}
+
+static int fork_missing_contains(struct fork_missing *cache, const git_oid *oid)
+{
+	size_t i, mask = cache->table_size - 1;
+
+	if (cache->table_size == 0)
+		return 0;
+
+	for (i = fork_missing_hash(oid) & mask; !git_oid_iszero(&cache->table[i]); i = (i + 1) & mask) {
+		if (git_oid_equal(&cache->table[i], oid))
+			return 1;
+	}
+
+	return 0;
+}
+
+static void fork_missing_table_insert(git_oid *table, size_t table_size, const git_oid *oid)
+{
+	size_t i, mask = table_size - 1;
+
+	for (i = fork_missing_hash(oid) & mask; !git_oid_iszero(&table[i]); i = (i + 1) & mask) {
+		if (git_oid_equal(&table[i], oid))
+			return;
+	}
+	git_oid_cpy(&table[i], oid);
+}
+
+/*
+ * Runs without the GVL, so it allocates with calloc() and simply stops
+ * remembering commits when that fails.
+ */
+static void fork_missing_add(struct fork_missing *cache, const git_oid *oid)
+{
+	size_t i;
+
+	/* Forks that far apart aren't worth the memory; start over */
+	if (cache->nr_oids >= FORK_MISSING_MAX) {
+		memset(cache->table, 0, cache->table_size * sizeof(git_oid));
+		cache->nr_oids = 0;
+	}
+
+	if ((cache->nr_oids + 1) * 2 > cache->table_size) {
+		size_t table_size = cache->table_size ? cache->table_size * 2 : 1024;
+		git_oid *table = calloc(table_size, sizeof(git_oid));
+
+		if (table == NULL)
+			return;
+
+		for (i = 0; i < cache->table_size; ++i) {
+			if (!git_oid_iszero(&cache->table[i]))
+				fork_missing_table_insert(table, table_size, &cache->table[i]);
+		}
+
+		free(cache->table);
+		cache->table = table;
+		cache->table_size = table_size;
+	}
+
+	fork_missing_table_insert(cache->table, cache->table_size, oid);
+	cache->nr_oids++;
+}
+
+struct fork_compare {
+	git_repository *fork, *upstream;
+	const rugged_commit_graph *fork_graph, *upstream_graph;
+	struct fork_missing missing;
+
+	git_oid fork_head, upstream_head;
+
+	/* merge base of the fork point and upstream_head, if any */
+	git_oid base;
+	int has_base;
+
+	size_t offset, limit;
+	int count_only;
+
+	git_oid *oids;
+	size_t nr_oids, alloc_oids;
+	size_t count;
+
+	int error, os_errno;
+	volatile int interrupted;
+};
+
+static int fork_first_parent(git_oid *out, struct fork_compare *fc, const git_oid *oid)
+{
+	git_commit *commit;
+	const git_oid *parent;
+	int error;
+
+	if (fc->fork_graph != NULL) {
+		error = rugged_commit_graph_first_parent(out, fc->fork_graph, oid);
+		if (error != GIT_PASSTHROUGH)
+			return error;
+	}
+
+	if ((error = git_commit_lookup(&commit, fc->fork, oid)) < 0)
+		return error;
+
+	parent = git_commit_parent_id(commit, 0);
+	if (parent != NULL)
+		git_oid_cpy(out, parent);
+	else
+		error = GIT_ENOTFOUND;
+
+	git_commit_free(commit);
+	return error;
+}
+
+/* git_odb_exists() without the pack directory rescan on every miss */
+static int fork_odb_exists(git_odb *odb, const git_oid *oid)
+{
+	git_odb_backend *backend;
+	size_t i, nr_backends = git_odb_num_backends(odb);
+
+	for (i = 0; i < nr_backends; ++i) {
+		if (git_odb_get_backend(&backend, odb, i) < 0 || backend->exists == NULL)
+			continue;
+		if (backend->exists(backend, oid))
+			return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Walk the first-parent chain of fork_head until a commit that exists in
+ * the upstream repository; leave it in +base+. Sets has_base to 0 when
+ * the fork shares no commit with the upstream.
+ */
+static int fork_find_point(struct fork_compare *fc)
+{
+	git_oid batch[FORK_BATCH_MAX], next;
+	char known[FORK_BATCH_MAX];
+	size_t batch_size = FORK_BATCH_MIN, n, i;
+	int error = 0, has_next = 1, found = 0;
+	git_odb *odb;
+
+	if ((error = git_repository_odb(&odb, fc->upstream)) < 0)
+		return error;
+
+	/* Pick up packs written since the repository was opened, once for the whole walk */
+	if ((error = git_odb_refresh(odb)) < 0)
+		goto cleanup;
+
+	git_oid_cpy(&next, &fc->fork_head);
+
+	while (has_next && !found && !fc->interrupted) {
+		for (n = 0; has_next && n < batch_size; ++n) {
+			git_oid_cpy(&batch[n], &next);
+
+			error = fork_first_parent(&next, fc, &batch[n]);
+			if (error == GIT_ENOTFOUND) {
+				has_next = 0;
+				error = 0;
+			} else if (error < 0) {
+				goto cleanup;
+			}
+		}
+
+		for (i = 0; i < n; ++i)
+			known[i] = (char)fork_missing_contains(&fc->missing, &batch[i]);
+
+		for (i = 0; i < n; ++i) {
+			if (!known[i] && fork_odb_exists(odb, &batch[i])) {
+				git_oid_cpy(&fc->base, &batch[i]);
+				found = 1;
+				break;
+			}
+		}
+
+		/* Everything before the fork point is missing from the upstream */
+		while (i-- > 0) {
+			if (!known[i])
+				fork_missing_add(&fc->missing, &batch[i]);
+		}
+
+		if (batch_size < FORK_BATCH_MAX)
+			batch_size *= 2;
+	}
+
+	fc->has_base = found;
+
+cleanup:
+	git_odb_free(odb);
+	return error;
+}
+
+static int fork_merge_base(struct fork_compare *fc)
+{
+	git_oidarray bases = {NULL, 0};
+	git_oid oids[2];
+	int error = GIT_PASSTHROUGH;
+
+	if (fc->upstream_graph != NULL)
+		error = rugged_commit_graph_merge_base(&fc->base, fc->upstream_graph, &fc->base, &fc->upstream_head);
+
+	if (error == GIT_PASSTHROUGH) {
+		git_oid_cpy(&oids[0], &fc->base);
+		git_oid_cpy(&oids[1], &fc->upstream_head);
+
+		error = git_merge_bases_many(&bases, fc->upstream, 2, oids);
+		if (error == GIT_OK) {
+			git_oid_cpy(&fc->base, &bases.ids[0]);
+			git_oidarray_free(&bases);
+		}
+	}
+
+	if (error == GIT_ENOTFOUND) {
+		fc->has_base = 0;
+		error = 0;
+	}
+
+	return error;
+}
+
+static int fork_push_oid(struct fork_compare *fc, const git_oid *oid)
+{
+	if (fc->nr_oids == fc->alloc_oids) {
+		size_t alloc_oids = fc->alloc_oids ? fc->alloc_oids * 2 : 64;
+		git_oid *oids = realloc(fc->oids, alloc_oids * sizeof(git_oid));
+
+		if (oids == NULL)
+			return -1;
+
+		fc->oids = oids;
+		fc->alloc_oids = alloc_oids;
+	}
+
+	git_oid_cpy(&fc->oids[fc->nr_oids++], oid);
+	return 0;
+}
+
+static int fork_list_commits(struct fork_compare *fc)
+{
+	git_revwalk *walk;
+	git_oid oid;
+	size_t offset = fc->offset;
+	int error;
+
+	if (fc->count_only && fc->upstream_graph != NULL) {
+		error = rugged_commit_graph_count(&fc->count, fc->upstream_graph,
+			&fc->upstream_head, fc->has_base ? &fc->base : NULL);
+		if (error != GIT_PASSTHROUGH)
+			return error;
+	}
+
+	if ((error = git_revwalk_new(&walk, fc->upstream)) < 0)
+		return error;
+
+	git_revwalk_sorting(walk, GIT_SORT_TIME);
+	error = git_revwalk_push(walk, &fc->upstream_head);
+	if (error == GIT_OK && fc->has_base)
+		error = git_revwalk_hide(walk, &fc->base);
+
+	while (error == GIT_OK && !fc->interrupted) {
+		if (!fc->count_only && fc->nr_oids >= fc->limit)
+			break;
+
+		if ((error = git_revwalk_next(&oid, walk)) != GIT_OK)
+			break;
+
+		if (fc->count_only) {
+			fc->count++;
+		} else if (offset > 0) {
+			offset--;
+		} else if (fork_push_oid(fc, &oid) < 0) {
+			fc->os_errno = ENOMEM;
+			break;
+		}
+	}
+
+	git_revwalk_free(walk);
+	return error == GIT_ITEROVER ? 0 : error;
+}
+
+static void *fork_compare_run(void *payload)
+{
+	struct fork_compare *fc = payload;
+
+	fc->nr_oids = fc->count = 0;
+	git_oid_cpy(&fc->base, &fc->fork_head);
+	fc->has_base = 0;
+
+	if ((fc->error = fork_find_point(fc)) < 0 || fc->interrupted)
+		return NULL;
+
+	if (fc->has_base && (fc->error = fork_merge_base(fc)) < 0)
+		return NULL;
+
+	fc->error = fork_list_commits(fc);
+	return NULL;
+}
+
+static void fork_compare_interrupt(void *payload)
+{
+	((struct fork_compare *)payload)->interrupted = 1;
+}
+
+static VALUE fork_compare_check_ints(VALUE unused)
+{
+	rb_thread_check_ints();
+	return Qnil;
+}
+
+static void fork_parse_oid(git_oid *out, VALUE rb_oid)
+{
+	Check_Type(rb_oid, T_STRING);
+
+	if (RSTRING_LEN(rb_oid) < GIT_OID_HEXSZ)
+		rb_raise(rb_eArgError, "The given OID is too short");
+	if (RSTRING_LEN(rb_oid) > GIT_OID_HEXSZ)
+		rb_raise(rb_eArgError, "The given OID is too long");
+
+	rugged_exception_check(git_oid_fromstr(out, RSTRING_PTR(rb_oid)));
+}
+
+/* Read the count option +key+ out of +rb_options+, if it was given */
+static void fork_parse_count(size_t *out, VALUE rb_options, const char *key)
+{
+	VALUE rb_value = rb_hash_aref(rb_options, CSTR2SYM(key));
+
+	if (NIL_P(rb_value))
+		return;
+
+	Check_Type(rb_value, T_FIXNUM);
+	if (FIX2LONG(rb_value) < 0)
+		rb_raise(rb_eArgError, "%s must not be negative", key);
+
+	*out = FIX2ULONG(rb_value);
+}
+
+/*
+ *  call-seq:
+ *    Commit.diff_between_repos(repo1, commit1, repo2, commit2, options = {}) -> commit_ids
+ *    Commit.diff_between_repos(repo1, commit1, repo2, commit2, count_only: true) -> count
+ *
+ *  Return a list of commit ids which are descendant of commit2 in repo2,
+ *  but are not descendant of commit1 in repo1, newest first.
+ *
+ *  The following options can be passed in the +options+ Hash:
+ *
+ *  :offset ::
+ *    Skip this many commits at the start of the list.
+ *
+ *  :limit ::
+ *    Return at most this many commit ids.
+ *
+ *  :count_only ::
+ *    If +true+, return the number of commits instead of their ids;
+ *    +:offset+ and +:limit+ are ignored.
+ *
+ *  The comparison runs without holding the GVL.
+ */
+static VALUE rb_git_commit_diff_between_repos(int argc, VALUE *argv, VALUE klass)
+{
+	VALUE rb_repo1, rb_commit1, rb_repo2, rb_commit2, rb_options;
+	VALUE rb_graph1, rb_graph2, rb_result = Qnil;
+	struct fork_compare fc;
+	int exception = 0;
+	size_t i;
+
+	rb_scan_args(argc, argv, "40:", &rb_repo1, &rb_commit1, &rb_repo2, &rb_commit2, &rb_options);
+
+	memset(&fc, 0, sizeof(fc));
+	fc.limit = SIZE_MAX;
+
+	rugged_check_repo(rb_repo1);
+	Data_Get_Struct(rb_repo1, git_repository, fc.fork);
+
+	rugged_check_repo(rb_repo2);
+	Data_Get_Struct(rb_repo2, git_repository, fc.upstream);
+
+	fork_parse_oid(&fc.fork_head, rb_commit1);
+	fork_parse_oid(&fc.upstream_head, rb_commit2);
+
+	if (!NIL_P(rb_options)) {
+		fork_parse_count(&fc.offset, rb_options, "offset");
+		fork_parse_count(&fc.limit, rb_options, "limit");
+
+		fc.count_only = RTEST(rb_hash_aref(rb_options, CSTR2SYM("count_only")));
+	}
+
+	/* Keep the graphs alive while we use them without the GVL */
+	fc.fork_graph = rugged_repo_commit_graph(rb_repo1);
+	fc.upstream_graph = rugged_repo_commit_graph(rb_repo2);
+	rb_graph1 = rb_iv_get(rb_repo1, "@commit_graph");
+	rb_graph2 = rb_iv_get(rb_repo2, "@commit_graph");
+
+	for (;;) {
+		fc.interrupted = 0;
+		rugged_without_gvl(fork_compare_run, &fc, fork_compare_interrupt, &fc);
+
+		if (!fc.interrupted || fc.error < 0 || fc.os_errno)
+			break;
+
+		/* Raise if there's a pending exception, start over otherwise */
+		rb_protect(fork_compare_check_ints, Qnil, &exception);
+		if (exception)
+			break;
+	}
+
+	RB_GC_GUARD(rb_graph1);
+	RB_GC_GUARD(rb_graph2);
+
+	if (!exception && !fc.os_errno && fc.error == GIT_OK) {
+		if (fc.count_only) {
+			rb_result = SIZET2NUM(fc.count);
+		} else {
+			rb_result = rb_ary_new2(fc.nr_oids);
+			for (i = 0; i < fc.nr_oids; ++i)
+				rb_ary_push(rb_result, rugged_create_oid(&fc.oids[i]));
+		}
+	}
+
+	free(fc.oids);
+	free(fc.missing.table);
+
+	if (exception)
+		rb_jump_tag(exception);
+	if (fc.os_errno) {
+		VALUE rb_errno = INT2FIX(fc.os_errno);
+		rb_exc_raise(rb_class_new_instance(1, &rb_errno, rb_eSystemCallError));
+	}
+	rugged_exception_check(fc.error);
+
+	return rb_result;
+}
+
+/*
+ * Commit.compare_forks walks the upstream history once into an in-memory
+ * index (commits in topological order plus the indexes of their parents),
+ * shared read-only by one pool task per fork. Each task walks the fork's
+ * own commits, hiding every commit the index knows about, and then marks
+ * the upstream commits reachable from where its walk stopped; whatever is
+ * left unmarked is what the fork is behind by.
+ */
+#define UPSTREAM_NO_PARENT UINT32_MAX
+
+struct upstream_index {
+	git_oid *oids;
+	size_t nr_commits, alloc_commits;
+
+	/* the parents of commit i are parents[parent_start[i]] .. parents[parent_start[i + 1] - 1] */
+	uint32_t *parent_start;
+	uint32_t *parents;
+	git_oid *parent_oids;
+	size_t nr_parents, alloc_parents;
+
+	/* open-addressing table of commit indexes + 1, 0 is empty */
+	uint32_t *table;
+	size_t table_size;
+
+	int error, os_errno;
+	volatile int interrupted;
+};
+
+static void upstream_index_clear(struct upstream_index *idx)
+{
+	free(idx->oids);
+	free(idx->parent_start);
+	free(idx->parents);
+	free(idx->parent_oids);
+	free(idx->table);
+
+	idx->oids = idx->parent_oids = NULL;
+	idx->parent_start = idx->parents = idx->table = NULL;
+	idx->nr_commits = idx->alloc_commits = 0;
+	idx->nr_parents = idx->alloc_parents = 0;
+	idx->table_size = 0;
+}
+
+static uint32_t upstream_index_find(const struct upstream_index *idx, const git_oid *oid)
+{
+	size_t i, mask = idx->table_size - 1;
+
+	for (i = fork_missing_hash(oid) & mask; idx->table[i]; i = (i + 1) & mask) {
+		if (git_oid_equal(&idx->oids[idx->table[i] - 1], oid))
+			return idx->table[i] - 1;
+	}
+
+	return UPSTREAM_NO_PARENT;
+}
+
+static int upstream_index_push(struct upstream_index *idx, git_commit *commit)
+{
+	unsigned int i, nr_parents = git_commit_parentcount(commit);
+
+	if (idx->nr_commits + 1 >= idx->alloc_commits) {
+		size_t alloc = idx->alloc_commits ? idx->alloc_commits * 2 : 1024;
+		git_oid *oids = realloc(idx->oids, alloc * sizeof(git_oid));
+		uint32_t *parent_start = realloc(idx->parent_start, (alloc + 1) * sizeof(uint32_t));
+
+		if (oids)
+			idx->oids = oids;
+		if (parent_start)
+			idx->parent_start = parent_start;
+		if (!oids || !parent_start)
+			return -1;
+
+		idx->alloc_commits = alloc;
+	}
+
+	if (idx->nr_parents + nr_parents > idx->alloc_parents) {
+		size_t alloc = idx->alloc_parents ? idx->alloc_parents * 2 : 1024;
+		git_oid *parent_oids;
+
+		while (alloc < idx->nr_parents + nr_parents)
+			alloc *= 2;
+
+		if ((parent_oids = realloc(idx->parent_oids, alloc * sizeof(git_oid))) == NULL)
+			return -1;
+
+		idx->parent_oids = parent_oids;
+		idx->alloc_parents = alloc;
+	}
+
+	if (idx->nr_commits == 0)
+		idx->parent_start[0] = 0;
+
+	git_oid_cpy(&idx->oids[idx->nr_commits], git_commit_id(commit));
+	for (i = 0; i < nr_parents; ++i)
+		git_oid_cpy(&idx->parent_oids[idx->nr_parents++], git_commit_parent_id(commit, i));
+
+	idx->parent_start[++idx->nr_commits] = (uint32_t)idx->nr_parents;
+	return 0;
+}
+
+/* Hash the commits and turn the parent OIDs into indexes */
+static int upstream_index_link(struct upstream_index *idx)
+{
+	size_t i, j, mask;
+
+	idx->table_size = 1024;
+	while (idx->table_size < idx->nr_commits * 2)
+		idx->table_size *= 2;
+	mask = idx->table_size - 1;
+
+	if ((idx->table = calloc(idx->table_size, sizeof(uint32_t))) == NULL)
+		return -1;
+
+	for (i = 0; i < idx->nr_commits; ++i) {
+		for (j = fork_missing_hash(&idx->oids[i]) & mask; idx->table[j]; j = (j + 1) & mask)
+			;
+		idx->table[j] = (uint32_t)(i + 1);
+	}
+
+	if (idx->nr_parents > 0 &&
+		(idx->parents = malloc(idx->nr_parents * sizeof(uint32_t))) == NULL)
+		return -1;
+
+	/* Parents missing from the walk (shallow clones, grafts) are simply dropped */
+	for (i = 0; i < idx->nr_parents; ++i)
+		idx->parents[i] = upstream_index_find(idx, &idx->parent_oids[i]);
+
+	free(idx->parent_oids);
+	idx->parent_oids = NULL;
+
+	return 0;
+}
+
+struct upstream_index_build {
+	struct upstream_index *idx;
+	git_repository *repo;
+	const git_oid *head;
+};
+
+static void *upstream_index_build(void *payload)
+{
+	struct upstream_index_build *b = payload;
+	struct upstream_index *idx = b->idx;
+	git_revwalk *walk;
+	git_commit *commit;
+	git_oid oid;
+	int error;
+
+	upstream_index_clear(idx);
+
+	if ((error = git_revwalk_new(&walk, b->repo)) < 0)
+		goto done;
+
+	git_revwalk_sorting(walk, GIT_SORT_TOPOLOGICAL | GIT_SORT_TIME);
+	error = git_revwalk_push(walk, b->head);
+
+	while (error == GIT_OK && !idx->interrupted) {
+		if ((error = git_revwalk_next(&oid, walk)) != GIT_OK)
+			break;
+
+		if ((error = git_commit_lookup(&commit, b->repo, &oid)) < 0)
+			break;
+
+		if (upstream_index_push(idx, commit) < 0)
+			idx->os_errno = ENOMEM;
+		git_commit_free(commit);
+
+		if (idx->os_errno)
+			break;
+	}
+
+	git_revwalk_free(walk);
+
+	if (error == GIT_ITEROVER)
+		error = 0;
+
+	if (error == 0 && !idx->os_errno && !idx->interrupted && upstream_index_link(idx) < 0)
+		idx->os_errno = ENOMEM;
+
+done:
+	idx->error = error;
+	return NULL;
+}
+
+static void upstream_index_interrupt(void *payload)
+{
+	((struct upstream_index_build *)payload)->idx->interrupted = 1;
+}
+
+typedef struct {
+	rugged_batch_task batch;
+
+	const struct upstream_index *upstream;
+	git_repository *repo;
+	git_oid head;
+
+	int want_commits;
+	size_t limit;
+
+	/* upstream commits reachable from head, and the stack to mark them */
+	unsigned char *reachable;
+	uint32_t *stack;
+	size_t nr_stack;
+
+	git_oid *ahead_oids;
+	size_t nr_ahead_oids, alloc_ahead_oids;
+	size_t ahead, behind;
+} fork_compare_task;
+
+#define REACHABLE_TEST(bits, i) ((bits)[(i) >> 3] & (1 << ((i) & 7)))
+#define REACHABLE_SET(bits, i) ((bits)[(i) >> 3] |= (unsigned char)(1 << ((i) & 7)))
+
+static void fork_task_mark(fork_compare_task *task, uint32_t pos)
+{
+	if (pos == UPSTREAM_NO_PARENT || REACHABLE_TEST(task->reachable, pos))
+		return;
+
+	REACHABLE_SET(task->reachable, pos);
+	task->stack[task->nr_stack++] = pos;
+}
+
+/* Stop the fork walk at every commit the upstream already has */
+static int fork_task_hide_cb(const git_oid *oid, void *payload)
+{
+	fork_compare_task *task = payload;
+	uint32_t pos = upstream_index_find(task->upstream, oid);
+
+	if (pos == UPSTREAM_NO_PARENT)
+		return 0;
+
+	fork_task_mark(task, pos);
+	return 1;
+}
+
+static void fork_task_run(void *payload)
+{
+	fork_compare_task *task = payload;
+	const struct upstream_index *idx = task->upstream;
+	git_revwalk *walk = NULL;
+	git_oid oid;
+	size_t i, reachable = 0;
+	int error;
+
+	task->reachable = calloc(idx->nr_commits / 8 + 1, 1);
+	task->stack = malloc((idx->nr_commits + 1) * sizeof(uint32_t));
+
+	if (task->reachable == NULL || task->stack == NULL) {
+		error = GIT_ERROR;
+		giterr_set_oom();
+		goto done;
+	}
+
+	if ((error = git_revwalk_new(&walk, task->repo)) < 0)
+		goto done;
+
+	git_revwalk_sorting(walk, GIT_SORT_TIME);
+	if ((error = git_revwalk_add_hide_cb(walk, fork_task_hide_cb, task)) < 0 ||
+		(error = git_revwalk_push(walk, &task->head)) < 0)
+		goto done;
+
+	while ((error = git_revwalk_next(&oid, walk)) == GIT_OK) {
+		task->ahead++;
+
+		if (!task->want_commits || task->nr_ahead_oids >= task->limit)
+			continue;
+
+		if (task->nr_ahead_oids == task->alloc_ahead_oids) {
+			size_t alloc = task->alloc_ahead_oids ? task->alloc_ahead_oids * 2 : 64;
+			git_oid *oids = realloc(task->ahead_oids, alloc * sizeof(git_oid));
+
+			if (oids == NULL) {
+				error = GIT_ERROR;
+				giterr_set_oom();
+				goto done;
+			}
+
+			task->ahead_oids = oids;
+			task->alloc_ahead_oids = alloc;
+		}
+
+		git_oid_cpy(&task->ahead_oids[task->nr_ahead_oids++], &oid);
+	}
+
+	if (error != GIT_ITEROVER)
+		goto done;
+	error = 0;
+
+	/* Everything the walk stopped at is upstream history the fork has */
+	while (task->nr_stack > 0) {
+		uint32_t pos = task->stack[--task->nr_stack];
+
+		reachable++;
+		for (i = idx->parent_start[pos]; i < idx->parent_start[pos + 1]; ++i)
+			fork_task_mark(task, idx->parents[i]);
+	}
+
+	task->behind = idx->nr_commits - reachable;
+
+done:
+	git_revwalk_free(walk);
+	if (error < 0)
+		rugged_batch_task_set_error(&task->batch, error);
+	task->batch.done = 1;
+}
+
+static void fork_task_clear(fork_compare_task *task)
+{
+	free(task->reachable);
+	free(task->stack);
+	free(task->ahead_oids);
+	free(task->batch.error_message);
+}
+
+static VALUE fork_task_result(fork_compare_task *task, const struct upstream_index *idx)
+{
+	VALUE rb_result = rb_hash_new(), rb_oids;
+	size_t i;
+
+	rb_hash_aset(rb_result, CSTR2SYM("ahead"), SIZET2NUM(task->ahead));
+	rb_hash_aset(rb_result, CSTR2SYM("behind"), SIZET2NUM(task->behind));
+
+	if (!task->want_commits)
+		return rb_result;
+
+	rb_oids = rb_ary_new2(task->nr_ahead_oids);
+	for (i = 0; i < task->nr_ahead_oids; ++i)
+		rb_ary_push(rb_oids, rugged_create_oid(&task->ahead_oids[i]));
+	rb_hash_aset(rb_result, CSTR2SYM("ahead_commits"), rb_oids);
+
+	rb_oids = rb_ary_new();
+	for (i = 0; i < idx->nr_commits && (size_t)RARRAY_LEN(rb_oids) < task->limit; ++i) {
+		if (!REACHABLE_TEST(task->reachable, i))
+			rb_ary_push(rb_oids, rugged_create_oid(&idx->oids[i]));
+	}
+	rb_hash_aset(rb_result, CSTR2SYM("behind_commits"), rb_oids);
+
+	return rb_result;
+}
+
+/*
+ *  call-seq:
+ *    Commit.compare_forks(upstream_repo, upstream_oid, forks, options = {}) -> results
+ *
+ *  Compare +upstream_oid+ in +upstream_repo+ against every fork in
+ *  +forks+, an Array of <tt>[repo, oid]</tt> pairs. Returns an Array with
+ *  a Hash for each fork, in the same order:
+ *
+ *    { :ahead => 2, :behind => 10 }
+ *
+ *  +:ahead+ is the number of commits reachable from the fork's commit
+ *  which are not part of the upstream history, and +:behind+ the number
+ *  of upstream commits which the fork's commit can't reach.
+ *
+ *  The following options can be passed in the +options+ Hash:
+ *
+ *  :commits ::
+ *    If +true+, also return the ids of these commits as
+ *    +:ahead_commits+ and +:behind_commits+, newest first.
+ *
+ *  :limit ::
+ *    Return at most this many ids in each list.
+ *
+ *  The upstream history is walked once for all the forks, and the forks
+ *  are then compared in parallel on the shared thread pool, without
+ *  holding the GVL.
+ */
+static VALUE rb_git_commit_compare_forks(int argc, VALUE *argv, VALUE klass)
+{
+	VALUE rb_upstream, rb_upstream_oid, rb_forks, rb_options, rb_results = Qnil;
+	struct upstream_index idx;
+	struct upstream_index_build build;
+	fork_compare_task *tasks = NULL;
+	git_repository *upstream;
+	git_oid upstream_head;
+	int exception = 0, os_errno = 0, error = 0, want_commits = 0;
+	size_t i, nr_forks, limit = SIZE_MAX;
+
+	rb_scan_args(argc, argv, "30:", &rb_upstream, &rb_upstream_oid, &rb_forks, &rb_options);
+
+	rugged_check_repo(rb_upstream);
+	Data_Get_Struct(rb_upstream, git_repository, upstream);
+
+	Check_Type(rb_forks, T_ARRAY);
+	nr_forks = RARRAY_LEN(rb_forks);
+
+	if (!NIL_P(rb_options)) {
+		want_commits = RTEST(rb_hash_aref(rb_options, CSTR2SYM("commits")));
+
+		fork_parse_count(&limit, rb_options, "limit");
+	}
+
+	/* Check every fork before allocating anything */
+	for (i = 0; i < nr_forks; ++i) {
+		VALUE rb_fork = rb_ary_entry(rb_forks, i);
+
+		if (TYPE(rb_fork) != T_ARRAY || RARRAY_LEN(rb_fork) != 2)
+			rb_raise(rb_eTypeError, "Expecting an Array of [repo, oid] pairs");
+
+		rugged_check_repo(rb_ary_entry(rb_fork, 0));
+		fork_parse_oid(&upstream_head, rb_ary_entry(rb_fork, 1));
+	}
+	fork_parse_oid(&upstream_head, rb_upstream_oid);
+
+	tasks = xcalloc(nr_forks ? nr_forks : 1, sizeof(fork_compare_task));
+
+	for (i = 0; i < nr_forks; ++i) {
+		VALUE rb_fork = rb_ary_entry(rb_forks, i);
+
+		Data_Get_Struct(rb_ary_entry(rb_fork, 0), git_repository, tasks[i].repo);
+		git_oid_fromstr(&tasks[i].head, RSTRING_PTR(rb_ary_entry(rb_fork, 1)));
+
+		tasks[i].upstream = &idx;
+		tasks[i].want_commits = want_commits;
+		tasks[i].limit = limit;
+	}
+
+	memset(&idx, 0, sizeof(idx));
+	build.idx = &idx;
+	build.repo = upstream;
+	build.head = &upstream_head;
+
+	for (;;) {
+		idx.interrupted = 0;
+		rugged_without_gvl(upstream_index_build, &build, upstream_index_interrupt, &build);
+
+		if (!idx.interrupted || idx.error < 0 || idx.os_errno)
+			break;
+
+		/* Raise if there's a pending exception, start over otherwise */
+		rb_protect(fork_compare_check_ints, Qnil, &exception);
+		if (exception)
+			goto CLEAN;
+	}
+
+	if ((os_errno = idx.os_errno) || (error = idx.error) < 0)
+		goto CLEAN;
+
+	os_errno = rugged_pool_run_tasks(tasks, sizeof(fork_compare_task), nr_forks, fork_task_run, &exception);
+	if (os_errno || exception)
+		goto CLEAN;
+
+	if ((error = rugged_batch_tasks_error(tasks, sizeof(fork_compare_task), nr_forks)) < 0)
+		goto CLEAN;
+
+	rb_results = rb_ary_new2(nr_forks);
+	for (i = 0; i < nr_forks; ++i)
+		rb_ary_push(rb_results, fork_task_result(&tasks[i], &idx));
+
+CLEAN:
+	for (i = 0; i < nr_forks; ++i)
+		fork_task_clear(&tasks[i]);
+	xfree(tasks);
+	upstream_index_clear(&idx);
+
+	RB_GC_GUARD(rb_forks);
+
+	rugged_batch_tasks_raise(os_errno, exception, error);
+
+	return rb_results;
+}
+
+void Init_rugged_commit_fork(void)
+{
+	rb_define_singleton_method(rb_cRuggedCommit, "diff_between_repos", rb_git_commit_diff_between_repos, -1);
+	rb_define_singleton_method(rb_cRuggedCommit, "compare_forks", rb_git_commit_compare_forks, -1);
+}
@@ -0,0 +1,1120 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2014 GitHub, Inc
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "rugged.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <stdio.h>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+extern VALUE rb_mRugged;
+extern VALUE rb_cRuggedRepo;
+VALUE rb_cRuggedCommitGraph;
+
+/*
+ * The commit-graph sidecar lives next to the packfiles, in
+ * `objects/info/rugged-commit-graph`. All integers are big-endian.
+ *
+ *   header       "RGCG", version, commit count, extra edge count (4 x u32)
+ *   fanout       256 x u32, cumulative count of OIDs by first byte
+ *   oids         count x 20 bytes, sorted
+ *   commit data  count x { parent1, parent2, generation, time_hi, time_lo }
+ *   extra edges  u32 list for octopus merges
+ *
+ * A parent is the position of the parent in the OID table. When a commit
+ * has more than two parents, parent2 has the high bit set and points into
+ * the extra edge list instead; the last edge of each list has the high bit
+ * set too.
+ */
+#define GRAPH_FILE "objects/info/rugged-commit-graph"
+#define GRAPH_SIGNATURE "RGCG"
+#define GRAPH_VERSION 1
+
+#define GRAPH_HEADER_SIZE 16
+#define GRAPH_FANOUT_SIZE (256 * 4)
+#define GRAPH_DATA_SIZE 20
+
+#define GRAPH_PARENT_NONE 0x7fffffff
+#define GRAPH_EXTRA_EDGES 0x80000000
+#define GRAPH_EDGE_LAST 0x80000000
+
+struct rugged_commit_graph {
+	unsigned char *map;
+	size_t map_size;
+
+	uint32_t nr_commits;
+	uint32_t nr_extra_edges;
+
+	const unsigned char *fanout;
+	const unsigned char *oids;
+	const unsigned char *data;
+	const unsigned char *extra_edges;
+};
+
+static inline uint32_t graph_get_be32(const unsigned char *p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+		((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+static inline void graph_put_be32(unsigned char *p, uint32_t value)
+{
+	p[0] = (unsigned char)(value >> 24);
+	p[1] = (unsigned char)(value >> 16);
+	p[2] = (unsigned char)(value >> 8);
+	p[3] = (unsigned char)value;
+}
+
+static void rugged_commit_graph__free(rugged_commit_graph *graph)
+{
+	if (graph->map) {
+#ifndef _WIN32
+		munmap(graph->map, graph->map_size);
+#else
+		xfree(graph->map);
+#endif
+	}
+
+	xfree(graph);
+}
+
+static int graph_map_file(rugged_commit_graph *graph, const char *path)
+{
+	struct stat st;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return -1;
+
+	if (fstat(fd, &st) < 0 || st.st_size < GRAPH_HEADER_SIZE + GRAPH_FANOUT_SIZE) {
+		close(fd);
+		return -1;
+	}
+
+	graph->map_size = (size_t)st.st_size;
+
+#ifndef _WIN32
+	graph->map = mmap(NULL, graph->map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (graph->map == MAP_FAILED) {
+		graph->map = NULL;
+		return -1;
+	}
+#else
+	graph->map = xmalloc(graph->map_size);
+	if (read(fd, graph->map, graph->map_size) != (ssize_t)graph->map_size) {
+		close(fd);
+		return -1;
+	}
+	close(fd);
+#endif
+
+	return 0;
+}
+
+static inline int graph_valid_parent(const rugged_commit_graph *graph, uint32_t parent)
+{
+	return parent == GRAPH_PARENT_NONE || parent < graph->nr_commits;
+}
+
+/*
+ * Check every position the lookups will follow, so that a damaged file
+ * is rejected up front instead of sending them out of bounds: the fanout
+ * has to be sorted, and every parent and extra edge has to point at a
+ * commit in the table.
+ */
+static int graph_verify(const rugged_commit_graph *graph)
+{
+	uint32_t i, prev = 0;
+
+	for (i = 0; i < 256; ++i) {
+		uint32_t count = graph_get_be32(graph->fanout + i * 4);
+
+		if (count < prev)
+			return -1;
+		prev = count;
+	}
+
+	for (i = 0; i < graph->nr_commits; ++i) {
+		const unsigned char *data = graph->data + (size_t)i * GRAPH_DATA_SIZE;
+		uint32_t parent2 = graph_get_be32(data + 4);
+
+		if (!graph_valid_parent(graph, graph_get_be32(data)))
+			return -1;
+
+		if (parent2 & GRAPH_EXTRA_EDGES) {
+			if ((parent2 & ~GRAPH_EXTRA_EDGES) >= graph->nr_extra_edges)
+				return -1;
+		} else if (!graph_valid_parent(graph, parent2)) {
+			return -1;
+		}
+	}
+
+	for (i = 0; i < graph->nr_extra_edges; ++i) {
+		uint32_t edge = graph_get_be32(graph->extra_edges + (size_t)i * 4);
+
+		if ((edge & ~GRAPH_EDGE_LAST) >= graph->nr_commits)
+			return -1;
+	}
+
+	return 0;
+}
+
+static int graph_parse(rugged_commit_graph *graph)
+{
+	const unsigned char *p = graph->map;
+	size_t expected;
+
+	if (memcmp(p, GRAPH_SIGNATURE, 4) != 0 || graph_get_be32(p + 4) != GRAPH_VERSION)
+		return -1;
+
+	graph->nr_commits = graph_get_be32(p + 8);
+	graph->nr_extra_edges = graph_get_be32(p + 12);
+
+	expected = GRAPH_HEADER_SIZE + GRAPH_FANOUT_SIZE +
+		(size_t)graph->nr_commits * (GIT_OID_RAWSZ + GRAPH_DATA_SIZE) +
+		(size_t)graph->nr_extra_edges * 4;
+
+	if (expected != graph->map_size)
+		return -1;
+
+	graph->fanout = p + GRAPH_HEADER_SIZE;
+	graph->oids = graph->fanout + GRAPH_FANOUT_SIZE;
+	graph->data = graph->oids + (size_t)graph->nr_commits * GIT_OID_RAWSZ;
+	graph->extra_edges = graph->data + (size_t)graph->nr_commits * GRAPH_DATA_SIZE;
+
+	if (graph_get_be32(graph->fanout + 255 * 4) != graph->nr_commits)
+		return -1;
+
+	return graph_verify(graph);
+}
+
+static VALUE rugged_commit_graph_load(git_repository *repo)
+{
+	rugged_commit_graph *graph;
+	const char *repo_path = git_repository_path(repo);
+	char *path;
+
+	if (!repo_path)
+		return Qfalse;
+
+	path = alloca(strlen(repo_path) + strlen(GRAPH_FILE) + 1);
+	strcpy(path, repo_path);
+	strcat(path, GRAPH_FILE);
+
+	graph = xcalloc(1, sizeof(rugged_commit_graph));
+
+	/* A missing or damaged graph is not an error, we simply don't use it */
+	if (graph_map_file(graph, path) < 0 || graph_parse(graph) < 0) {
+		rugged_commit_graph__free(graph);
+		return Qfalse;
+	}
+
+	return Data_Wrap_Struct(rb_cRuggedCommitGraph, NULL, &rugged_commit_graph__free, graph);
+}
+
+rugged_commit_graph *rugged_repo_commit_graph(VALUE rb_repo)
+{
+	VALUE rb_graph = rb_iv_get(rb_repo, "@commit_graph");
+	rugged_commit_graph *graph;
+
+	if (NIL_P(rb_graph)) {
+		git_repository *repo;
+		Data_Get_Struct(rb_repo, git_repository, repo);
+
+		rb_graph = rugged_commit_graph_load(repo);
+		rb_iv_set(rb_repo, "@commit_graph", rb_graph);
+	}
+
+	if (rb_graph == Qfalse)
+		return NULL;
+
+	Data_Get_Struct(rb_graph, rugged_commit_graph, graph);
+	return graph;
+}
+
+int rugged_commit_graph_find(const rugged_commit_graph *graph, const git_oid *oid, uint32_t *pos)
+{
+	uint32_t lo, hi, mid;
+	int cmp;
+
+	lo = oid->id[0] ? graph_get_be32(graph->fanout + (oid->id[0] - 1) * 4) : 0;
+	hi = graph_get_be32(graph->fanout + oid->id[0] * 4);
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		cmp = memcmp(oid->id, graph->oids + (size_t)mid * GIT_OID_RAWSZ, GIT_OID_RAWSZ);
+
+		if (cmp == 0) {
+			*pos = mid;
+			return 1;
+		} else if (cmp < 0) {
+			hi = mid;
+		} else {
+			lo = mid + 1;
+		}
+	}
+
+	return 0;
+}
+
+static inline const unsigned char *graph_data(const rugged_commit_graph *graph, uint32_t pos)
+{
+	return graph->data + (size_t)pos * GRAPH_DATA_SIZE;
+}
+
+static uint32_t graph_generation(const rugged_commit_graph *graph, uint32_t pos)
+{
+	return graph_get_be32(graph_data(graph, pos) + 8);
+}
+
+static void graph_oid(git_oid *out, const rugged_commit_graph *graph, uint32_t pos)
+{
+	git_oid_fromraw(out, graph->oids + (size_t)pos * GIT_OID_RAWSZ);
+}
+
+static size_t graph_parents(uint32_t *out, size_t max, const rugged_commit_graph *graph, uint32_t pos)
+{
+	const unsigned char *data = graph_data(graph, pos);
+	uint32_t parent;
+	size_t n = 0;
+
+	if ((parent = graph_get_be32(data)) == GRAPH_PARENT_NONE)
+		return 0;
+
+	if (n < max) out[n] = parent;
+	n++;
+
+	if ((parent = graph_get_be32(data + 4)) == GRAPH_PARENT_NONE)
+		return n;
+
+	if (!(parent & GRAPH_EXTRA_EDGES)) {
+		if (n < max) out[n] = parent;
+		return n + 1;
+	}
+
+	parent &= ~GRAPH_EXTRA_EDGES;
+	while (parent < graph->nr_extra_edges) {
+		uint32_t edge = graph_get_be32(graph->extra_edges + (size_t)parent * 4);
+
+		if (n < max) out[n] = edge & ~GRAPH_EDGE_LAST;
+		n++;
+
+		if (edge & GRAPH_EDGE_LAST)
+			break;
+		parent++;
+	}
+
+	return n;
+}
+
+/*
+ * Priority queue of graph positions, highest generation first. Visiting
+ * commits by generation guarantees that every child of a commit has been
+ * visited before the commit itself.
+ */
+struct graph_queue {
+	const rugged_commit_graph *graph;
+	uint32_t *items;
+	size_t len, alloc;
+};
+
+static inline int graph_queue_higher(struct graph_queue *q, uint32_t a, uint32_t b)
+{
+	return graph_generation(q->graph, a) > graph_generation(q->graph, b);
+}
+
+static int graph_queue_push(struct graph_queue *q, uint32_t pos)
+{
+	size_t i;
+
+	if (q->len == q->alloc) {
+		size_t alloc = q->alloc ? q->alloc * 2 : 64;
+		uint32_t *items = realloc(q->items, alloc * sizeof(uint32_t));
+		if (!items) {
+			giterr_set_oom();
+			return -1;
+		}
+		q->items = items;
+		q->alloc = alloc;
+	}
+
+	i = q->len++;
+	while (i > 0 && graph_queue_higher(q, pos, q->items[(i - 1) / 2])) {
+		q->items[i] = q->items[(i - 1) / 2];
+		i = (i - 1) / 2;
+	}
+	q->items[i] = pos;
+
+	return 0;
+}
+
+static uint32_t graph_queue_pop(struct graph_queue *q)
+{
+	uint32_t top = q->items[0], last = q->items[--q->len];
+	size_t i = 0, child;
+
+	while ((child = 2 * i + 1) < q->len) {
+		if (child + 1 < q->len && graph_queue_higher(q, q->items[child + 1], q->items[child]))
+			child++;
+		if (!graph_queue_higher(q, q->items[child], last))
+			break;
+		q->items[i] = q->items[child];
+		i = child;
+	}
+	if (q->len > 0)
+		q->items[i] = last;
+
+	return top;
+}
+
+#define PAINT_ONE 1
+#define PAINT_TWO 2
+#define PAINT_STALE 4
+#define PAINT_RESULT 8
+#define PAINT_VISITED 16
+
+struct graph_paint {
+	struct graph_queue queue;
+	unsigned char *flags;
+};
+
+static int graph_paint_init(struct graph_paint *paint, const rugged_commit_graph *graph)
+{
+	memset(paint, 0, sizeof(*paint));
+	paint->queue.graph = graph;
+
+	if ((paint->flags = calloc(graph->nr_commits, 1)) == NULL) {
+		giterr_set_oom();
+		return -1;
+	}
+
+	return 0;
+}
+
+static void graph_paint_free(struct graph_paint *paint)
+{
+	free(paint->flags);
+	free(paint->queue.items);
+}
+
+static int graph_paint_push(struct graph_paint *paint, uint32_t pos, unsigned char flags)
+{
+	if ((paint->flags[pos] & flags) == flags)
+		return 0;
+
+	paint->flags[pos] |= flags;
+	return graph_queue_push(&paint->queue, pos);
+}
+
+static int graph_paint_has_nonstale(struct graph_paint *paint)
+{
+	size_t i;
+
+	for (i = 0; i < paint->queue.len; ++i) {
+		if (!(paint->flags[paint->queue.items[i]] & PAINT_STALE))
+			return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Paint the history down from +one+ (PAINT_ONE) and +two+ (PAINT_TWO),
+ * stopping as soon as only commits reachable from both sides are left.
+ * +visit+ is called exactly once per commit, with its final flags.
+ */
+static int graph_paint_down(struct graph_paint *paint, const rugged_commit_graph *graph,
+	uint32_t one, int has_two, uint32_t two,
+	void (*visit)(uint32_t pos, unsigned char flags, void *payload), void *payload)
+{
+	uint32_t parents[16], *all_parents = parents;
+	size_t nparents, i;
+	int error;
+
+	if ((error = graph_paint_push(paint, one, PAINT_ONE)) < 0)
+		return error;
+	if (has_two && (error = graph_paint_push(paint, two, PAINT_TWO)) < 0)
+		return error;
+
+	while (graph_paint_has_nonstale(paint)) {
+		uint32_t pos = graph_queue_pop(&paint->queue);
+		unsigned char flags = paint->flags[pos];
+
+		if (flags & PAINT_VISITED)
+			continue;
+		paint->flags[pos] |= PAINT_VISITED;
+
+		flags &= (PAINT_ONE | PAINT_TWO | PAINT_STALE);
+		if ((flags & (PAINT_ONE | PAINT_TWO)) == (PAINT_ONE | PAINT_TWO)) {
+			if (!(flags & PAINT_STALE))
+				paint->flags[pos] |= PAINT_RESULT;
+			flags |= PAINT_STALE;
+		}
+
+		if (visit)
+			visit(pos, paint->flags[pos], payload);
+
+		nparents = graph_parents(parents, 16, graph, pos);
+		if (nparents > 16) {
+			all_parents = malloc(nparents * sizeof(uint32_t));
+			if (!all_parents) {
+				giterr_set_oom();
+				return -1;
+			}
+			graph_parents(all_parents, nparents, graph, pos);
+		}
+
+		for (i = 0; i < nparents; ++i) {
+			if ((error = graph_paint_push(paint, all_parents[i], flags)) < 0)
+				break;
+		}
+
+		if (all_parents != parents) {
+			free(all_parents);
+			all_parents = parents;
+		}
+
+		if (error < 0)
+			return error;
+	}
+
+	return 0;
+}
+
+/*
+ * Returns 1 when +commit+ descends from +ancestor+, 0 when it doesn't and
+ * GIT_PASSTHROUGH when the graph doesn't know about one of the commits.
+ */
+int rugged_commit_graph_descendant_of(const rugged_commit_graph *graph, const git_oid *commit, const git_oid *ancestor)
+{
+	uint32_t from, to, generation, parents[16], *all_parents;
+	size_t nparents, i, stack_len = 0, stack_alloc = 64;
+	unsigned char *seen;
+	uint32_t *stack;
+	int found = 0;
+
+	if (!rugged_commit_graph_find(graph, commit, &from) ||
+		!rugged_commit_graph_find(graph, ancestor, &to))
+		return GIT_PASSTHROUGH;
+
+	if (from == to)
+		return 0;
+
+	generation = graph_generation(graph, to);
+	if (graph_generation(graph, from) <= generation)
+		return 0;
+
+	seen = calloc(graph->nr_commits, 1);
+	stack = malloc(stack_alloc * sizeof(uint32_t));
+	if (!seen || !stack) {
+		free(seen);
+		free(stack);
+		giterr_set_oom();
+		return -1;
+	}
+
+	stack[stack_len++] = from;
+	seen[from] = 1;
+
+	while (stack_len > 0 && !found) {
+		uint32_t pos = stack[--stack_len];
+
+		nparents = graph_parents(parents, 16, graph, pos);
+		all_parents = parents;
+		if (nparents > 16) {
+			all_parents = malloc(nparents * sizeof(uint32_t));
+			if (!all_parents) {
+				found = -1;
+				break;
+			}
+			graph_parents(all_parents, nparents, graph, pos);
+		}
+
+		for (i = 0; i < nparents; ++i) {
+			uint32_t parent = all_parents[i];
+
+			if (parent == to) {
+				found = 1;
+				break;
+			}
+
+			/* Nothing below the ancestor's generation can reach it */
+			if (seen[parent] || graph_generation(graph, parent) <= generation)
+				continue;
+			seen[parent] = 1;
+
+			if (stack_len == stack_alloc) {
+				uint32_t *new_stack = realloc(stack, stack_alloc * 2 * sizeof(uint32_t));
+				if (!new_stack) {
+					found = -1;
+					break;
+				}
+				stack = new_stack;
+				stack_alloc *= 2;
+			}
+			stack[stack_len++] = parent;
+		}
+
+		if (all_parents != parents)
+			free(all_parents);
+	}
+
+	free(seen);
+	free(stack);
+
+	if (found < 0)
+		giterr_set_oom();
+
+	return found;
+}
+
+struct graph_count_payload {
+	size_t one, two;
+};
+
+static void graph_count_cb(uint32_t pos, unsigned char flags, void *_payload)
+{
+	struct graph_count_payload *payload = _payload;
+
+	switch (flags & (PAINT_ONE | PAINT_TWO)) {
+	case PAINT_ONE: payload->one++; break;
+	case PAINT_TWO: payload->two++; break;
+	default: break;
+	}
+}
+
+/*
+ * Count the commits only reachable from +local+ and only reachable from
+ * +upstream+, like git_graph_ahead_behind(). Returns GIT_PASSTHROUGH when
+ * the graph can't answer the question.
+ */
+int rugged_commit_graph_ahead_behind(size_t *ahead, size_t *behind,
+	const rugged_commit_graph *graph, const git_oid *local, const git_oid *upstream)
+{
+	struct graph_paint paint;
+	struct graph_count_payload counts = {0, 0};
+	uint32_t one, two;
+	int error;
+
+	if (!rugged_commit_graph_find(graph, local, &one) ||
+		(upstream && !rugged_commit_graph_find(graph, upstream, &two)))
+		return GIT_PASSTHROUGH;
+
+	if ((error = graph_paint_init(&paint, graph)) < 0)
+		return error;
+
+	error = graph_paint_down(&paint, graph, one, upstream != NULL, two, graph_count_cb, &counts);
+	graph_paint_free(&paint);
+
+	if (error < 0)
+		return error;
+
+	*ahead = counts.one;
+	if (behind)
+		*behind = counts.two;
+
+	return 0;
+}
+
+/*
+ * Count the commits reachable from +show+ but not from +hide+ (which may
+ * be NULL).
+ */
+int rugged_commit_graph_count(size_t *out, const rugged_commit_graph *graph,
+	const git_oid *show, const git_oid *hide)
+{
+	return rugged_commit_graph_ahead_behind(out, NULL, graph, show, hide);
+}
+
+/*
+ * Find the merge base of +one+ and +two+. Returns GIT_ENOTFOUND when they
+ * share no history, and GIT_PASSTHROUGH when the graph can't give an
+ * unambiguous answer (unknown commits or several merge bases), in which
+ * case the caller should ask libgit2.
+ */
+int rugged_commit_graph_merge_base(git_oid *out, const rugged_commit_graph *graph,
+	const git_oid *one, const git_oid *two)
+{
+	struct graph_paint paint;
+	uint32_t pos_one, pos_two, pos, base = 0;
+	size_t nbases = 0;
+	int error;
+
+	if (!rugged_commit_graph_find(graph, one, &pos_one) ||
+		!rugged_commit_graph_find(graph, two, &pos_two))
+		return GIT_PASSTHROUGH;
+
+	if ((error = graph_paint_init(&paint, graph)) < 0)
+		return error;
+
+	if ((error = graph_paint_down(&paint, graph, pos_one, 1, pos_two, NULL, NULL)) < 0) {
+		graph_paint_free(&paint);
+		return error;
+	}
+
+	/*
+	 * A single candidate is the merge base. With two or more, picking
+	 * the best one takes more than the painting gives us, so defer to
+	 * libgit2.
+	 */
+	for (pos = 0; pos < graph->nr_commits && nbases < 2; ++pos) {
+		if (paint.flags[pos] & PAINT_RESULT) {
+			base = pos;
+			nbases++;
+		}
+	}
+	graph_paint_free(&paint);
+
+	if (nbases == 0)
+		return GIT_ENOTFOUND;
+	if (nbases > 1)
+		return GIT_PASSTHROUGH;
+
+	graph_oid(out, graph, base);
+	return 0;
+}
+
+/*
+ * Fetch the first parent of +oid+. Returns GIT_ENOTFOUND for root commits
+ * and GIT_PASSTHROUGH for commits the graph doesn't know about.
+ */
+int rugged_commit_graph_first_parent(git_oid *out, const rugged_commit_graph *graph, const git_oid *oid)
+{
+	uint32_t pos, parent;
+
+	if (!rugged_commit_graph_find(graph, oid, &pos))
+		return GIT_PASSTHROUGH;
+
+	if (graph_parents(&parent, 1, graph, pos) == 0)
+		return GIT_ENOTFOUND;
+
+	graph_oid(out, graph, parent);
+	return 0;
+}
+
+/*
+ * Writing
+ */
+
+struct graph_entry {
+	git_oid oid;
+	uint32_t topo;
+};
+
+struct graph_writer {
+	struct graph_entry *entries;
+	uint32_t *sorted_pos;
+	uint32_t *generation;
+	int64_t *time;
+	size_t *parent_start;
+	unsigned int *parent_count;
+	git_oid *parents;
+	size_t nr, alloc, nr_parents, alloc_parents;
+};
+
+static int graph_entry_cmp(const void *a, const void *b)
+{
+	return git_oid_cmp(&((const struct graph_entry *)a)->oid, &((const struct graph_entry *)b)->oid);
+}
+
+static int graph_writer_find(const struct graph_writer *w, const git_oid *oid, uint32_t *pos)
+{
+	size_t lo = 0, hi = w->nr;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		int cmp = git_oid_cmp(oid, &w->entries[mid].oid);
+
+		if (cmp == 0) {
+			*pos = (uint32_t)mid;
+			return 1;
+		} else if (cmp < 0) {
+			hi = mid;
+		} else {
+			lo = mid + 1;
+		}
+	}
+
+	return 0;
+}
+
+static void graph_writer_free(struct graph_writer *w)
+{
+	xfree(w->entries);
+	xfree(w->sorted_pos);
+	xfree(w->generation);
+	xfree(w->time);
+	xfree(w->parent_start);
+	xfree(w->parent_count);
+	xfree(w->parents);
+}
+
+static int graph_writer_add(struct graph_writer *w, git_repository *repo, const git_oid *oid)
+{
+	git_commit *commit;
+	unsigned int i, nparents;
+	int error;
+
+	if ((error = git_commit_lookup(&commit, repo, oid)) < 0)
+		return error;
+
+	if (w->nr == w->alloc) {
+		w->alloc = w->alloc ? w->alloc * 2 : 1024;
+		REALLOC_N(w->entries, struct graph_entry, w->alloc);
+		REALLOC_N(w->time, int64_t, w->alloc);
+		REALLOC_N(w->parent_start, size_t, w->alloc);
+		REALLOC_N(w->parent_count, unsigned int, w->alloc);
+	}
+
+	nparents = git_commit_parentcount(commit);
+	while (w->nr_parents + nparents > w->alloc_parents) {
+		w->alloc_parents = w->alloc_parents ? w->alloc_parents * 2 : 1024;
+		REALLOC_N(w->parents, git_oid, w->alloc_parents);
+	}
+
+	git_oid_cpy(&w->entries[w->nr].oid, oid);
+	w->entries[w->nr].topo = (uint32_t)w->nr;
+	w->time[w->nr] = (int64_t)git_commit_time(commit);
+	w->parent_start[w->nr] = w->nr_parents;
+	w->parent_count[w->nr] = nparents;
+
+	for (i = 0; i < nparents; ++i)
+		git_oid_cpy(&w->parents[w->nr_parents++], git_commit_parent_id(commit, i));
+
+	w->nr++;
+	git_commit_free(commit);
+
+	return 0;
+}
+
+/*
+ * Resolve the parents of the commit at topological position +topo+ to
+ * positions in the sorted OID table. Parents outside of the graph (e.g. in
+ * shallow repositories) are dropped.
+ */
+static size_t graph_writer_parents(uint32_t *out, const struct graph_writer *w, size_t topo)
+{
+	size_t i, n = 0;
+	uint32_t pos;
+
+	for (i = 0; i < w->parent_count[topo]; ++i) {
+		if (graph_writer_find(w, &w->parents[w->parent_start[topo] + i], &pos))
+			out[n++] = pos;
+	}
+
+	return n;
+}
+
+static int graph_writer_write(struct graph_writer *w, FILE *fp)
+{
+	unsigned char buf[GRAPH_DATA_SIZE], fanout[GRAPH_FANOUT_SIZE];
+	uint32_t *parents = NULL, nr_extra = 0;
+	size_t i, j, n, max_parents = 0;
+	int error = 0;
+
+	for (i = 0; i < w->nr; ++i) {
+		if (w->parent_count[i] > max_parents)
+			max_parents = w->parent_count[i];
+	}
+
+	parents = xmalloc((max_parents ? max_parents : 1) * sizeof(uint32_t));
+
+	/* Octopus merges can lose parents to shallowness; count what we write */
+	for (i = 0; i < w->nr; ++i) {
+		n = graph_writer_parents(parents, w, w->entries[i].topo);
+		if (n > 2)
+			nr_extra += (uint32_t)(n - 1);
+	}
+
+	memcpy(buf, GRAPH_SIGNATURE, 4);
+	graph_put_be32(buf + 4, GRAPH_VERSION);
+	graph_put_be32(buf + 8, (uint32_t)w->nr);
+	graph_put_be32(buf + 12, nr_extra);
+	if (fwrite(buf, GRAPH_HEADER_SIZE, 1, fp) != 1)
+		goto on_error;
+
+	for (i = 0, j = 0; i < 256; ++i) {
+		while (j < w->nr && w->entries[j].oid.id[0] <= i)
+			j++;
+		graph_put_be32(fanout + i * 4, (uint32_t)j);
+	}
+	if (fwrite(fanout, GRAPH_FANOUT_SIZE, 1, fp) != 1)
+		goto on_error;
+
+	for (i = 0; i < w->nr; ++i) {
+		if (fwrite(w->entries[i].oid.id, GIT_OID_RAWSZ, 1, fp) != 1)
+			goto on_error;
+	}
+
+	nr_extra = 0;
+	for (i = 0; i < w->nr; ++i) {
+		size_t topo = w->entries[i].topo;
+		uint64_t time = (uint64_t)w->time[topo];
+
+		n = graph_writer_parents(parents, w, topo);
+
+		graph_put_be32(buf, n > 0 ? parents[0] : GRAPH_PARENT_NONE);
+		if (n > 2) {
+			graph_put_be32(buf + 4, GRAPH_EXTRA_EDGES | nr_extra);
+			nr_extra += (uint32_t)(n - 1);
+		} else {
+			graph_put_be32(buf + 4, n > 1 ? parents[1] : GRAPH_PARENT_NONE);
+		}
+		graph_put_be32(buf + 8, w->generation[topo]);
+		graph_put_be32(buf + 12, (uint32_t)(time >> 32));
+		graph_put_be32(buf + 16, (uint32_t)time);
+
+		if (fwrite(buf, GRAPH_DATA_SIZE, 1, fp) != 1)
+			goto on_error;
+	}
+
+	for (i = 0; i < w->nr; ++i) {
+		n = graph_writer_parents(parents, w, w->entries[i].topo);
+		if (n <= 2)
+			continue;
+
+		for (j = 1; j < n; ++j) {
+			graph_put_be32(buf, parents[j] | (j == n - 1 ? GRAPH_EDGE_LAST : 0));
+			if (fwrite(buf, 4, 1, fp) != 1)
+				goto on_error;
+		}
+	}
+
+	goto cleanup;
+
+on_error:
+	error = -1;
+
+cleanup:
+	xfree(parents);
+	return error;
+}
+
+/*
+ *  call-seq:
+ *    repo.write_commit_graph -> count
+ *
+ *  Write a commit-graph file for every commit reachable from the
+ *  references in +repo+, and return the number of commits it contains.
+ *
+ *  The commit-graph stores the parents, commit time and generation number
+ *  of each commit in a compact file that is memory-mapped on demand. When
+ *  it is present, Repository#ahead_behind, Repository#merge_base,
+ *  Repository#descendant_of?, Walker.count and Commit.diff_between_repos
+ *  use it instead of parsing commits from the object database. Commits
+ *  created after the graph was written are handled the regular way, so
+ *  the graph only needs to be refreshed periodically.
+ */
+static VALUE rb_git_repo_write_commit_graph(VALUE self)
+{
+	struct graph_writer w;
+	git_repository *repo;
+	git_revwalk *walk;
+	git_oid oid;
+	const char *repo_path;
+	char *path, *lock_path;
+	FILE *fp;
+	uint32_t parents[64], *all_parents;
+	size_t i, j, n;
+	int error;
+
+	Data_Get_Struct(self, git_repository, repo);
+
+	repo_path = git_repository_path(repo);
+	if (!repo_path)
+		rb_raise(rb_eRuntimeError, "repository has no path to write the commit-graph to");
+
+	memset(&w, 0, sizeof(w));
+
+	error = git_revwalk_new(&walk, repo);
+	rugged_exception_check(error);
+
+	/* Parents come before their children, so generations are one pass */
+	git_revwalk_sorting(walk, GIT_SORT_TOPOLOGICAL | GIT_SORT_REVERSE);
+
+	error = git_revwalk_push_glob(walk, "refs/*");
+	while (error == GIT_OK && (error = git_revwalk_next(&oid, walk)) == GIT_OK)
+		error = graph_writer_add(&w, repo, &oid);
+	git_revwalk_free(walk);
+
+	if (error != GIT_ITEROVER) {
+		graph_writer_free(&w);
+		rugged_exception_check(error);
+	}
+
+	if (w.nr >= GRAPH_PARENT_NONE) {
+		graph_writer_free(&w);
+		rb_raise(rb_eRuntimeError, "too many commits for a commit-graph");
+	}
+
+	w.generation = xcalloc(w.nr ? w.nr : 1, sizeof(uint32_t));
+
+	qsort(w.entries, w.nr, sizeof(struct graph_entry), graph_entry_cmp);
+	w.sorted_pos = xmalloc((w.nr ? w.nr : 1) * sizeof(uint32_t));
+	for (i = 0; i < w.nr; ++i)
+		w.sorted_pos[w.entries[i].topo] = (uint32_t)i;
+
+	for (i = 0; i < w.nr; ++i) {
+		uint32_t generation = 1;
+
+		all_parents = parents;
+		if (w.parent_count[i] > 64)
+			all_parents = xmalloc(w.parent_count[i] * sizeof(uint32_t));
+
+		n = graph_writer_parents(all_parents, &w, i);
+		for (j = 0; j < n; ++j) {
+			uint32_t parent_generation = w.generation[w.entries[all_parents[j]].topo];
+			if (parent_generation >= generation)
+				generation = parent_generation + 1;
+		}
+		w.generation[i] = generation;
+
+		if (all_parents != parents)
+			xfree(all_parents);
+	}
+
+	path = alloca(strlen(repo_path) + strlen(GRAPH_FILE) + 1);
+	strcpy(path, repo_path);
+	strcat(path, GRAPH_FILE);
+
+	lock_path = alloca(strlen(path) + strlen(".lock") + 1);
+	strcpy(lock_path, path);
+	strcat(lock_path, ".lock");
+
+	if ((fp = fopen(lock_path, "wb")) == NULL) {
+		graph_writer_free(&w);
+		rb_sys_fail(lock_path);
+	}
+
+	error = graph_writer_write(&w, fp);
+	if (fclose(fp) != 0)
+		error = -1;
+
+	n = w.nr;
+	graph_writer_free(&w);
+
+	if (error < 0 || rename(lock_path, path) < 0) {
+		int os_errno = errno;
+		unlink(lock_path);
+		errno = os_errno;
+		rb_sys_fail(path);
+	}
+
+	/* Pick up the new graph on next use */
+	rb_iv_set(self, "@commit_graph", Qnil);
+
+	return ULONG2NUM((unsigned long)n);
+}
+
+/*
+ *  call-seq:
+ *    repo.commit_graph -> commit_graph or nil
+ *
+ *  Return the Rugged::CommitGraph loaded for +repo+, or +nil+ if no
+ *  commit-graph has been written (see Repository#write_commit_graph).
+ */
+static VALUE rb_git_repo_commit_graph(VALUE self)
+{
+	rugged_repo_commit_graph(self);
+	return RTEST(rb_iv_get(self, "@commit_graph")) ? rb_iv_get(self, "@commit_graph") : Qnil;
+}
+
+/*
+ *  call-seq:
+ *    commit_graph.count -> count
+ *
+ *  Return the number of commits stored in the commit-graph.
+ */
+static VALUE rb_git_commit_graph_count(VALUE self)
+{
+	rugged_commit_graph *graph;
+	Data_Get_Struct(self, rugged_commit_graph, graph);
+
+	return ULONG2NUM(graph->nr_commits);
+}
+
+/*
+ *  call-seq:
+ *    commit_graph.generation(oid) -> generation or nil
+ *
+ *  Return the generation number of the commit +oid+, or +nil+ if the
+ *  commit is not part of the graph. Root commits have generation 1, every
+ *  other commit is one more than the highest generation of its parents.
+ */
+static VALUE rb_git_commit_graph_generation(VALUE self, VALUE rb_oid)
+{
+	rugged_commit_graph *graph;
+	git_oid oid;
+	uint32_t pos;
+
+	Data_Get_Struct(self, rugged_commit_graph, graph);
+	Check_Type(rb_oid, T_STRING);
+	rugged_exception_check(git_oid_fromstr(&oid, StringValueCStr(rb_oid)));
+
+	if (!rugged_commit_graph_find(graph, &oid, &pos))
+		return Qnil;
+
+	return ULONG2NUM(graph_generation(graph, pos));
+}
+
+/*
+ *  call-seq:
+ *    commit_graph.include?(oid) -> true or false
+ *
+ *  Return whether the commit +oid+ is part of the commit-graph.
+ */
+static VALUE rb_git_commit_graph_include(VALUE self, VALUE rb_oid)
+{
+	rugged_commit_graph *graph;
+	git_oid oid;
+	uint32_t pos;
+
+	Data_Get_Struct(self, rugged_commit_graph, graph);
+	Check_Type(rb_oid, T_STRING);
+	rugged_exception_check(git_oid_fromstr(&oid, StringValueCStr(rb_oid)));
+
+	return rugged_commit_graph_find(graph, &oid, &pos) ? Qtrue : Qfalse;
+}
+
+void Init_rugged_commit_graph(void)
+{
+	rb_cRuggedCommitGraph = rb_define_class_under(rb_mRugged, "CommitGraph", rb_cObject);
+	rb_undef_alloc_func(rb_cRuggedCommitGraph);
+
+	rb_define_method(rb_cRuggedCommitGraph, "count", rb_git_commit_graph_count, 0);
+	rb_define_method(rb_cRuggedCommitGraph, "length", rb_git_commit_graph_count, 0);
+	rb_define_method(rb_cRuggedCommitGraph, "generation", rb_git_commit_graph_generation, 1);
+	rb_define_method(rb_cRuggedCommitGraph, "include?", rb_git_commit_graph_include, 1);
+
+	rb_define_method(rb_cRuggedRepo, "write_commit_graph", rb_git_repo_write_commit_graph, 0);
+	rb_define_method(rb_cRuggedRepo, "commit_graph", rb_git_repo_commit_graph, 0);
+}
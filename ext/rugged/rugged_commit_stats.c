@@ -6,10 +6,30 @@ VALUE rb_cRuggedCommitStats;
 typedef struct commit_stats commit_stats;
 
 struct rb_git_commit_stats_cb_args {
-    int adds, dels;
+    size_t adds, dels, files, bytes;
     char *path_only;
+    const struct rugged_diff_budget *budget;
+    int truncated;
 };
 
+static int git_commit_stats_file_cb(
+    const git_diff_delta *delta,
+    float progress,
+    void *payload)
+{
+    struct rb_git_commit_stats_cb_args *args = payload;
+
+    if (!args->path_only || (strcmp(args->path_only, delta->old_file.path) == 0 && strcmp(args->path_only, delta->new_file.path) == 0)) {
+        if (rugged_diff_budget_files_exceeded(args->budget, args->files + 1)) {
+            args->truncated = 1;
+            return GIT_EUSER;
+        }
+        args->files++;
+    }
+
+    return GIT_OK;
+}
+
 static int git_commit_stats_cb(
     const git_diff_delta *delta,
     const git_diff_hunk *hunk,
@@ -19,11 +39,21 @@ static int git_commit_stats_cb(
     struct rb_git_commit_stats_cb_args *args = payload;
 
     if (!args->path_only || (strcmp(args->path_only, delta->old_file.path) == 0 && strcmp(args->path_only, delta->new_file.path) == 0)) {
+        if (line->origin != GIT_DIFF_LINE_ADDITION && line->origin != GIT_DIFF_LINE_DELETION)
+            return GIT_OK;
+
+        if (rugged_diff_budget_lines_exceeded(args->budget,
+                args->adds + args->dels + 1, args->bytes + line->content_len)) {
+            args->truncated = 1;
+            return GIT_EUSER;
+        }
+
         switch (line->origin) {
         case GIT_DIFF_LINE_ADDITION: args->adds++; break;
         case GIT_DIFF_LINE_DELETION: args->dels++; break;
         default: break;
         }
+        args->bytes += line->content_len;
     }
 
     return GIT_OK;
@@ -39,67 +69,53 @@ VALUE rugged_commit_stats_new(struct commit_stats *stats) {
     return Data_Wrap_Struct(rb_cRuggedCommitStats, NULL, git_commit_stats__free, stats);
 }
 
+/*
+ * Count the additions, deletions and changed files between +parent_tree+
+ * and +tree+. When +budget+ runs out, the diff is stopped early and the
+ * stats are flagged as truncated. Safe to call without the GVL.
+ *
+ * With +path_only+, only that file is diffed. Callers are expected to
+ * have skipped the commits that don't touch it already, as the walker
+ * does, so the entries aren't looked up a second time here.
+ */
 int git_commit_stats_of(git_repository *repo, git_tree *tree, git_tree *parent_tree,
-                        const char *path_only, size_t *adds, size_t *dels) {
+                        const char *path_only, const struct rugged_diff_budget *budget,
+                        struct commit_stats *stats) {
     int error;
     git_diff *diff;
     git_diff_options diff_opts = GIT_DIFF_OPTIONS_INIT;
     struct rb_git_commit_stats_cb_args args;
 
+    if (path_only) {
+        /*
+         * Limit the diff to the file itself. The tree iterators use the
+         * pathspec prefix to skip every subtree outside of its directory.
+         */
+        diff_opts.pathspec.strings = (char **)&path_only;
+        diff_opts.pathspec.count = 1;
+        diff_opts.flags |= GIT_DIFF_DISABLE_PATHSPEC_MATCH;
+    }
+
     error = git_diff_tree_to_tree(&diff, repo, parent_tree, tree, &diff_opts);
     if (error == GIT_OK) {
-        args.adds = args.dels = 0;
-        args.path_only = path_only;
-        error = git_diff_foreach(diff, NULL, NULL, NULL, git_commit_stats_cb, &args);
+        args.adds = args.dels = args.files = args.bytes = 0;
+        args.path_only = (char *)path_only;
+        args.budget = budget;
+        args.truncated = 0;
+        error = git_diff_foreach(diff, git_commit_stats_file_cb, NULL, NULL, git_commit_stats_cb, &args);
         git_diff_free(diff);
-        *adds = args.adds;
-        *dels = args.dels;
+        if (args.truncated) {
+            giterr_clear();
+            error = GIT_OK;
+        }
+        stats->adds = args.adds;
+        stats->dels = args.dels;
+        stats->files = args.files;
+        stats->truncated = args.truncated;
     }
     return error;
 }
 
-VALUE rugged_commit_stats_of(git_repository *repo, git_commit *commit, const char *path_only) {
-    int error;
-    commit_stats *stats;
-    git_tree *tree, *parent_tree;
-    git_commit *parent_commit;
-
-    error = git_commit_tree(&tree, commit);
-    rugged_exception_check(error);
-
-    stats = xmalloc(sizeof(commit_stats));
-    stats->adds = stats->dels = 0;
-    git_signature_dup(&stats->committer, git_commit_committer(commit));
-    git_signature_dup(&stats->author, git_commit_author(commit));
-    git_oid_cpy(&stats->oid, git_commit_id(commit));
-
-    // Commit must not be merge commit here!
-    error = git_commit_parent(&parent_commit, commit, 0);
-    if (error == GIT_OK) {
-        error = git_commit_tree(&parent_tree, parent_commit);
-        git_commit_free(parent_commit);
-    } else if (error == GIT_ENOTFOUND) { // If commit has no parent, still ok
-        parent_tree = NULL;
-        error = GIT_OK;
-    }
-
-    if (error != GIT_OK) {
-        xfree(stats);
-        git_tree_free(tree);
-        rugged_exception_check(error);
-    }
-
-    error = git_commit_stats_of(repo, tree, parent_tree, path_only, &stats->adds, &stats->dels);
-    git_tree_free(tree);
-    if (parent_tree) git_tree_free(parent_tree);
-    if (error != GIT_OK) {
-        xfree(stats);
-        rugged_exception_check(error);
-    }
-
-    return rugged_commit_stats_new(stats);
-}
-
 static VALUE rb_git_commit_stats_adds_GET(VALUE self) {
     commit_stats *stats;
     Data_Get_Struct(self, commit_stats, stats);
@@ -112,6 +128,18 @@ static VALUE rb_git_commit_stats_dels_GET(VALUE self) {
     return INT2FIX((int) stats->dels);
 }
 
+static VALUE rb_git_commit_stats_files_GET(VALUE self) {
+    commit_stats *stats;
+    Data_Get_Struct(self, commit_stats, stats);
+    return INT2FIX((int) stats->files);
+}
+
+static VALUE rb_git_commit_stats_truncated_p(VALUE self) {
+    commit_stats *stats;
+    Data_Get_Struct(self, commit_stats, stats);
+    return stats->truncated ? Qtrue : Qfalse;
+}
+
 static VALUE rb_git_commit_stats_committer_GET(VALUE self) {
     commit_stats *stats;
     Data_Get_Struct(self, commit_stats, stats);
@@ -135,6 +163,8 @@ void Init_rugged_commit_stat(void)
     rb_cRuggedCommitStats = rb_define_class_under(rb_cRuggedCommit, "Stats", rb_cObject);
     rb_define_method(rb_cRuggedCommitStats, "adds", rb_git_commit_stats_adds_GET, 0);
     rb_define_method(rb_cRuggedCommitStats, "dels", rb_git_commit_stats_dels_GET, 0);
+    rb_define_method(rb_cRuggedCommitStats, "files", rb_git_commit_stats_files_GET, 0);
+    rb_define_method(rb_cRuggedCommitStats, "truncated?", rb_git_commit_stats_truncated_p, 0);
     rb_define_method(rb_cRuggedCommitStats, "committer", rb_git_commit_stats_committer_GET, 0);
     rb_define_method(rb_cRuggedCommitStats, "author", rb_git_commit_stats_author_GET, 0);
     rb_define_method(rb_cRuggedCommitStats, "oid", rb_git_commit_stats_oid_GET, 0);
@@ -0,0 +1,407 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2014 GitHub, Inc
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "rugged.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+extern VALUE rb_cRuggedRepo;
+extern VALUE rb_cRuggedCommitStats;
+VALUE rb_cRuggedCommitStatsCache;
+
+/*
+ * The stats cache is an append-only file of fixed 64-byte records in
+ * `$GIT_DIR/rugged-stats-cache`, one per (commit, first parent) pair:
+ *
+ *   magic "RGS1", commit OID, parent OID (zeros for root commits),
+ *   adds, dels, files, reserved, checksum (u32, big-endian)
+ *
+ * Records are appended with a single O_APPEND write, so several processes
+ * can share the file. Every record carries its own magic and checksum; a
+ * torn or interleaved write is skipped and the reader resynchronizes on
+ * the next valid record. Duplicate records are harmless.
+ */
+#define STATS_CACHE_FILE "rugged-stats-cache"
+#define STATS_CACHE_MAGIC "RGS1"
+#define STATS_CACHE_RECORD_SIZE 64
+#define STATS_CACHE_FLUSH_AT 256
+
+struct stats_cache_entry {
+	git_oid commit, parent;
+	uint32_t adds, dels, files;
+};
+
+struct rugged_stats_cache {
+	int fd;
+	off_t loaded;
+
+	struct stats_cache_entry *entries;
+	size_t nr_entries, alloc_entries;
+
+	/* open-addressing table of entry indexes + 1, 0 is empty */
+	uint32_t *table;
+	size_t table_size;
+
+	unsigned char *pending;
+	size_t nr_pending;
+};
+
+static inline uint32_t stats_cache_get_be32(const unsigned char *p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+		((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+static inline void stats_cache_put_be32(unsigned char *p, uint32_t value)
+{
+	p[0] = (unsigned char)(value >> 24);
+	p[1] = (unsigned char)(value >> 16);
+	p[2] = (unsigned char)(value >> 8);
+	p[3] = (unsigned char)value;
+}
+
+/* FNV-1a over everything but the checksum itself */
+static uint32_t stats_cache_checksum(const unsigned char *record)
+{
+	uint32_t hash = 2166136261u;
+	size_t i;
+
+	for (i = 0; i < STATS_CACHE_RECORD_SIZE - 4; ++i) {
+		hash ^= record[i];
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+static int stats_cache_record_valid(const unsigned char *record)
+{
+	return memcmp(record, STATS_CACHE_MAGIC, 4) == 0 &&
+		stats_cache_get_be32(record + 60) == stats_cache_checksum(record);
+}
+
+static inline size_t stats_cache_hash(const git_oid *commit, const git_oid *parent)
+{
+	/* OIDs are already uniformly distributed */
+	return (size_t)stats_cache_get_be32(commit->id) ^ (size_t)stats_cache_get_be32(parent->id + 4);
+}
+
+static struct stats_cache_entry *stats_cache_find(struct rugged_stats_cache *cache,
+	const git_oid *commit, const git_oid *parent)
+{
+	size_t i, mask = cache->table_size - 1;
+
+	if (cache->table_size == 0)
+		return NULL;
+
+	for (i = stats_cache_hash(commit, parent) & mask; cache->table[i]; i = (i + 1) & mask) {
+		struct stats_cache_entry *entry = &cache->entries[cache->table[i] - 1];
+		if (git_oid_equal(&entry->commit, commit) && git_oid_equal(&entry->parent, parent))
+			return entry;
+	}
+
+	return NULL;
+}
+
+static void stats_cache_table_insert(struct rugged_stats_cache *cache, size_t index)
+{
+	struct stats_cache_entry *entry = &cache->entries[index];
+	size_t i, mask = cache->table_size - 1;
+
+	for (i = stats_cache_hash(&entry->commit, &entry->parent) & mask; cache->table[i]; i = (i + 1) & mask)
+		;
+	cache->table[i] = (uint32_t)(index + 1);
+}
+
+static void stats_cache_insert(struct rugged_stats_cache *cache, const struct stats_cache_entry *entry)
+{
+	size_t i;
+
+	if (stats_cache_find(cache, &entry->commit, &entry->parent))
+		return;
+
+	if (cache->nr_entries == cache->alloc_entries) {
+		cache->alloc_entries = cache->alloc_entries ? cache->alloc_entries * 2 : 1024;
+		REALLOC_N(cache->entries, struct stats_cache_entry, cache->alloc_entries);
+	}
+
+	/* Keep the table at most half full */
+	if ((cache->nr_entries + 1) * 2 > cache->table_size) {
+		cache->table_size = cache->table_size ? cache->table_size * 2 : 2048;
+		xfree(cache->table);
+		cache->table = xcalloc(cache->table_size, sizeof(uint32_t));
+		for (i = 0; i < cache->nr_entries; ++i)
+			stats_cache_table_insert(cache, i);
+	}
+
+	cache->entries[cache->nr_entries] = *entry;
+	stats_cache_table_insert(cache, cache->nr_entries++);
+}
+
+/* Pick up the records appended (by us or by other processes) since the last read */
+static void stats_cache_refresh(struct rugged_stats_cache *cache)
+{
+	struct stat st;
+	unsigned char *buf, *p, *end;
+	size_t len;
+	ssize_t nread;
+
+	if (fstat(cache->fd, &st) < 0 || st.st_size - cache->loaded < STATS_CACHE_RECORD_SIZE)
+		return;
+
+	len = (size_t)(st.st_size - cache->loaded);
+	buf = xmalloc(len);
+
+	nread = pread(cache->fd, buf, len, cache->loaded);
+	if (nread <= 0) {
+		xfree(buf);
+		return;
+	}
+
+	p = buf;
+	end = buf + nread;
+	while (end - p >= STATS_CACHE_RECORD_SIZE) {
+		struct stats_cache_entry entry;
+
+		if (!stats_cache_record_valid(p)) {
+			p++;
+			continue;
+		}
+
+		git_oid_fromraw(&entry.commit, p + 4);
+		git_oid_fromraw(&entry.parent, p + 24);
+		entry.adds = stats_cache_get_be32(p + 44);
+		entry.dels = stats_cache_get_be32(p + 48);
+		entry.files = stats_cache_get_be32(p + 52);
+		stats_cache_insert(cache, &entry);
+
+		p += STATS_CACHE_RECORD_SIZE;
+	}
+
+	/* A partial record at the end may still be in the middle of being written */
+	cache->loaded += p - buf;
+	xfree(buf);
+}
+
+void rugged_stats_cache_flush(rugged_stats_cache *cache)
+{
+	if (cache->nr_pending == 0)
+		return;
+
+	/* Best effort: a cache that can't be written is just a slower cache */
+	if (write(cache->fd, cache->pending, cache->nr_pending * STATS_CACHE_RECORD_SIZE) < 0) {
+		/* nothing to do */
+	}
+
+	cache->nr_pending = 0;
+}
+
+/*
+ * Look up the stats of +commit+ against +parent+ (NULL for root commits).
+ * Fills in adds, dels and files and returns 1 on a hit, 0 on a miss.
+ */
+int rugged_stats_cache_lookup(rugged_stats_cache *cache, const git_oid *commit,
+	const git_oid *parent, struct commit_stats *stats)
+{
+	struct stats_cache_entry *entry;
+	git_oid zero;
+
+	if (!parent) {
+		memset(&zero, 0, sizeof(zero));
+		parent = &zero;
+	}
+
+	if ((entry = stats_cache_find(cache, commit, parent)) == NULL) {
+		stats_cache_refresh(cache);
+		if ((entry = stats_cache_find(cache, commit, parent)) == NULL)
+			return 0;
+	}
+
+	stats->adds = entry->adds;
+	stats->dels = entry->dels;
+	stats->files = entry->files;
+	return 1;
+}
+
+/*
+ * Remember the stats of +commit+ against +parent+. Records are buffered
+ * and appended in batches; call rugged_stats_cache_flush() when done.
+ */
+void rugged_stats_cache_add(rugged_stats_cache *cache, const git_oid *commit,
+	const git_oid *parent, const struct commit_stats *stats)
+{
+	struct stats_cache_entry entry;
+	unsigned char *record;
+
+	memset(&entry, 0, sizeof(entry));
+	git_oid_cpy(&entry.commit, commit);
+	if (parent)
+		git_oid_cpy(&entry.parent, parent);
+
+	/* Counts that don't fit the record are not worth caching */
+	if (stats->adds > UINT32_MAX || stats->dels > UINT32_MAX || stats->files > UINT32_MAX)
+		return;
+
+	entry.adds = (uint32_t)stats->adds;
+	entry.dels = (uint32_t)stats->dels;
+	entry.files = (uint32_t)stats->files;
+
+	if (stats_cache_find(cache, &entry.commit, &entry.parent))
+		return;
+	stats_cache_insert(cache, &entry);
+
+	if (!cache->pending)
+		cache->pending = xmalloc(STATS_CACHE_FLUSH_AT * STATS_CACHE_RECORD_SIZE);
+
+	record = cache->pending + cache->nr_pending++ * STATS_CACHE_RECORD_SIZE;
+	memset(record, 0, STATS_CACHE_RECORD_SIZE);
+	memcpy(record, STATS_CACHE_MAGIC, 4);
+	memcpy(record + 4, entry.commit.id, GIT_OID_RAWSZ);
+	memcpy(record + 24, entry.parent.id, GIT_OID_RAWSZ);
+	stats_cache_put_be32(record + 44, entry.adds);
+	stats_cache_put_be32(record + 48, entry.dels);
+	stats_cache_put_be32(record + 52, entry.files);
+	stats_cache_put_be32(record + 60, stats_cache_checksum(record));
+
+	if (cache->nr_pending == STATS_CACHE_FLUSH_AT)
+		rugged_stats_cache_flush(cache);
+}
+
+static void rugged_stats_cache__free(rugged_stats_cache *cache)
+{
+	rugged_stats_cache_flush(cache);
+	close(cache->fd);
+
+	xfree(cache->entries);
+	xfree(cache->table);
+	xfree(cache->pending);
+	xfree(cache);
+}
+
+rugged_stats_cache *rugged_repo_stats_cache(VALUE rb_repo)
+{
+	VALUE rb_cache = rb_iv_get(rb_repo, "@stats_cache");
+	rugged_stats_cache *cache;
+
+	if (NIL_P(rb_cache))
+		return NULL;
+
+	Data_Get_Struct(rb_cache, rugged_stats_cache, cache);
+	return cache;
+}
+
+/*
+ *  call-seq:
+ *    repo.stats_cache = true or false
+ *
+ *  Enable or disable the on-disk commit stats cache for +repo+.
+ *
+ *  When enabled, Commit.stats and +stats_only+ walks look up the stats of
+ *  each commit against its first parent in `$GIT_DIR/rugged-stats-cache`
+ *  before diffing anything, and append the stats they had to compute.
+ *  Walks using +path_only+ don't use the cache.
+ */
+static VALUE rb_git_repo_set_stats_cache(VALUE self, VALUE rb_enabled)
+{
+	git_repository *repo;
+	rugged_stats_cache *cache;
+	const char *repo_path;
+	char *path;
+	int fd;
+
+	if (!RTEST(rb_enabled)) {
+		rb_iv_set(self, "@stats_cache", Qnil);
+		return rb_enabled;
+	}
+
+	if (rugged_repo_stats_cache(self))
+		return rb_enabled;
+
+	Data_Get_Struct(self, git_repository, repo);
+
+	if ((repo_path = git_repository_path(repo)) == NULL)
+		rb_raise(rb_eRuntimeError, "repository has no path to keep a stats cache in");
+
+	path = alloca(strlen(repo_path) + strlen(STATS_CACHE_FILE) + 1);
+	strcpy(path, repo_path);
+	strcat(path, STATS_CACHE_FILE);
+
+	if ((fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644)) < 0)
+		rb_sys_fail(path);
+
+	cache = xcalloc(1, sizeof(rugged_stats_cache));
+	cache->fd = fd;
+
+	rb_iv_set(self, "@stats_cache",
+		Data_Wrap_Struct(rb_cRuggedCommitStatsCache, NULL, &rugged_stats_cache__free, cache));
+
+	stats_cache_refresh(cache);
+
+	return rb_enabled;
+}
+
+/*
+ *  call-seq:
+ *    repo.stats_cache? -> true or false
+ *
+ *  Return whether the commit stats cache is enabled for +repo+.
+ */
+static VALUE rb_git_repo_stats_cache_p(VALUE self)
+{
+	return rugged_repo_stats_cache(self) ? Qtrue : Qfalse;
+}
+
+/*
+ *  call-seq:
+ *    stats_cache.count -> count
+ *
+ *  Return the number of (commit, parent) pairs in the cache.
+ */
+static VALUE rb_git_stats_cache_count(VALUE self)
+{
+	rugged_stats_cache *cache;
+	Data_Get_Struct(self, rugged_stats_cache, cache);
+
+	stats_cache_refresh(cache);
+	return ULONG2NUM((unsigned long)cache->nr_entries);
+}
+
+void Init_rugged_commit_stats_cache(void)
+{
+	rb_cRuggedCommitStatsCache = rb_define_class_under(rb_cRuggedCommitStats, "Cache", rb_cObject);
+	rb_undef_alloc_func(rb_cRuggedCommitStatsCache);
+
+	rb_define_method(rb_cRuggedCommitStatsCache, "count", rb_git_stats_cache_count, 0);
+	rb_define_method(rb_cRuggedCommitStatsCache, "length", rb_git_stats_cache_count, 0);
+
+	rb_define_method(rb_cRuggedRepo, "stats_cache=", rb_git_repo_set_stats_cache, 1);
+	rb_define_method(rb_cRuggedRepo, "stats_cache?", rb_git_repo_stats_cache_p, 0);
+	rb_define_attr(rb_cRuggedRepo, "stats_cache", 1, 0);
+}
@@ -194,6 +194,38 @@ void rugged_parse_diff_options(git_diff_options *opts, VALUE rb_options)
 	}
 }
 
+static size_t parse_budget_value(VALUE rb_options, const char *key)
+{
+	VALUE rb_value = rb_hash_aref(rb_options, CSTR2SYM(key));
+
+	if (NIL_P(rb_value))
+		return 0;
+
+	Check_Type(rb_value, T_FIXNUM);
+	if (FIX2LONG(rb_value) <= 0)
+		rb_raise(rb_eArgError, "%s must be a positive number", key);
+
+	return FIX2ULONG(rb_value);
+}
+
+/*
+ * Read the +max_files+, +max_lines+ and +max_bytes+ budgets out of
+ * +rb_options+. A budget of 0 means no limit.
+ */
+void rugged_parse_diff_budget(struct rugged_diff_budget *budget, VALUE rb_options)
+{
+	memset(budget, 0, sizeof(*budget));
+
+	if (NIL_P(rb_options))
+		return;
+
+	Check_Type(rb_options, T_HASH);
+
+	budget->max_files = parse_budget_value(rb_options, "max_files");
+	budget->max_lines = parse_budget_value(rb_options, "max_lines");
+	budget->max_bytes = parse_budget_value(rb_options, "max_bytes");
+}
+
 static int diff_print_cb(
 	const git_diff_delta *delta,
 	const git_diff_hunk *hunk,
@@ -591,7 +623,9 @@ static VALUE rb_git_diff_size(VALUE self)
 }
 
 struct diff_stats {
-	size_t files, adds, dels;
+	size_t files, adds, dels, bytes;
+	const struct rugged_diff_budget *budget;
+	int truncated;
 };
 
 static int diff_file_stats_cb(
@@ -608,6 +642,10 @@ static int diff_file_stats_cb(
 	case GIT_DELTA_RENAMED:
 	case GIT_DELTA_COPIED:
 	case GIT_DELTA_TYPECHANGE:
+		if (rugged_diff_budget_files_exceeded(stats->budget, stats->files + 1)) {
+			stats->truncated = 1;
+			return GIT_EUSER;
+		}
 		stats->files++;
 		break;
 	default:
@@ -625,34 +663,88 @@ static int diff_line_stats_cb(
 {
 	struct diff_stats *stats = payload;
 
+	if (line->origin != GIT_DIFF_LINE_ADDITION && line->origin != GIT_DIFF_LINE_DELETION)
+		return GIT_OK;
+
+	if (rugged_diff_budget_lines_exceeded(stats->budget,
+			stats->adds + stats->dels + 1, stats->bytes + line->content_len)) {
+		stats->truncated = 1;
+		return GIT_EUSER;
+	}
+
 	switch (line->origin) {
 	case GIT_DIFF_LINE_ADDITION: stats->adds++; break;
 	case GIT_DIFF_LINE_DELETION: stats->dels++; break;
 	default: break;
 	}
+	stats->bytes += line->content_len;
 
 	return GIT_OK;
 }
 
+static int diff_stats_collect(VALUE self, struct diff_stats *stats)
+{
+	git_diff *diff;
+	Data_Get_Struct(self, git_diff, diff);
+
+	return git_diff_foreach(
+		diff, diff_file_stats_cb, NULL, NULL, diff_line_stats_cb, stats);
+}
+
 /*
  *  call-seq: diff.stat -> int, int, int
  *
  *  Returns the number of files/additions/deletions in this diff.
+ *
+ *  If the diff can't be generated completely, e.g. because a blob is
+ *  missing from the object database, the counts so far are returned.
  */
 static VALUE rb_git_diff_stat(VALUE self)
 {
-	git_diff *diff;
-	struct diff_stats stats = { 0, 0, 0 };
-
-	Data_Get_Struct(self, git_diff, diff);
+	struct diff_stats stats = { 0, 0, 0, 0, NULL, 0 };
 
-	git_diff_foreach(
-		diff, diff_file_stats_cb, NULL, NULL, diff_line_stats_cb, &stats);
+	if (diff_stats_collect(self, &stats) < 0)
+		giterr_clear();
 
 	return rb_ary_new3(
 		3, INT2FIX(stats.files), INT2FIX(stats.adds), INT2FIX(stats.dels));
 }
 
+/*
+ *  call-seq:
+ *    diff.stat_with_budget(max_files: n, max_lines: n, max_bytes: n) -> int, int, int, truncated
+ *
+ *  Like Diff#stat, but counting stops as soon as any of the +max_files+,
+ *  +max_lines+ (added plus deleted lines) or +max_bytes+ (of added and
+ *  deleted lines) budgets is used up. The fourth value tells whether the
+ *  counts were truncated. Budgets that aren't given are unlimited.
+ *
+ *  Unlike Diff#stat, this raises an error if the diff can't be
+ *  generated, e.g. because a blob is missing from the object database.
+ */
+static VALUE rb_git_diff_stat_with_budget(int argc, VALUE *argv, VALUE self)
+{
+	struct rugged_diff_budget budget;
+	struct diff_stats stats = { 0, 0, 0, 0, NULL, 0 };
+	VALUE rb_options;
+	int error;
+
+	rb_scan_args(argc, argv, "00:", &rb_options);
+	rugged_parse_diff_budget(&budget, rb_options);
+
+	stats.budget = &budget;
+	error = diff_stats_collect(self, &stats);
+
+	if (stats.truncated)
+		giterr_clear();
+	else
+		rugged_exception_check(error);
+
+	return rb_ary_new3(
+		4, INT2FIX(stats.files), INT2FIX(stats.adds), INT2FIX(stats.dels),
+		stats.truncated ? Qtrue : Qfalse);
+}
+
 /*
  *  call-seq: diff.sorted_icase?
  *
@@ -677,6 +769,7 @@ void Init_rugged_diff(void)
 
 	rb_define_method(rb_cRuggedDiff, "size", rb_git_diff_size, 0);
 	rb_define_method(rb_cRuggedDiff, "stat", rb_git_diff_stat, 0);
+	rb_define_method(rb_cRuggedDiff, "stat_with_budget", rb_git_diff_stat_with_budget, -1);
 
 	rb_define_method(rb_cRuggedDiff, "sorted_icase?", rb_git_diff_sorted_icase_p, 0);
 
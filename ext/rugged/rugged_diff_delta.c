@@ -45,7 +45,7 @@ VALUE rb_git_delta_file_fromC(const git_diff_file *file)
 	return rb_file;
 }
 
-static VALUE rb_git_delta_status_fromC(git_delta_t status)
+VALUE rb_git_delta_status_fromC(git_delta_t status)
 {
 	switch(status) {
 		case GIT_DELTA_UNMODIFIED:
@@ -154,6 +154,8 @@ VALUE rugged_repo_new(VALUE klass, git_repository *repo)
 
 	rb_iv_set(rb_repo, "@config", Qnil);
 	rb_iv_set(rb_repo, "@index", Qnil);
+	rb_iv_set(rb_repo, "@commit_graph", Qnil);
+	rb_iv_set(rb_repo, "@stats_cache", Qnil);
 
 	return rb_repo;
 }
@@ -694,7 +696,15 @@ static VALUE rb_git_repo_merge_base(VALUE self, VALUE rb_args)
 		rugged_exception_check(error);
 	}
 
-	error = git_merge_base_many(&base, repo, len, input_array);
+	error = GIT_PASSTHROUGH;
+	if (len == 2) {
+		rugged_commit_graph *graph = rugged_repo_commit_graph(self);
+		if (graph)
+			error = rugged_commit_graph_merge_base(&base, graph, &input_array[0], &input_array[1]);
+	}
+
+	if (error == GIT_PASSTHROUGH)
+		error = git_merge_base_many(&base, repo, len, input_array);
 	xfree(input_array);
 
 	if (error == GIT_ENOTFOUND)
@@ -1192,6 +1202,7 @@ static VALUE rb_git_repo_descendant_of(VALUE self, VALUE rb_commit, VALUE rb_anc
 	int result;
 	int error;
 	git_repository *repo;
+	rugged_commit_graph *graph;
 	git_oid commit, ancestor;
 
 	Data_Get_Struct(self, git_repository, repo);
@@ -1202,7 +1213,12 @@ static VALUE rb_git_repo_descendant_of(VALUE self, VALUE rb_commit, VALUE rb_anc
 	error = rugged_oid_get(&ancestor, repo, rb_ancestor);
 	rugged_exception_check(error);
 
-	result = git_graph_descendant_of(repo, &commit, &ancestor);
+	result = GIT_PASSTHROUGH;
+	if ((graph = rugged_repo_commit_graph(self)) != NULL)
+		result = rugged_commit_graph_descendant_of(graph, &commit, &ancestor);
+
+	if (result == GIT_PASSTHROUGH)
+		result = git_graph_descendant_of(repo, &commit, &ancestor);
 	rugged_exception_check(result);
 
 	return result ? Qtrue : Qfalse;
@@ -1876,6 +1892,7 @@ static VALUE rb_git_repo_get_namespace(VALUE self)
  */
 static VALUE rb_git_repo_ahead_behind(VALUE self, VALUE rb_local, VALUE rb_upstream) {
 	git_repository *repo;
+	rugged_commit_graph *graph;
 	int error;
 	git_oid local, upstream;
 	size_t ahead, behind;
@@ -1889,7 +1906,12 @@ static VALUE rb_git_repo_ahead_behind(VALUE self, VALUE rb_local, VALUE rb_upstr
 	error = rugged_oid_get(&upstream, repo, rb_upstream);
 	rugged_exception_check(error);
 
-	error = git_graph_ahead_behind(&ahead, &behind, repo, &local, &upstream);
+	error = GIT_PASSTHROUGH;
+	if ((graph = rugged_repo_commit_graph(self)) != NULL)
+		error = rugged_commit_graph_ahead_behind(&ahead, &behind, graph, &local, &upstream);
+
+	if (error == GIT_PASSTHROUGH)
+		error = git_graph_ahead_behind(&ahead, &behind, repo, &local, &upstream);
 	rugged_exception_check(error);
 
 	rb_result = rb_ary_new2(2);
@@ -0,0 +1,346 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2014 GitHub, Inc
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "rugged.h"
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+extern VALUE rb_cRuggedRepo;
+
+#define HASH_FILES_BATCH 64
+/* Below this, a read() is cheaper than setting up a mapping */
+#define HASH_FILES_MMAP_MIN (64 * 1024)
+
+struct hash_file {
+	char *full_path;
+	const char *rel_path;
+	git_oid oid;
+};
+
+typedef struct {
+	rugged_batch_task base;
+	git_repository *repo;
+	git_odb *odb;
+	struct hash_file *files;
+	size_t start, end;
+	int write_objects;
+	int os_errno;
+	size_t os_errno_file;
+} hash_files_task;
+
+static int hash_file_store(hash_files_task *task, struct hash_file *file, const void *data, size_t len)
+{
+	int error = git_odb_hash(&file->oid, data, len, GIT_OBJ_BLOB);
+
+	if (error == GIT_OK && task->write_objects && !git_odb_exists(task->odb, &file->oid))
+		error = git_odb_write(&file->oid, task->odb, data, len, GIT_OBJ_BLOB);
+
+	return error;
+}
+
+/* System errors are returned as GIT_ERROR, with the errno in +os_errno+ */
+static int hash_file_read(hash_files_task *task, struct hash_file *file, size_t size, int *os_errno)
+{
+	void *data = NULL;
+	int fd, error;
+
+	if (size == 0)
+		return hash_file_store(task, file, "", 0);
+
+	if ((fd = open(file->full_path, O_RDONLY)) < 0)
+		goto os_error;
+
+#ifndef _WIN32
+	if (size >= HASH_FILES_MMAP_MIN) {
+		data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data == MAP_FAILED) {
+			*os_errno = errno;
+			close(fd);
+			return GIT_ERROR;
+		}
+		close(fd);
+
+		error = hash_file_store(task, file, data, size);
+		munmap(data, size);
+		return error;
+	}
+#endif
+
+	if ((data = malloc(size)) == NULL) {
+		close(fd);
+		*os_errno = ENOMEM;
+		return GIT_ERROR;
+	}
+
+	errno = 0;
+	if (read(fd, data, size) != (ssize_t)size) {
+		/* A short read means the file changed under us */
+		*os_errno = errno ? errno : EIO;
+		free(data);
+		close(fd);
+		return GIT_ERROR;
+	}
+	close(fd);
+
+	error = hash_file_store(task, file, data, size);
+	free(data);
+	return error;
+
+os_error:
+	*os_errno = errno;
+	return GIT_ERROR;
+}
+
+/*
+ * Hash one file the way `git add` would: symlinks are stored as their
+ * target, and the files inside the working directory go through the
+ * same filters (CRLF, ident, ...) as Blob.from_workdir. System errors
+ * are returned as GIT_ERROR, with the errno in +os_errno+.
+ */
+static int hash_file_one(hash_files_task *task, struct hash_file *file, int *os_errno)
+{
+	git_filter_list *filters = NULL;
+	struct stat st;
+	int error;
+
+#ifndef _WIN32
+	if (lstat(file->full_path, &st) < 0)
+		goto os_error;
+
+	if (S_ISLNK(st.st_mode)) {
+		char *target = malloc((size_t)st.st_size + 1);
+		ssize_t len;
+
+		if (target == NULL) {
+			*os_errno = ENOMEM;
+			return GIT_ERROR;
+		}
+
+		len = readlink(file->full_path, target, (size_t)st.st_size + 1);
+		if (len < 0) {
+			free(target);
+			goto os_error;
+		}
+
+		error = hash_file_store(task, file, target, (size_t)len);
+		free(target);
+		return error;
+	}
+#else
+	if (stat(file->full_path, &st) < 0)
+		goto os_error;
+#endif
+
+	if (!S_ISREG(st.st_mode)) {
+		*os_errno = S_ISDIR(st.st_mode) ? EISDIR : EINVAL;
+		return GIT_ERROR;
+	}
+
+	if (file->rel_path) {
+		error = git_filter_list_load(&filters, task->repo, NULL, file->rel_path,
+			GIT_FILTER_TO_ODB, GIT_FILTER_DEFAULT);
+		if (error < 0)
+			return error;
+	}
+
+	if (filters) {
+		git_buf out = { NULL, 0, 0 };
+
+		error = git_filter_list_apply_to_file(&out, filters, task->repo, file->full_path);
+		if (error == GIT_OK)
+			error = hash_file_store(task, file, out.ptr, out.size);
+
+		git_buf_free(&out);
+		git_filter_list_free(filters);
+		return error;
+	}
+
+	return hash_file_read(task, file, (size_t)st.st_size, os_errno);
+
+os_error:
+	*os_errno = errno;
+	return GIT_ERROR;
+}
+
+static void hash_files_task_run(void *payload)
+{
+	hash_files_task *task = payload;
+	size_t i;
+	int error, os_errno;
+
+	for (i = task->start; i < task->end; ++i) {
+		os_errno = 0;
+		error = hash_file_one(task, &task->files[i], &os_errno);
+
+		if (os_errno) {
+			task->os_errno = os_errno;
+			task->os_errno_file = i;
+			break;
+		} else if (error < 0) {
+			rugged_batch_task_set_error(&task->base, error);
+			break;
+		}
+	}
+
+	task->base.done = 1;
+}
+
+/*
+ *  call-seq:
+ *    repo.hash_files(paths, write: true) -> hash
+ *
+ *  Hash many files at once, and return a hash mapping each of the given
+ *  +paths+ to the OID of its blob. When +write+ is true (the default),
+ *  the blobs that are not in the object database yet are also written
+ *  to it, like Blob.from_workdir does.
+ *
+ *  Relative paths are relative to the working directory of the
+ *  repository (or to the current directory for bare repositories).
+ *  Files inside the working directory are filtered the same way as with
+ *  Blob.from_workdir; symlinks are stored as their target.
+ *
+ *  The files are read (or mapped, for the large ones) and hashed on the
+ *  thread pool, without holding the GVL. A SystemCallError is raised
+ *  for the first file that can't be read.
+ */
+static VALUE rb_git_repo_hash_files(int argc, VALUE *argv, VALUE self)
+{
+	VALUE rb_paths, rb_options, rb_result = Qnil;
+	git_repository *repo;
+	git_odb *odb = NULL;
+	struct hash_file *files;
+	hash_files_task *tasks;
+	const char *workdir;
+	size_t i, count, workdir_len = 0, nr_tasks;
+	int write_objects = 1, error, os_errno = 0, exception = 0;
+	long failed = -1;
+
+	rb_scan_args(argc, argv, "1:", &rb_paths, &rb_options);
+	Check_Type(rb_paths, T_ARRAY);
+
+	if (!NIL_P(rb_options)) {
+		VALUE rb_write = rb_hash_aref(rb_options, CSTR2SYM("write"));
+		if (!NIL_P(rb_write))
+			write_objects = RTEST(rb_write);
+	}
+
+	Data_Get_Struct(self, git_repository, repo);
+
+	count = RARRAY_LEN(rb_paths);
+	for (i = 0; i < count; ++i) {
+		VALUE rb_path = rb_ary_entry(rb_paths, i);
+		Check_Type(rb_path, T_STRING);
+		StringValueCStr(rb_path);
+	}
+
+	workdir = git_repository_workdir(repo);
+	if (workdir)
+		workdir_len = strlen(workdir);
+
+	rugged_exception_check(git_repository_odb(&odb, repo));
+
+	files = xcalloc(count ? count : 1, sizeof(struct hash_file));
+	for (i = 0; i < count; ++i) {
+		VALUE rb_path = rb_ary_entry(rb_paths, i);
+		const char *path = RSTRING_PTR(rb_path);
+		size_t len = RSTRING_LEN(rb_path);
+
+		if (workdir && path[0] != '/') {
+			files[i].full_path = xmalloc(workdir_len + len + 1);
+			memcpy(files[i].full_path, workdir, workdir_len);
+			memcpy(files[i].full_path + workdir_len, path, len + 1);
+		} else {
+			files[i].full_path = xmalloc(len + 1);
+			memcpy(files[i].full_path, path, len + 1);
+		}
+
+		/* The workdir always ends with a slash */
+		if (workdir && strncmp(files[i].full_path, workdir, workdir_len) == 0)
+			files[i].rel_path = files[i].full_path + workdir_len;
+	}
+
+	nr_tasks = (count + HASH_FILES_BATCH - 1) / HASH_FILES_BATCH;
+	tasks = xcalloc(nr_tasks ? nr_tasks : 1, sizeof(hash_files_task));
+	for (i = 0; i < nr_tasks; ++i) {
+		tasks[i].repo = repo;
+		tasks[i].odb = odb;
+		tasks[i].files = files;
+		tasks[i].write_objects = write_objects;
+		tasks[i].start = i * HASH_FILES_BATCH;
+		tasks[i].end = i + 1 < nr_tasks ? tasks[i].start + HASH_FILES_BATCH : count;
+	}
+
+	os_errno = rugged_pool_run_tasks(tasks, sizeof(hash_files_task), nr_tasks, hash_files_task_run, &exception);
+	error = GIT_OK;
+
+	if (!os_errno && !exception) {
+		for (i = 0; i < nr_tasks; ++i) {
+			if (tasks[i].os_errno) {
+				os_errno = tasks[i].os_errno;
+				failed = (long)tasks[i].os_errno_file;
+				break;
+			}
+		}
+	}
+
+	if (!os_errno && !exception)
+		error = rugged_batch_tasks_error(tasks, sizeof(hash_files_task), nr_tasks);
+
+	if (!os_errno && !exception && error == GIT_OK) {
+		rb_result = rb_hash_new();
+		for (i = 0; i < count; ++i)
+			rb_hash_aset(rb_result, rb_ary_entry(rb_paths, i), rugged_create_oid(&files[i].oid));
+	}
+
+	for (i = 0; i < nr_tasks; ++i)
+		free(tasks[i].base.error_message);
+	for (i = 0; i < count; ++i)
+		xfree(files[i].full_path);
+	xfree(tasks);
+	xfree(files);
+	git_odb_free(odb);
+
+	if (failed >= 0) {
+		VALUE rb_args[2];
+
+		rb_args[0] = rb_ary_entry(rb_paths, failed);
+		rb_args[1] = INT2FIX(os_errno);
+		rb_exc_raise(rb_class_new_instance(2, rb_args, rb_eSystemCallError));
+	}
+	rugged_batch_tasks_raise(os_errno, exception, error);
+
+	return rb_result;
+}
+
+void Init_rugged_repo_hash_files(void)
+{
+	rb_define_method(rb_cRuggedRepo, "hash_files", rb_git_repo_hash_files, -1);
+}
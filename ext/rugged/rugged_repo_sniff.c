@@ -0,0 +1,649 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2014 GitHub, Inc
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "rugged.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <dirent.h>
+#include <unistd.h>
+#endif
+
+/*
+ * libgit2 can only hand out whole objects, so to look at the first bytes
+ * of a blob we find it in the loose objects or the packs ourselves and
+ * inflate just what we need. Deltas (and objects in alternates) can't be
+ * read that way; they are read in full if they are small enough.
+ */
+#if defined(HAVE_ZLIB_H) && defined(HAVE_LIBZ) && !defined(_WIN32)
+#define SNIFF_PARTIAL_INFLATE 1
+#include <zlib.h>
+#endif
+
+extern VALUE rb_cRuggedRepo;
+
+#define SNIFF_DEFAULT_BYTES 8000
+#define SNIFF_FULL_READ_MAX (16 * 1024 * 1024)
+
+struct sniff_packs;
+
+struct sniff {
+	git_odb *odb;
+	const char *repo_path;
+	struct sniff_packs *packs;
+	git_oid oid;
+	size_t bytes;
+
+	size_t size;
+	git_otype type;
+	unsigned char *data;
+	size_t len;
+	int have_data;
+	int error;
+};
+
+#ifdef SNIFF_PARTIAL_INFLATE
+
+#define SNIFF_READ_CHUNK (16 * 1024)
+#define PACK_IDX_HEADER (8 + 256 * 4)
+
+static uint32_t sniff_be32(const unsigned char *p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+/*
+ * Inflate the zlib stream at +offset+ in +fd+ until +out_size+ bytes came
+ * out or the stream ended. Returns the number of bytes inflated, or -1.
+ */
+static ssize_t sniff_inflate(int fd, off_t offset, unsigned char *out, size_t out_size)
+{
+	unsigned char in[SNIFF_READ_CHUNK];
+	z_stream zs;
+	ssize_t nread;
+	int status = Z_OK;
+
+	memset(&zs, 0, sizeof(zs));
+	if (inflateInit(&zs) != Z_OK)
+		return -1;
+
+	zs.next_out = out;
+	zs.avail_out = (uInt)out_size;
+
+	while (zs.avail_out > 0 && status == Z_OK) {
+		if (zs.avail_in == 0) {
+			if ((nread = pread(fd, in, sizeof(in), offset)) <= 0) {
+				status = Z_DATA_ERROR;
+				break;
+			}
+			offset += nread;
+			zs.next_in = in;
+			zs.avail_in = (uInt)nread;
+		}
+
+		status = inflate(&zs, Z_NO_FLUSH);
+	}
+
+	inflateEnd(&zs);
+
+	if (status != Z_OK && status != Z_STREAM_END)
+		return -1;
+	return (ssize_t)(out_size - zs.avail_out);
+}
+
+static int sniff_loose(struct sniff *s)
+{
+	char hex[GIT_OID_HEXSZ + 1], *path;
+	unsigned char *buf, *nul;
+	/* "blob <size>\0" */
+	size_t header_max = 32, len;
+	ssize_t n;
+	int fd;
+
+	git_oid_tostr(hex, sizeof(hex), &s->oid);
+
+	if ((path = malloc(strlen(s->repo_path) + sizeof("objects/xx/") + GIT_OID_HEXSZ)) == NULL)
+		return 0;
+	sprintf(path, "%sobjects/%.2s/%s", s->repo_path, hex, hex + 2);
+
+	fd = open(path, O_RDONLY);
+	free(path);
+	if (fd < 0)
+		return 0;
+
+	if ((buf = malloc(s->bytes + header_max)) == NULL) {
+		close(fd);
+		return 0;
+	}
+
+	n = sniff_inflate(fd, 0, buf, s->bytes + header_max);
+	close(fd);
+
+	if (n <= 0 || (nul = memchr(buf, '\0', (size_t)n)) == NULL) {
+		free(buf);
+		return 0;
+	}
+
+	len = (size_t)n - (size_t)(nul + 1 - buf);
+	if (len > s->bytes)
+		len = s->bytes;
+
+	memcpy(s->data, nul + 1, len);
+	s->len = len;
+	free(buf);
+	return len == s->bytes;
+}
+
+/*
+ * The pack indexes of a repository, mapped once and kept on the
+ * repository object so every sniff doesn't open and map all of them
+ * again. The list is reloaded when the mtime of objects/pack changes;
+ * a pack added within the same second is only missed until then, and
+ * the object is read through the ODB in the meantime.
+ */
+#define SNIFF_PACKS_IVAR "__sniff_packs"
+
+struct sniff_pack {
+	char *pack_path;
+	const unsigned char *map;
+	size_t map_size;
+	uint32_t nr;
+};
+
+struct sniff_packs {
+	time_t mtime;
+	size_t nr_packs, alloc;
+	struct sniff_pack *packs;
+};
+
+static void sniff_packs__free(struct sniff_packs *packs)
+{
+	size_t i;
+
+	for (i = 0; i < packs->nr_packs; ++i) {
+		munmap((void *)packs->packs[i].map, packs->packs[i].map_size);
+		xfree(packs->packs[i].pack_path);
+	}
+
+	xfree(packs->packs);
+	xfree(packs);
+}
+
+/* Map the version 2 pack index at +idx_path+; returns 0 if it isn't one */
+static int sniff_pack_index_load(struct sniff_pack *pack, const char *idx_path)
+{
+	const unsigned char *map;
+	struct stat st;
+	size_t map_size;
+	uint32_t nr;
+	int fd;
+
+	if ((fd = open(idx_path, O_RDONLY)) < 0)
+		return 0;
+
+	if (fstat(fd, &st) < 0 || st.st_size < PACK_IDX_HEADER + 2 * GIT_OID_RAWSZ) {
+		close(fd);
+		return 0;
+	}
+
+	map_size = (size_t)st.st_size;
+	map = mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return 0;
+
+	if (memcmp(map, "\377tOc", 4) != 0 || sniff_be32(map + 4) != 2)
+		goto fail;
+
+	nr = sniff_be32(map + 8 + 255 * 4);
+	if (map_size < PACK_IDX_HEADER + (size_t)nr * (GIT_OID_RAWSZ + 8) + 2 * GIT_OID_RAWSZ)
+		goto fail;
+
+	pack->map = map;
+	pack->map_size = map_size;
+	pack->nr = nr;
+	return 1;
+
+fail:
+	munmap((void *)map, map_size);
+	return 0;
+}
+
+static struct sniff_packs *sniff_packs_load(const char *dir_path, time_t mtime)
+{
+	struct sniff_packs *packs = xcalloc(1, sizeof(struct sniff_packs));
+	struct dirent *entry;
+	struct sniff_pack pack;
+	DIR *dir;
+	size_t len;
+
+	packs->mtime = mtime;
+
+	if ((dir = opendir(dir_path)) == NULL)
+		return packs;
+
+	while ((entry = readdir(dir)) != NULL) {
+		len = strlen(entry->d_name);
+		if (len < 5 || strcmp(entry->d_name + len - 4, ".idx") != 0)
+			continue;
+
+		/* Room for swapping ".idx" for ".pack" */
+		pack.pack_path = xmalloc(strlen(dir_path) + len + 2);
+		sprintf(pack.pack_path, "%s%s", dir_path, entry->d_name);
+
+		if (!sniff_pack_index_load(&pack, pack.pack_path)) {
+			xfree(pack.pack_path);
+			continue;
+		}
+
+		strcpy(pack.pack_path + strlen(pack.pack_path) - 4, ".pack");
+
+		if (packs->nr_packs == packs->alloc) {
+			packs->alloc = packs->alloc ? packs->alloc * 2 : 8;
+			packs->packs = xrealloc(packs->packs, packs->alloc * sizeof(struct sniff_pack));
+		}
+		packs->packs[packs->nr_packs++] = pack;
+	}
+
+	closedir(dir);
+	return packs;
+}
+
+/*
+ * Return the cached pack indexes of +rb_repo+, reloading them if the pack
+ * directory changed. Must be called with the GVL held; the returned object
+ * has to be kept alive for as long as the indexes are used.
+ */
+static VALUE rugged_repo_sniff_packs(VALUE rb_repo, const char *repo_path)
+{
+	VALUE rb_packs = rb_iv_get(rb_repo, SNIFF_PACKS_IVAR);
+	struct sniff_packs *packs;
+	struct stat st;
+	char *dir_path;
+
+	dir_path = xmalloc(strlen(repo_path) + sizeof("objects/pack/"));
+	sprintf(dir_path, "%sobjects/pack/", repo_path);
+
+	if (stat(dir_path, &st) < 0)
+		st.st_mtime = 0;
+
+	if (!NIL_P(rb_packs)) {
+		Data_Get_Struct(rb_packs, struct sniff_packs, packs);
+		if (packs->mtime == st.st_mtime) {
+			xfree(dir_path);
+			return rb_packs;
+		}
+	}
+
+	packs = sniff_packs_load(dir_path, st.st_mtime);
+	xfree(dir_path);
+
+	/* A sniff still running on the old list keeps its own reference to it */
+	rb_packs = Data_Wrap_Struct(rb_cObject, NULL, &sniff_packs__free, packs);
+	rb_iv_set(rb_repo, SNIFF_PACKS_IVAR, rb_packs);
+
+	return rb_packs;
+}
+
+/* Look +oid+ up in a pack index; returns 1 and sets +offset+ if found */
+static int sniff_pack_index_find(const struct sniff_pack *pack, const git_oid *oid, off_t *offset)
+{
+	const unsigned char *map = pack->map, *oids, *offsets;
+	uint32_t lo, hi, nr = pack->nr, value;
+
+	oids = map + PACK_IDX_HEADER;
+	offsets = oids + (size_t)nr * (GIT_OID_RAWSZ + 4);
+
+	lo = oid->id[0] ? sniff_be32(map + 8 + (oid->id[0] - 1) * 4) : 0;
+	hi = sniff_be32(map + 8 + oid->id[0] * 4);
+	if (hi > nr || lo > hi)
+		return 0;
+
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+		int cmp = memcmp(oids + (size_t)mid * GIT_OID_RAWSZ, oid->id, GIT_OID_RAWSZ);
+
+		if (cmp == 0) {
+			value = sniff_be32(offsets + (size_t)mid * 4);
+
+			if (value & 0x80000000) {
+				/* Offsets past 2GB live in a table of 64-bit offsets */
+				const unsigned char *large = offsets + (size_t)nr * 4 + (size_t)(value & 0x7fffffff) * 8;
+
+				if (large + 8 > map + pack->map_size - 2 * GIT_OID_RAWSZ)
+					return 0;
+				*offset = (off_t)(((uint64_t)sniff_be32(large) << 32) | sniff_be32(large + 4));
+			} else {
+				*offset = (off_t)value;
+			}
+
+			return 1;
+		} else if (cmp < 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	return 0;
+}
+
+static int sniff_pack_entry(struct sniff *s, const char *pack_path, off_t offset)
+{
+	unsigned char header[32];
+	ssize_t n;
+	size_t pos = 0;
+	int fd, type;
+
+	if ((fd = open(pack_path, O_RDONLY)) < 0)
+		return 0;
+
+	if ((n = pread(fd, header, sizeof(header), offset)) <= 0) {
+		close(fd);
+		return 0;
+	}
+
+	/* Type and size, then the rest of the size 7 bits at a time */
+	type = (header[0] >> 4) & 7;
+	while (header[pos] & 0x80 && pos + 1 < (size_t)n)
+		pos++;
+	pos++;
+
+	/* Only whole objects can be cut short, deltas need their base */
+	if (type < GIT_OBJ_COMMIT || type > GIT_OBJ_TAG) {
+		close(fd);
+		return 0;
+	}
+
+	n = sniff_inflate(fd, offset + pos, s->data, s->bytes);
+	close(fd);
+
+	if (n < 0)
+		return 0;
+
+	s->len = (size_t)n;
+	return s->len == s->bytes;
+}
+
+static int sniff_packed(struct sniff *s)
+{
+	off_t offset;
+	size_t i;
+
+	if (!s->packs)
+		return 0;
+
+	for (i = 0; i < s->packs->nr_packs; ++i) {
+		const struct sniff_pack *pack = &s->packs->packs[i];
+
+		/* The object is in this pack; if we couldn't cut it short, no other pack will */
+		if (sniff_pack_index_find(pack, &s->oid, &offset))
+			return sniff_pack_entry(s, pack->pack_path, offset);
+	}
+
+	return 0;
+}
+
+#endif
+
+static void *sniff_run(void *payload)
+{
+	struct sniff *s = payload;
+	git_odb_object *object;
+
+	s->error = git_odb_read_header(&s->size, &s->type, s->odb, &s->oid);
+	if (s->error < 0 || s->type != GIT_OBJ_BLOB)
+		return NULL;
+
+	if (s->bytes > s->size)
+		s->bytes = s->size;
+
+	/* An empty blob is an empty text file; with no bytes to look at, we can't tell */
+	if (s->bytes == 0) {
+		s->have_data = (s->size == 0);
+		return NULL;
+	}
+
+	if ((s->data = malloc(s->bytes)) == NULL) {
+		giterr_set_oom();
+		s->error = GIT_ERROR;
+		return NULL;
+	}
+
+#ifdef SNIFF_PARTIAL_INFLATE
+	if (s->repo_path && (sniff_loose(s) || sniff_packed(s))) {
+		s->have_data = 1;
+		return NULL;
+	}
+#endif
+
+	if (s->size > SNIFF_FULL_READ_MAX)
+		return NULL;
+
+	if ((s->error = git_odb_read(&object, s->odb, &s->oid)) < 0)
+		return NULL;
+
+	memcpy(s->data, git_odb_object_data(object), s->bytes);
+	s->len = s->bytes;
+	s->have_data = 1;
+	git_odb_object_free(object);
+
+	return NULL;
+}
+
+/* Same heuristic as git_blob_is_binary() */
+static int sniff_is_binary(const unsigned char *data, size_t len)
+{
+	const unsigned char *scan = data, *end = data + len;
+	size_t printable = 0, nonprintable = 0;
+
+	if (len >= 3 && memcmp(data, "\xef\xbb\xbf", 3) == 0)
+		scan += 3;
+	else if (len >= 2 && (memcmp(data, "\xff\xfe", 2) == 0 || memcmp(data, "\xfe\xff", 2) == 0))
+		return 1;
+	else if (len >= 4 && memcmp(data, "\0\0\xfe\xff", 4) == 0)
+		return 1;
+
+	while (scan < end) {
+		unsigned char c = *scan++;
+
+		if ((c > 0x1f && c != 127) || c == '\b' || c == '\033' || c == '\014')
+			printable++;
+		else if (c == '\0')
+			return 1;
+		else if (!strchr(" \t\n\f\r\v", c))
+			nonprintable++;
+	}
+
+	return (printable >> 7) < nonprintable;
+}
+
+static const struct sniff_magic {
+	size_t offset;
+	const char *magic;
+	size_t len;
+	const char *mime;
+} sniff_magics[] = {
+	{ 0, "\x89PNG\r\n\x1a\n", 8, "image/png" },
+	{ 0, "GIF87a", 6, "image/gif" },
+	{ 0, "GIF89a", 6, "image/gif" },
+	{ 0, "\xff\xd8\xff", 3, "image/jpeg" },
+	{ 8, "WEBP", 4, "image/webp" },
+	{ 0, "II*\0", 4, "image/tiff" },
+	{ 0, "MM\0*", 4, "image/tiff" },
+	{ 0, "\0\0\1\0", 4, "image/x-icon" },
+	{ 0, "BM", 2, "image/bmp" },
+	{ 0, "%PDF-", 5, "application/pdf" },
+	{ 0, "%!PS", 4, "application/postscript" },
+	{ 0, "PK\3\4", 4, "application/zip" },
+	{ 0, "\x1f\x8b", 2, "application/gzip" },
+	{ 0, "BZh", 3, "application/x-bzip2" },
+	{ 0, "\xfd" "7zXZ\0", 6, "application/x-xz" },
+	{ 0, "7z\xbc\xaf\x27\x1c", 6, "application/x-7z-compressed" },
+	{ 257, "ustar", 5, "application/x-tar" },
+	{ 0, "\x7f" "ELF", 4, "application/x-elf" },
+	{ 0, "\xcf\xfa\xed\xfe", 4, "application/x-mach-binary" },
+	{ 0, "\xce\xfa\xed\xfe", 4, "application/x-mach-binary" },
+	{ 0, "\xca\xfe\xba\xbe", 4, "application/java-vm" },
+	{ 0, "MZ", 2, "application/x-msdownload" },
+	{ 0, "\0asm", 4, "application/wasm" },
+	{ 0, "SQLite format 3\0", 16, "application/vnd.sqlite3" },
+	{ 8, "WAVE", 4, "audio/wav" },
+	{ 0, "OggS", 4, "audio/ogg" },
+	{ 0, "fLaC", 4, "audio/flac" },
+	{ 0, "ID3", 3, "audio/mpeg" },
+	{ 4, "ftyp", 4, "video/mp4" },
+	{ 0, "\x1a\x45\xdf\xa3", 4, "video/webm" },
+	{ 0, "wOFF", 4, "font/woff" },
+	{ 0, "wOF2", 4, "font/woff2" },
+};
+
+static int sniff_contains(const unsigned char *data, size_t len, const char *needle)
+{
+	size_t i, needle_len = strlen(needle);
+
+	for (i = 0; i + needle_len <= len; ++i) {
+		if (data[i] == needle[0] && memcmp(data + i, needle, needle_len) == 0)
+			return 1;
+	}
+
+	return 0;
+}
+
+static const char *sniff_mime(const unsigned char *data, size_t len, int binary)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof(sniff_magics) / sizeof(sniff_magics[0]); ++i) {
+		const struct sniff_magic *m = &sniff_magics[i];
+
+		if (m->offset + m->len > len || memcmp(data + m->offset, m->magic, m->len) != 0)
+			continue;
+		/* Short signatures are too easy to hit in text files */
+		if (m->len < 4 && !binary)
+			continue;
+		return m->mime;
+	}
+
+	if (binary)
+		return "application/octet-stream";
+
+	if (len >= 4 && memcmp(data, "<svg", 4) == 0)
+		return "image/svg+xml";
+	if (len >= 5 && memcmp(data, "<?xml", 5) == 0)
+		return sniff_contains(data, len, "<svg") ? "image/svg+xml" : "application/xml";
+
+	return "text/plain";
+}
+
+/*
+ *  call-seq:
+ *    repo.sniff(oid, bytes: 8000) -> hash
+ *
+ *  Find out what the object +oid+ is without loading it: returns a hash
+ *  with its +:type+ and +:size+ and, for blobs, whether it's +:binary+
+ *  (with the same heuristic as Blob#binary?) and a +:mime+ type guessed
+ *  from its first bytes.
+ *
+ *  Only the first +bytes+ bytes of the blob are inflated, straight from
+ *  the loose object or the pack. Blobs stored as deltas can't be cut short
+ *  like that: they are read in full when smaller than 16MB, otherwise
+ *  +:binary+ and +:mime+ are +nil+. The same goes for every blob of a
+ *  repository opened with a custom +:backend+.
+ *
+ *    repo.sniff(oid) #=> {:type=>:blob, :size=>314572800, :binary=>true, :mime=>"application/zip"}
+ */
+static VALUE rb_git_repo_sniff(int argc, VALUE *argv, VALUE self)
+{
+	VALUE rb_oid, rb_options, rb_bytes, rb_result, rb_packs = Qnil;
+	git_repository *repo;
+	struct sniff s;
+	int binary;
+
+	rb_scan_args(argc, argv, "1:", &rb_oid, &rb_options);
+	Data_Get_Struct(self, git_repository, repo);
+	Check_Type(rb_oid, T_STRING);
+
+	memset(&s, 0, sizeof(s));
+	s.bytes = SNIFF_DEFAULT_BYTES;
+
+	if (!NIL_P(rb_options) && !NIL_P(rb_bytes = rb_hash_aref(rb_options, CSTR2SYM("bytes")))) {
+		long bytes = NUM2LONG(rb_bytes);
+		if (bytes < 0)
+			rb_raise(rb_eArgError, "bytes must not be negative");
+		s.bytes = (size_t)bytes;
+	}
+
+	rugged_exception_check(git_oid_fromstr(&s.oid, StringValueCStr(rb_oid)));
+	rugged_exception_check(git_repository_odb(&s.odb, repo));
+
+	/*
+	 * Objects are only read off disk for repositories with the stock
+	 * loose and pack backends. A repository opened with a
+	 * Rugged::Backend wraps a custom ODB and has no path, so it always
+	 * goes through git_odb_read().
+	 */
+	s.repo_path = git_repository_path(repo);
+
+#ifdef SNIFF_PARTIAL_INFLATE
+	if (s.repo_path) {
+		rb_packs = rugged_repo_sniff_packs(self, s.repo_path);
+		Data_Get_Struct(rb_packs, struct sniff_packs, s.packs);
+	}
+#endif
+
+	rugged_without_gvl(sniff_run, &s, NULL, NULL);
+	git_odb_free(s.odb);
+	RB_GC_GUARD(rb_packs);
+
+	if (s.error < 0) {
+		free(s.data);
+		rugged_exception_check(s.error);
+	}
+
+	rb_result = rb_hash_new();
+	rb_hash_aset(rb_result, CSTR2SYM("type"), rugged_otype_new(s.type));
+	rb_hash_aset(rb_result, CSTR2SYM("size"), SIZET2NUM(s.size));
+
+	if (s.have_data) {
+		binary = sniff_is_binary(s.data, s.len);
+		rb_hash_aset(rb_result, CSTR2SYM("binary"), binary ? Qtrue : Qfalse);
+		rb_hash_aset(rb_result, CSTR2SYM("mime"), rb_str_new_cstr(sniff_mime(s.data, s.len, binary)));
+	} else {
+		rb_hash_aset(rb_result, CSTR2SYM("binary"), Qnil);
+		rb_hash_aset(rb_result, CSTR2SYM("mime"), Qnil);
+	}
+
+	free(s.data);
+	return rb_result;
+}
+
+void Init_rugged_repo_sniff(void)
+{
+	rb_define_method(rb_cRuggedRepo, "sniff", rb_git_repo_sniff, -1);
+}
@@ -215,6 +215,7 @@ struct walk_options {
 	char *path_only;
 	int oid_only, stats_only, no_merges;
 	uint64_t offset, limit;
+	struct rugged_diff_budget budget;
 };
 
 static void load_walk_limits(struct walk_options *w, VALUE rb_options)
@@ -248,6 +249,8 @@ static void load_walk_limits(struct walk_options *w, VALUE rb_options)
 		w->no_merges = 1;
 		w->stats_only = 1;
 	}
+
+	rugged_parse_diff_budget(&w->budget, rb_options);
 }
 
 static VALUE load_all_options(VALUE _payload)
@@ -287,6 +290,76 @@ static VALUE load_all_options(VALUE _payload)
 	return Qnil;
 }
 
+/*
+ * Look up the tree of +commit+ and the tree of its first parent (NULL for
+ * root commits).
+ */
+static int walk_commit_trees(git_tree **tree, git_tree **parent_tree, git_commit *commit)
+{
+	git_commit *parent_commit;
+	int error;
+
+	error = git_commit_parent(&parent_commit, commit, 0);
+	if (error == GIT_OK) {
+		error = git_commit_tree(parent_tree, parent_commit);
+		git_commit_free(parent_commit);
+	} else if (error == GIT_ENOTFOUND) {
+		*parent_tree = NULL;
+		error = GIT_OK;
+	}
+
+	if (error != GIT_OK)
+		return error;
+
+	error = git_commit_tree(tree, commit);
+	if (error != GIT_OK && *parent_tree) {
+		git_tree_free(*parent_tree);
+		*parent_tree = NULL;
+	}
+
+	return error;
+}
+
+/*
+ * Returns 1 if the entry at +path+ differs between +tree+ and
+ * +parent_tree+, 0 if it doesn't, or an error code. This doesn't touch
+ * the Ruby VM and is safe to call from worker threads.
+ */
+static int walk_path_changed(git_tree *tree, git_tree *parent_tree, const char *path)
+{
+	git_tree_entry *left_entry = NULL, *right_entry = NULL;
+	int error, changed;
+
+	error = git_tree_entry_bypath(&left_entry, tree, path);
+	if (error == GIT_ENOTFOUND) {
+		left_entry = NULL;
+	} else if (error != GIT_OK) {
+		return error;
+	}
+
+	if (parent_tree) {
+		error = git_tree_entry_bypath(&right_entry, parent_tree, path);
+		if (error == GIT_ENOTFOUND) {
+			right_entry = NULL;
+		} else if (error != GIT_OK) {
+			if (left_entry) git_tree_entry_free(left_entry);
+			return error;
+		}
+	}
+
+	if (left_entry && right_entry) {
+		changed = !git_oid_equal(git_tree_entry_id(left_entry), git_tree_entry_id(right_entry)) ||
+			git_tree_entry_filemode(left_entry) != git_tree_entry_filemode(right_entry);
+	} else {
+		changed = left_entry || right_entry;
+	}
+
+	if (left_entry) git_tree_entry_free(left_entry);
+	if (right_entry) git_tree_entry_free(right_entry);
+
+	return changed;
+}
+
 struct apply_walk_options_args {
 	git_commit *commit;
 	struct walk_options *options;
@@ -295,7 +368,7 @@ struct apply_walk_options_args {
 static VALUE apply_walk_options(VALUE _payload) {
 	int error;
 	struct walk_options *w;
-	git_commit *commit, *right_commit;
+	git_commit *commit;
 	git_tree *tree, *right_tree;
 
 	w = ((struct apply_walk_options_args *)_payload)->options;
@@ -305,70 +378,301 @@ static VALUE apply_walk_options(VALUE _payload) {
 		return Qnil;
 
 	if (w->path_only) {
-		git_tree_entry *left_entry, *right_entry;
+		error = walk_commit_trees(&tree, &right_tree, commit);
+		rugged_exception_check(error);
+
+		error = walk_path_changed(tree, right_tree, w->path_only);
+		git_tree_free(tree);
+		if (right_tree) git_tree_free(right_tree);
 
-		error = git_commit_tree(&tree, commit);
 		rugged_exception_check(error);
+		if (!error)
+			return Qnil;
+	}
 
-		error = git_commit_parent(&right_commit, commit, 0);
-		if (error == GIT_OK) {
-			error = git_commit_tree(&right_tree, right_commit);
-			git_commit_free(right_commit);
-		}
-		else if (error == GIT_ENOTFOUND) {
-			right_tree = NULL;
-			error = GIT_OK;
-		}
+	/* Stats walks never get here, do_stats_walk() handles them */
+	return rugged_object_new(w->rb_owner, (git_object *)commit);
+}
+
+/*
+ * Stats walks are pipelined: the walking thread looks up commits and
+ * queues them into a window of slots, while the thread pool runs the
+ * tree-to-tree diffs. Results are yielded from the head of the window, so
+ * they come out in walk order even though they finish out of order.
+ */
+struct stats_walk;
+
+struct stats_walk_slot {
+	rugged_pool_task task;
+	struct stats_walk *sw;
+	git_tree *tree, *parent_tree;
+	struct commit_stats *stats;
+	git_oid parent_oid;
+	int has_parent, cached;
+	int done, skip, error, error_class;
+	char *error_message;
+};
+
+struct stats_walk {
+	struct walk_options *w;
+	struct stats_walk_slot *slots;
+	size_t window;
+	rugged_stats_cache *cache;
+
+	/* head: next slot to yield; submitted: slots handed to the pool */
+	size_t head, submitted;
+	volatile int interrupted;
+
+	rugged_pool_group group;
+	pthread_mutex_t mutex;
+	pthread_cond_t done_cond;
+};
+
+static void stats_walk_slot_run(void *payload)
+{
+	struct stats_walk_slot *slot = payload;
+	struct stats_walk *sw = slot->sw;
+	int error = GIT_OK;
+
+	if (sw->w->path_only) {
+		error = walk_path_changed(slot->tree, slot->parent_tree, sw->w->path_only);
+		if (error == 0)
+			slot->skip = 1;
+	}
+
+	if (error >= 0 && !slot->skip)
+		error = git_commit_stats_of(sw->w->repo, slot->tree, slot->parent_tree,
+			sw->w->path_only, &sw->w->budget, slot->stats);
+
+	if (error < 0) {
+		/* libgit2 errors are per-thread; carry it back to the walking thread */
+		const git_error *err = giterr_last();
+
+		slot->error = error;
+		slot->error_class = err ? err->klass : GITERR_INVALID;
+		slot->error_message = strdup(err ? err->message : "failed to compute commit stats");
+	}
+
+	pthread_mutex_lock(&sw->mutex);
+	slot->done = 1;
+	pthread_cond_broadcast(&sw->done_cond);
+	pthread_mutex_unlock(&sw->mutex);
+}
 
-		if (error != GIT_OK) {
-			git_tree_free(tree);
+static void *stats_walk_wait_head(void *payload)
+{
+	struct stats_walk *sw = payload;
+	struct stats_walk_slot *slot = &sw->slots[sw->head % sw->window];
+
+	pthread_mutex_lock(&sw->mutex);
+	while (!slot->done && !sw->interrupted)
+		pthread_cond_wait(&sw->done_cond, &sw->mutex);
+	pthread_mutex_unlock(&sw->mutex);
+
+	return NULL;
+}
+
+static void stats_walk_interrupt(void *payload)
+{
+	struct stats_walk *sw = payload;
+
+	pthread_mutex_lock(&sw->mutex);
+	sw->interrupted = 1;
+	pthread_cond_broadcast(&sw->done_cond);
+	pthread_mutex_unlock(&sw->mutex);
+}
+
+static void stats_walk_slot_clear(struct stats_walk_slot *slot)
+{
+	if (slot->tree) git_tree_free(slot->tree);
+	if (slot->parent_tree) git_tree_free(slot->parent_tree);
+	if (slot->stats) {
+		git_signature_free(slot->stats->committer);
+		git_signature_free(slot->stats->author);
+		xfree(slot->stats);
+	}
+	free(slot->error_message);
+	memset(slot, 0, sizeof(*slot));
+}
+
+/*
+ * Fill the next free slot with +commit+ and queue it on the pool.
+ * Returns 0 when the commit was queued, 1 when it was filtered out, a
+ * libgit2 error code, or sets +os_errno+ if the pool couldn't start.
+ */
+static int stats_walk_submit(struct stats_walk *sw, git_commit *commit, int *os_errno)
+{
+	struct stats_walk_slot *slot = &sw->slots[sw->submitted % sw->window];
+	int error;
+
+	if (sw->w->no_merges && git_commit_parentcount(commit) > 1)
+		return 1;
+
+	slot->sw = sw;
+	slot->stats = xcalloc(1, sizeof(struct commit_stats));
+	git_oid_cpy(&slot->stats->oid, git_commit_id(commit));
+
+	if ((error = git_signature_dup(&slot->stats->committer, git_commit_committer(commit))) < 0 ||
+		(error = git_signature_dup(&slot->stats->author, git_commit_author(commit))) < 0) {
+		stats_walk_slot_clear(slot);
+		return error;
+	}
+
+	if (git_commit_parentcount(commit) > 0) {
+		git_oid_cpy(&slot->parent_oid, git_commit_parent_id(commit, 0));
+		slot->has_parent = 1;
+	}
+
+	/* Cached stats are ready to be yielded right away */
+	if (sw->cache && rugged_stats_cache_lookup(sw->cache, &slot->stats->oid,
+			slot->has_parent ? &slot->parent_oid : NULL, slot->stats)) {
+		slot->cached = 1;
+		slot->done = 1;
+		sw->submitted++;
+		return 0;
+	}
+
+	if ((error = walk_commit_trees(&slot->tree, &slot->parent_tree, commit)) < 0) {
+		stats_walk_slot_clear(slot);
+		return error;
+	}
+
+	if ((*os_errno = rugged_pool_submit(&sw->group, &slot->task, stats_walk_slot_run, slot))) {
+		stats_walk_slot_clear(slot);
+		return 0;
+	}
+
+	sw->submitted++;
+	return 0;
+}
+
+static VALUE stats_walk_run(VALUE _payload)
+{
+	struct stats_walk *sw = (struct stats_walk *)_payload;
+	struct walk_options *w = sw->w;
+	struct stats_walk_slot *slot;
+	int error = GIT_OK, os_errno = 0, walk_done = 0;
+	git_oid commit_oid;
+	git_commit *commit;
+	VALUE rb_result;
+
+	for (;;) {
+		while (!walk_done && sw->submitted - sw->head < sw->window) {
+			if ((error = git_revwalk_next(&commit_oid, w->walk)) == GIT_ITEROVER) {
+				walk_done = 1;
+				break;
+			}
 			rugged_exception_check(error);
-		}
 
-		error = git_tree_entry_bypath(&left_entry, tree, w->path_only);
-		git_tree_free(tree);
-		if (error == GIT_ENOTFOUND) {
-			left_entry = NULL;
-			error = GIT_OK;
-		} else if (error != GIT_OK) {
-			if (right_tree) git_tree_free(right_tree);
+			if (w->offset > 0) {
+				w->offset--;
+				continue;
+			}
+
+			error = git_commit_lookup(&commit, w->repo, &commit_oid);
 			rugged_exception_check(error);
-		}
 
-		if (right_tree) {
-			error = git_tree_entry_bypath(&right_entry, right_tree, w->path_only);
-			git_tree_free(right_tree);
-			if (error == GIT_ENOTFOUND) {
-				right_entry = NULL;
-			} else if (error != GIT_OK) {
-				if (left_entry) git_tree_entry_free(left_entry);
-				rugged_exception_check(error);
+			error = stats_walk_submit(sw, commit, &os_errno);
+			git_commit_free(commit);
+			rugged_exception_check(error);
+
+			if (os_errno) {
+				VALUE rb_errno = INT2FIX(os_errno);
+				rb_exc_raise(rb_class_new_instance(1, &rb_errno, rb_eSystemCallError));
 			}
-		} else {
-			right_entry = NULL;
 		}
 
-		if (left_entry && right_entry) {
-			int equal;
-			equal = git_oid_equal(git_tree_entry_id(left_entry), git_tree_entry_id(right_entry)) &&
-				    git_tree_entry_filemode(left_entry) == git_tree_entry_filemode(right_entry);
-			git_tree_entry_free(left_entry);
-			git_tree_entry_free(right_entry);
-			if (equal) return Qnil;
-		} else if (left_entry) {
-			git_tree_entry_free(left_entry);
-		} else if (right_entry) {
-			git_tree_entry_free(right_entry);
-		} else {
-			return Qnil;
+		if (sw->head == sw->submitted)
+			break;
+
+		slot = &sw->slots[sw->head % sw->window];
+		rugged_without_gvl(stats_walk_wait_head, sw, stats_walk_interrupt, sw);
+
+		if (!slot->done) {
+			sw->interrupted = 0;
+			rb_thread_check_ints();
+			continue;
 		}
-	}
 
-	if (w->stats_only) {
-		return rugged_commit_stats_of(w->repo, commit, w->path_only);
-	} else {
-		return rugged_object_new(w->rb_owner, (git_object *)commit);
+		if (slot->error) {
+			giterr_set_str(slot->error_class, slot->error_message);
+			rugged_exception_check(slot->error);
+		}
+
+		rb_result = Qnil;
+		if (!slot->skip) {
+			if (sw->cache && !slot->cached && !slot->stats->truncated)
+				rugged_stats_cache_add(sw->cache, &slot->stats->oid,
+					slot->has_parent ? &slot->parent_oid : NULL, slot->stats);
+
+			rb_result = rugged_commit_stats_new(slot->stats);
+			slot->stats = NULL;
+		}
+
+		stats_walk_slot_clear(slot);
+		sw->head++;
+
+		if (!NIL_P(rb_result)) {
+			rb_yield(rb_result);
+			if (--w->limit == 0)
+				break;
+		}
 	}
+
+	return Qnil;
+}
+
+static VALUE stats_walk_cleanup(VALUE _payload)
+{
+	struct stats_walk *sw = (struct stats_walk *)_payload;
+	size_t i;
+
+	/* Drop whatever hasn't started and wait for the rest before freeing the slots */
+	rugged_pool_cancel(&sw->group);
+	rugged_pool_drain(&sw->group);
+
+	for (i = 0; i < sw->window; ++i)
+		stats_walk_slot_clear(&sw->slots[i]);
+
+	if (sw->cache)
+		rugged_stats_cache_flush(sw->cache);
+
+	rugged_pool_group_free(&sw->group);
+	pthread_cond_destroy(&sw->done_cond);
+	pthread_mutex_destroy(&sw->mutex);
+	xfree(sw->slots);
+
+	return Qnil;
+}
+
+static VALUE do_stats_walk(struct walk_options *w)
+{
+	struct stats_walk sw;
+	size_t pool_size;
+
+	memset(&sw, 0, sizeof(sw));
+	sw.w = w;
+
+	/* The cache holds whole-commit stats, path_only stats are different */
+	if (!w->path_only)
+		sw.cache = rugged_repo_stats_cache(w->rb_owner);
+
+	/*
+	 * Keep every worker busy while the walker yields, but don't diff far
+	 * past +limit+ when nothing can be filtered out.
+	 */
+	rugged_pool_stats(&pool_size, NULL, NULL, NULL);
+	sw.window = pool_size * 4;
+	if (!w->path_only && w->limit > 0 && w->limit < sw.window)
+		sw.window = (size_t)w->limit;
+
+	sw.slots = xcalloc(sw.window, sizeof(struct stats_walk_slot));
+
+	rugged_pool_group_init(&sw.group);
+	pthread_mutex_init(&sw.mutex, NULL);
+	pthread_cond_init(&sw.done_cond, NULL);
+
+	return rb_ensure(stats_walk_run, (VALUE)&sw, stats_walk_cleanup, (VALUE)&sw);
 }
 
 static VALUE do_walk(VALUE _payload)
@@ -377,6 +681,9 @@ static VALUE do_walk(VALUE _payload)
 	int error, exception = 0;
 	git_oid commit_oid;
 
+	if (w->stats_only && !w->oid_only)
+		return do_stats_walk(w);
+
 	while ((error = git_revwalk_next(&commit_oid, w->walk)) == 0) {
 		if (w->offset > 0) {
 			w->offset--;
@@ -457,6 +764,10 @@ static VALUE do_walk(VALUE _payload)
  *	- +stats_only+: if +true+, the walker will yield a stats object
  *  with additions and deletions for each no-merges commit, instead of
  *  a real +Rugged::Commit+ objects. This option implies +no_merges+.
+ *  The diffs are computed on Rugged's shared thread pool while walking,
+ *  but the stats are still yielded in walk order. The +max_files+,
+ *  +max_lines+ and +max_bytes+ options limit the work done for each
+ *  commit, see Commit.stats.
  *	Defaults to +false+.
  *
  *  - +path_only+: if not +nil+, the walker will only yield commit object
@@ -505,6 +816,7 @@ static VALUE rb_git_walk(int argc, VALUE *argv, VALUE self)
 	w.offset = 0;
 	w.limit = UINT64_MAX;
 	w.path_only = NULL;
+	memset(&w.budget, 0, sizeof(w.budget));
 
 	if (!NIL_P(w.rb_options))
 		rb_protect(load_all_options, (VALUE)&w, &exception);
@@ -544,6 +856,7 @@ static VALUE rb_git_walk_with_opts(int argc, VALUE *argv, VALUE self, int oid_on
 	w.offset = 0;
 	w.limit = UINT64_MAX;
 	w.path_only = NULL;
+	memset(&w.budget, 0, sizeof(w.budget));
 
 	if (!NIL_P(rb_options))
 		load_walk_limits(&w, rb_options);
@@ -611,12 +924,170 @@ static VALUE rb_git_walker_each_oid(int argc, VALUE *argv, VALUE self)
 	return rb_git_walk_with_opts(argc, argv, self, 1);
 }
 
+struct walk_batch {
+	git_revwalk *walk;
+	git_oid *oids;
+	size_t size, count;
+	uint64_t offset, limit;
+	int error;
+	volatile int interrupted;
+};
+
+static void *walk_batch_fill(void *_payload)
+{
+	struct walk_batch *b = (struct walk_batch *)_payload;
+	git_oid commit_oid;
+
+	while (!b->interrupted && b->count < b->size && b->limit > 0) {
+		if ((b->error = git_revwalk_next(&commit_oid, b->walk)) != GIT_OK)
+			break;
+
+		if (b->offset > 0) {
+			b->offset--;
+			continue;
+		}
+
+		git_oid_cpy(&b->oids[b->count++], &commit_oid);
+		b->limit--;
+	}
+
+	return NULL;
+}
+
+static void walk_batch_interrupt(void *_payload)
+{
+	((struct walk_batch *)_payload)->interrupted = 1;
+}
+
+static VALUE do_walk_batch(VALUE _payload)
+{
+	struct walk_batch *b = (struct walk_batch *)_payload;
+	VALUE rb_batch;
+	size_t i;
+
+	while (b->limit > 0 && b->error == GIT_OK) {
+		b->count = 0;
+		b->interrupted = 0;
+
+		rugged_without_gvl(walk_batch_fill, b, walk_batch_interrupt, b);
+
+		if (b->interrupted)
+			rb_thread_check_ints();
+
+		if (b->error != GIT_ITEROVER)
+			rugged_exception_check(b->error);
+
+		if (b->count == 0)
+			continue;
+
+		rb_batch = rb_ary_new2(b->count);
+		for (i = 0; i < b->count; ++i)
+			rb_ary_push(rb_batch, rugged_create_oid(&b->oids[i]));
+
+		rb_yield(rb_batch);
+	}
+
+	return Qnil;
+}
+
+/*
+ *  call-seq:
+ *    walker.each_oid_batch(size, options = {}) { |oids| block }
+ *    walker.each_oid_batch(size, options = {}) -> Iterator
+ *
+ *  Perform the walk through the repository, yielding the commit oids
+ *  found as an +Array+ of up to +size+ <tt>String</tt>s at a time.
+ *
+ *  The walk itself runs without holding the Global VM Lock, so other Ruby
+ *  threads keep running while the next batch is collected; Ruby is only
+ *  re-entered once per batch.
+ *
+ *  The +:offset+ and +:limit+ options are honored like in +each_oid+.
+ *
+ *    walker.push("92b22bbcb37caf4f6f53d30292169e84f5e4283b")
+ *    walker.each_oid_batch(1000) { |oids| puts oids.size }
+ */
+static VALUE rb_git_walker_each_oid_batch(int argc, VALUE *argv, VALUE self)
+{
+	VALUE rb_size, rb_options, rb_value;
+	struct walk_batch b;
+	long size;
+	int exception = 0;
+
+	rb_scan_args(argc, argv, "11", &rb_size, &rb_options);
+
+	if (!rb_block_given_p()) {
+		return rb_funcall(self, rb_intern("to_enum"), 3,
+			CSTR2SYM("each_oid_batch"), rb_size, rb_options);
+	}
+
+	Check_Type(rb_size, T_FIXNUM);
+	size = FIX2LONG(rb_size);
+	if (size <= 0)
+		rb_raise(rb_eArgError, "batch size must be positive");
+
+	Data_Get_Struct(self, git_revwalk, b.walk);
+
+	b.size = (size_t)size;
+	b.count = 0;
+	b.offset = 0;
+	b.limit = UINT64_MAX;
+	b.error = GIT_OK;
+	b.interrupted = 0;
+
+	if (!NIL_P(rb_options)) {
+		Check_Type(rb_options, T_HASH);
+
+		rb_value = rb_hash_lookup(rb_options, CSTR2SYM("offset"));
+		if (!NIL_P(rb_value)) {
+			Check_Type(rb_value, T_FIXNUM);
+			b.offset = FIX2ULONG(rb_value);
+		}
+
+		rb_value = rb_hash_lookup(rb_options, CSTR2SYM("limit"));
+		if (!NIL_P(rb_value)) {
+			Check_Type(rb_value, T_FIXNUM);
+			b.limit = FIX2ULONG(rb_value);
+		}
+	}
+
+	b.oids = xmalloc(sizeof(git_oid) * b.size);
+
+	rb_protect(do_walk_batch, (VALUE)&b, &exception);
+	xfree(b.oids);
+
+	if (exception)
+		rb_jump_tag(exception);
+
+	return Qnil;
+}
+
+/*
+ * Resolve a single commit for the commit-graph. Anything push_commit()
+ * accepts but this doesn't (arrays, reference names) goes through the
+ * regular revwalk instead.
+ */
+static int graph_commit_oid(git_oid *oid, VALUE rb_commit)
+{
+	if (rb_obj_is_kind_of(rb_commit, rb_cRuggedObject)) {
+		git_object *object;
+		Data_Get_Struct(rb_commit, git_object, object);
+
+		git_oid_cpy(oid, git_object_id(object));
+		return 1;
+	}
+
+	return TYPE(rb_commit) == T_STRING && RSTRING_LEN(rb_commit) == 40 &&
+		git_oid_fromstr(oid, RSTRING_PTR(rb_commit)) == 0;
+}
+
 static VALUE rb_git_walker_count(int argc, VALUE *argv, VALUE self) {
 	int error;
 	unsigned long count;
-	git_oid oid;
+	git_oid oid, show, hide;
 	git_repository *repo;
 	git_revwalk *walk;
+	rugged_commit_graph *graph;
 	VALUE rb_repo, rb_show_commit, rb_hide_commit;
 
 	rb_scan_args(argc, argv, "21", &rb_repo, &rb_show_commit, &rb_hide_commit);
@@ -624,6 +1095,19 @@ static VALUE rb_git_walker_count(int argc, VALUE *argv, VALUE self) {
 	rugged_check_repo(rb_repo);
 	Data_Get_Struct(rb_repo, git_repository, repo);
 
+	if ((graph = rugged_repo_commit_graph(rb_repo)) != NULL &&
+		graph_commit_oid(&show, rb_show_commit) &&
+		(NIL_P(rb_hide_commit) || graph_commit_oid(&hide, rb_hide_commit))) {
+		size_t graph_count;
+
+		error = rugged_commit_graph_count(&graph_count, graph, &show,
+			NIL_P(rb_hide_commit) ? NULL : &hide);
+		if (error != GIT_PASSTHROUGH) {
+			rugged_exception_check(error);
+			return LONG2FIX(graph_count);
+		}
+	}
+
 	error = git_revwalk_new(&walk, repo);
 	rugged_exception_check(error);
 
@@ -652,6 +1136,7 @@ void Init_rugged_revwalk(void)
 	rb_define_method(rb_cRuggedWalker, "push_range", rb_git_walker_push_range, 1);
 	rb_define_method(rb_cRuggedWalker, "each", rb_git_walker_each, -1);
 	rb_define_method(rb_cRuggedWalker, "each_oid", rb_git_walker_each_oid, -1);
+	rb_define_method(rb_cRuggedWalker, "each_oid_batch", rb_git_walker_each_oid_batch, -1);
 	rb_define_method(rb_cRuggedWalker, "walk", rb_git_walker_each, -1);
 	rb_define_method(rb_cRuggedWalker, "hide", rb_git_walker_hide, 1);
 	rb_define_method(rb_cRuggedWalker, "reset", rb_git_walker_reset, 0);
@@ -64,6 +64,10 @@ static VALUE get_search_path(int level)
  *    Settings[option] = value
  *
  *  Sets a libgit2 library option.
+ *
+ *  Besides the libgit2 options, +thread_pool_size+ sets the number of
+ *  native worker threads Rugged uses for parallel operations such as
+ *  Commit.stats. A size of 0 (the default) uses one worker per CPU.
  */
 static VALUE rb_git_set_option(VALUE self, VALUE option, VALUE value)
 {
@@ -98,6 +102,15 @@ static VALUE rb_git_set_option(VALUE self, VALUE option, VALUE value)
 		set_search_path(GIT_CONFIG_LEVEL_SYSTEM, value);
 	}
 
+	else if (strcmp(opt, "thread_pool_size") == 0) {
+		long val;
+		Check_Type(value, T_FIXNUM);
+		val = FIX2LONG(value);
+		if (val < 0)
+			rb_raise(rb_eArgError, "thread_pool_size must not be negative");
+		rugged_pool_set_size(val > RUGGED_POOL_MAX_SIZE ? RUGGED_POOL_MAX_SIZE : (size_t)val);
+	}
+
 	else {
 		rb_raise(rb_eArgError, "Unknown option specified");
 	}
@@ -110,6 +123,11 @@ static VALUE rb_git_set_option(VALUE self, VALUE option, VALUE value)
  *    Settings[option] -> value
  *
  *  Gets the value of a libgit2 library option.
+ *
+ *  The state of Rugged's thread pool can be inspected with
+ *  +thread_pool_size+, +thread_pool_workers+ (threads currently
+ *  running), +thread_pool_busy_workers+ (threads running a task) and
+ *  +thread_pool_queue_depth+ (tasks waiting for a worker).
  */
 static VALUE rb_git_get_option(VALUE self, VALUE option)
 {
@@ -142,6 +160,30 @@ static VALUE rb_git_get_option(VALUE self, VALUE option)
 		return get_search_path(GIT_CONFIG_LEVEL_SYSTEM);
 	}
 
+	else if (strcmp(opt, "thread_pool_size") == 0) {
+		size_t val;
+		rugged_pool_stats(&val, NULL, NULL, NULL);
+		return SIZET2NUM(val);
+	}
+
+	else if (strcmp(opt, "thread_pool_workers") == 0) {
+		size_t val;
+		rugged_pool_stats(NULL, &val, NULL, NULL);
+		return SIZET2NUM(val);
+	}
+
+	else if (strcmp(opt, "thread_pool_busy_workers") == 0) {
+		size_t val;
+		rugged_pool_stats(NULL, NULL, &val, NULL);
+		return SIZET2NUM(val);
+	}
+
+	else if (strcmp(opt, "thread_pool_queue_depth") == 0) {
+		size_t val;
+		rugged_pool_stats(NULL, NULL, NULL, &val);
+		return SIZET2NUM(val);
+	}
+
 	else {
 		rb_raise(rb_eArgError, "Unknown option specified");
 	}
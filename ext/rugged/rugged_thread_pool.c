@@ -0,0 +1,425 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2014 GitHub, Inc
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "rugged.h"
+
+/*
+ * Process-wide pool of native worker threads shared by every parallel
+ * operation in Rugged. Workers are started on the first submission and
+ * live for the rest of the process; a forked child starts with an empty
+ * pool and spawns its own workers on demand.
+ *
+ * Callers embed a rugged_pool_task per unit of work and track them with a
+ * rugged_pool_group, which lets them wait for (or cancel) their own tasks
+ * without caring about anybody else's. Tasks run without the GVL and must
+ * not touch the Ruby VM.
+ */
+static struct {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+
+	rugged_pool_task *head, *tail;
+
+	/* 0 means one worker per online CPU */
+	size_t size;
+	size_t nr_threads, busy, queued;
+
+	/* a worker couldn't be started; don't retry until the size changes */
+	int spawn_failed;
+} pool = {
+	PTHREAD_MUTEX_INITIALIZER,
+	PTHREAD_COND_INITIALIZER,
+	NULL, NULL, 0, 0, 0, 0, 0
+};
+
+static size_t pool_target_size(void)
+{
+	size_t size = pool.size;
+
+	if (size == 0)
+		size = (size_t)git_online_cpus();
+
+	if (size > RUGGED_POOL_MAX_SIZE)
+		size = RUGGED_POOL_MAX_SIZE;
+
+	return size > 0 ? size : 1;
+}
+
+static void *pool_worker(void *payload)
+{
+	rugged_pool_task *task;
+	rugged_pool_group *group;
+
+	pthread_mutex_lock(&pool.mutex);
+	for (;;) {
+		while (pool.head == NULL && pool.nr_threads <= pool_target_size())
+			pthread_cond_wait(&pool.cond, &pool.mutex);
+
+		/* The pool has been shrunk; let the surplus workers go */
+		if (pool.nr_threads > pool_target_size()) {
+			pool.nr_threads--;
+			break;
+		}
+
+		task = pool.head;
+		pool.head = task->next;
+		if (pool.head == NULL)
+			pool.tail = NULL;
+		pool.queued--;
+		pool.busy++;
+
+		group = task->group;
+		pthread_mutex_unlock(&pool.mutex);
+
+		task->run(task->payload);
+
+		pthread_mutex_lock(&pool.mutex);
+		pool.busy--;
+		if (--group->pending == 0)
+			pthread_cond_broadcast(&group->cond);
+	}
+	pthread_mutex_unlock(&pool.mutex);
+
+	return NULL;
+}
+
+/* Must be called with the pool mutex held */
+static int pool_spawn_workers(void)
+{
+	size_t target = pool_target_size();
+	pthread_attr_t attr;
+	pthread_t thread;
+	int error = 0;
+
+	if (pool.nr_threads >= target || (pool.spawn_failed && pool.nr_threads > 0))
+		return 0;
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+	while (pool.nr_threads < target) {
+		if ((error = pthread_create(&thread, &attr, pool_worker, NULL))) {
+			pool.spawn_failed = 1;
+			break;
+		}
+		pool.nr_threads++;
+	}
+
+	pthread_attr_destroy(&attr);
+
+	/* Running with fewer workers than asked for is fine, running with none isn't */
+	return pool.nr_threads > 0 ? 0 : error;
+}
+
+void rugged_pool_group_init(rugged_pool_group *group)
+{
+	group->pending = 0;
+	group->interrupted = 0;
+	pthread_cond_init(&group->cond, NULL);
+}
+
+void rugged_pool_group_free(rugged_pool_group *group)
+{
+	pthread_cond_destroy(&group->cond);
+}
+
+/*
+ * Queue +task+ to run +run(payload)+ on the pool as part of +group+.
+ * Returns 0 or an errno value if no worker could be started.
+ */
+int rugged_pool_submit(rugged_pool_group *group, rugged_pool_task *task,
+	void (*run)(void *payload), void *payload)
+{
+	int error;
+
+	task->run = run;
+	task->payload = payload;
+	task->group = group;
+	task->next = NULL;
+
+	pthread_mutex_lock(&pool.mutex);
+
+	if ((error = pool_spawn_workers()) != 0) {
+		pthread_mutex_unlock(&pool.mutex);
+		return error;
+	}
+
+	if (pool.tail)
+		pool.tail->next = task;
+	else
+		pool.head = task;
+	pool.tail = task;
+
+	pool.queued++;
+	group->pending++;
+
+	pthread_cond_signal(&pool.cond);
+	pthread_mutex_unlock(&pool.mutex);
+
+	return 0;
+}
+
+/*
+ * Remove the tasks of +group+ that haven't started yet from the queue.
+ * Returns the number of tasks that were dropped; tasks already running
+ * still have to be waited for.
+ */
+size_t rugged_pool_cancel(rugged_pool_group *group)
+{
+	rugged_pool_task **task, *prev = NULL;
+	size_t cancelled = 0;
+
+	pthread_mutex_lock(&pool.mutex);
+
+	task = &pool.head;
+	while (*task) {
+		if ((*task)->group == group) {
+			*task = (*task)->next;
+			cancelled++;
+		} else {
+			prev = *task;
+			task = &(*task)->next;
+		}
+	}
+	pool.tail = prev;
+
+	pool.queued -= cancelled;
+	group->pending -= cancelled;
+	if (group->pending == 0)
+		pthread_cond_broadcast(&group->cond);
+
+	pthread_mutex_unlock(&pool.mutex);
+
+	return cancelled;
+}
+
+/*
+ * Block until every task of +group+ has finished, or until the group is
+ * interrupted with rugged_pool_interrupt(). Returns 0 when the group is
+ * done and -1 when the wait was interrupted.
+ */
+int rugged_pool_wait(rugged_pool_group *group)
+{
+	int result;
+
+	pthread_mutex_lock(&pool.mutex);
+	while (group->pending > 0 && !group->interrupted)
+		pthread_cond_wait(&group->cond, &pool.mutex);
+	result = group->pending > 0 ? -1 : 0;
+	group->interrupted = 0;
+	pthread_mutex_unlock(&pool.mutex);
+
+	return result;
+}
+
+/*
+ * Block until every task of +group+ has finished, ignoring interrupts.
+ * The group and its tasks can only be freed after this: a task that
+ * already started can't be stopped, and its worker still touches the
+ * group when it finishes.
+ */
+void rugged_pool_drain(rugged_pool_group *group)
+{
+	pthread_mutex_lock(&pool.mutex);
+	while (group->pending > 0)
+		pthread_cond_wait(&group->cond, &pool.mutex);
+	group->interrupted = 0;
+	pthread_mutex_unlock(&pool.mutex);
+}
+
+/*
+ * Wake up a thread blocked in rugged_pool_wait() on +group+. Safe to call
+ * from an unblocking function.
+ */
+void rugged_pool_interrupt(rugged_pool_group *group)
+{
+	pthread_mutex_lock(&pool.mutex);
+	group->interrupted = 1;
+	pthread_cond_broadcast(&group->cond);
+	pthread_mutex_unlock(&pool.mutex);
+}
+
+void rugged_pool_set_size(size_t size)
+{
+	pthread_mutex_lock(&pool.mutex);
+	pool.size = size > RUGGED_POOL_MAX_SIZE ? RUGGED_POOL_MAX_SIZE : size;
+	pool.spawn_failed = 0;
+
+	/* Grow eagerly if the pool is already running, shrinking happens as workers go idle */
+	if (pool.nr_threads > 0)
+		pool_spawn_workers();
+	pthread_cond_broadcast(&pool.cond);
+
+	pthread_mutex_unlock(&pool.mutex);
+}
+
+void rugged_pool_stats(size_t *size, size_t *workers, size_t *busy, size_t *queued)
+{
+	pthread_mutex_lock(&pool.mutex);
+	if (size) *size = pool_target_size();
+	if (workers) *workers = pool.nr_threads;
+	if (busy) *busy = pool.busy;
+	if (queued) *queued = pool.queued;
+	pthread_mutex_unlock(&pool.mutex);
+}
+
+/* libgit2 errors are per-thread; keep it for the calling thread */
+void rugged_batch_task_set_error(rugged_batch_task *task, int error)
+{
+	const git_error *err = giterr_last();
+
+	task->error = error;
+	task->error_class = err ? err->klass : GITERR_INVALID;
+	task->error_message = strdup(err ? err->message : "unknown error");
+}
+
+static void *pool_tasks_wait(void *group)
+{
+	rugged_pool_wait(group);
+	return NULL;
+}
+
+/* Drop the tasks that haven't started yet so the waiting thread can wake up */
+static void pool_tasks_cancel(void *group)
+{
+	rugged_pool_cancel(group);
+	rugged_pool_interrupt(group);
+}
+
+static VALUE pool_tasks_check_ints(VALUE unused)
+{
+	rb_thread_check_ints();
+	return Qnil;
+}
+
+/*
+ * Run +count+ tasks (+stride+ bytes apart, each starting with a
+ * rugged_batch_task) on the pool and wait for them without the GVL.
+ * +run+ gets the task itself and has to set its +done+ flag.
+ *
+ * If the wait is interrupted, the tasks that haven't started are
+ * cancelled and the running ones are drained. A pending exception is
+ * then stored in +exception+; otherwise the cancelled tasks are
+ * submitted again. Returns an errno value if the pool couldn't be
+ * started, 0 otherwise. Either way, no task is running on return.
+ */
+int rugged_pool_run_tasks(void *tasks, size_t stride, size_t count,
+	void (*run)(void *payload), int *exception)
+{
+	rugged_pool_group group;
+	rugged_batch_task *task;
+	int os_errno = 0;
+	size_t i;
+
+	rugged_pool_group_init(&group);
+
+	for (;;) {
+		for (i = 0; i < count; ++i) {
+			task = RUGGED_BATCH_TASK_AT(tasks, stride, i);
+			if (task->done)
+				continue;
+			if ((os_errno = rugged_pool_submit(&group, &task->task, run, task))) {
+				rugged_pool_cancel(&group);
+				break;
+			}
+		}
+
+		rugged_without_gvl(pool_tasks_wait, &group, pool_tasks_cancel, &group);
+		rugged_pool_drain(&group);
+
+		if (os_errno)
+			break;
+
+		for (i = 0; i < count && RUGGED_BATCH_TASK_AT(tasks, stride, i)->done; ++i)
+			;
+		if (i == count)
+			break;
+
+		/* Some tasks were cancelled: raise if there's a pending exception, resume otherwise */
+		rb_protect(pool_tasks_check_ints, Qnil, exception);
+		if (*exception)
+			break;
+	}
+
+	rugged_pool_group_free(&group);
+	return os_errno;
+}
+
+/* Hand the first task error back to the calling thread, returns GIT_OK if there is none */
+int rugged_batch_tasks_error(void *tasks, size_t stride, size_t count)
+{
+	rugged_batch_task *task;
+	size_t i;
+
+	for (i = 0; i < count; ++i) {
+		task = RUGGED_BATCH_TASK_AT(tasks, stride, i);
+		if (task->error < 0) {
+			giterr_set_str(task->error_class, task->error_message);
+			return task->error;
+		}
+	}
+
+	return GIT_OK;
+}
+
+/* Raise whatever rugged_pool_run_tasks() and rugged_batch_tasks_error() reported */
+void rugged_batch_tasks_raise(int os_errno, int exception, int error)
+{
+	if (exception)
+		rb_jump_tag(exception);
+	if (os_errno) {
+		VALUE rb_errno = INT2FIX(os_errno);
+		rb_exc_raise(rb_class_new_instance(1, &rb_errno, rb_eSystemCallError));
+	}
+	rugged_exception_check(error);
+}
+
+static void pool_atfork_prepare(void)
+{
+	pthread_mutex_lock(&pool.mutex);
+}
+
+static void pool_atfork_parent(void)
+{
+	pthread_mutex_unlock(&pool.mutex);
+}
+
+/*
+ * Only the forking thread survives in the child: forget about the parent's
+ * workers and queued tasks, the next submission starts a fresh pool.
+ */
+static void pool_atfork_child(void)
+{
+	pthread_mutex_init(&pool.mutex, NULL);
+	pthread_cond_init(&pool.cond, NULL);
+
+	pool.head = pool.tail = NULL;
+	pool.nr_threads = pool.busy = pool.queued = 0;
+	pool.spawn_failed = 0;
+}
+
+void Init_rugged_thread_pool(void)
+{
+	pthread_atfork(pool_atfork_prepare, pool_atfork_parent, pool_atfork_child);
+}
@@ -34,43 +34,6 @@ extern VALUE rb_cRuggedCommit;
 VALUE rb_cRuggedTree;
 VALUE rb_cRuggedTreeBuilder;
 
-static VALUE rb_git_treeentry_fromC(const git_tree_entry *entry)
-{
-	VALUE rb_entry;
-	VALUE type;
-
-	if (!entry)
-		return Qnil;
-
-	rb_entry = rb_hash_new();
-
-	rb_hash_aset(rb_entry, CSTR2SYM("name"), rb_str_new_utf8(git_tree_entry_name(entry)));
-	rb_hash_aset(rb_entry, CSTR2SYM("oid"), rugged_create_oid(git_tree_entry_id(entry)));
-
-	rb_hash_aset(rb_entry, CSTR2SYM("filemode"), INT2FIX(git_tree_entry_filemode(entry)));
-
-	switch(git_tree_entry_type(entry)) {
-		case GIT_OBJ_TREE:
-			type = CSTR2SYM("tree");
-			break;
-
-		case GIT_OBJ_BLOB:
-			type = CSTR2SYM("blob");
-			break;
-
-		case GIT_OBJ_COMMIT:
-			type = CSTR2SYM("commit");
-			break;
-
-		default:
-			type = Qnil;
-			break;
-	}
-	rb_hash_aset(rb_entry, CSTR2SYM("type"), type);
-
-	return rb_entry;
-}
-
 /*
  * Rugged Tree
  */
@@ -123,12 +86,16 @@ static int rugged__treecount_cb(const char *root, const git_tree_entry *entry, v
  *
  *  Return the number of blobs (up to the limit) contained in the tree and
  *  all subtrees.
+ *
+ *  When Tree#counts has already counted this tree, the cached count is
+ *  used instead of walking it.
  */
 static VALUE rb_git_tree_entrycount_recursive(int argc, VALUE* argv, VALUE self)
 {
 	git_tree *tree;
 	int error;
 	struct rugged_treecount_cb_payload payload;
+	struct rugged_tree_counts counts;
 	VALUE rb_limit;
 
 	Data_Get_Struct(self, git_tree, tree);
@@ -143,6 +110,15 @@ static VALUE rb_git_tree_entrycount_recursive(int argc, VALUE* argv, VALUE self)
 		payload.limit = FIX2INT(rb_limit);
 	}
 
+	/*
+	 * A count cached by Tree#counts is free. Computing one reads every
+	 * blob header for the byte totals, which the walk below doesn't need.
+	 */
+	if (rugged_tree_counts_cached(self, &counts)) {
+		if (payload.limit < 0)
+			return SIZET2NUM(counts.files);
+		return INT2FIX(counts.files < (size_t)payload.limit ? (int)counts.files : payload.limit);
+	}
 
 	error = git_tree_walk(tree, GIT_TREEWALK_PRE, &rugged__treecount_cb, (void *)&payload);
 
@@ -161,7 +137,7 @@ static VALUE rb_git_tree_entrycount_recursive(int argc, VALUE* argv, VALUE self)
  *    tree[e] -> entry
  *    tree.get_entry(e) -> entry
  *
- *  Return one of the entries from a tree as a +Hash+. If +e+ is a number, the +e+nth entry
+ *  Return one of the entries from a tree as a +Rugged::Tree::Entry+. If +e+ is a number, the +e+nth entry
  *  from the tree will be returned. If +e+ is a string, the entry with that name
  *  will be returned.
  *
@@ -177,10 +153,10 @@ static VALUE rb_git_tree_get_entry(VALUE self, VALUE entry_id)
 	Data_Get_Struct(self, git_tree, tree);
 
 	if (TYPE(entry_id) == T_FIXNUM)
-		return rb_git_treeentry_fromC(git_tree_entry_byindex(tree, FIX2INT(entry_id)));
+		return rugged_tree_entry_new(git_tree_entry_byindex(tree, FIX2INT(entry_id)));
 
 	else if (TYPE(entry_id) == T_STRING)
-		return rb_git_treeentry_fromC(git_tree_entry_byname(tree, StringValueCStr(entry_id)));
+		return rugged_tree_entry_new(git_tree_entry_byname(tree, StringValueCStr(entry_id)));
 
 	else
 		rb_raise(rb_eTypeError, "entry_id must be either an index or a filename");
@@ -190,7 +166,7 @@ static VALUE rb_git_tree_get_entry(VALUE self, VALUE entry_id)
  *  call-seq:
  *    tree.get_entry_by_oid(rb_oid) -> entry
  *
- *  Return one of the entries from a tree as a +Hash+, based off the oid SHA.
+ *  Return one of the entries from a tree as a +Rugged::Tree::Entry+, based off the oid SHA.
  *
  *  If the entry doesn't exist, +nil+ will be returned.
  *
@@ -210,7 +186,7 @@ static VALUE rb_git_tree_get_entry_by_oid(VALUE self, VALUE rb_oid)
 	Check_Type(rb_oid, T_STRING);
 	rugged_exception_check(git_oid_fromstr(&oid, StringValueCStr(rb_oid)));
 
-	return rb_git_treeentry_fromC(git_tree_entry_byid(tree, &oid));
+	return rugged_tree_entry_new(git_tree_entry_byid(tree, &oid));
 }
 
 /*
@@ -218,7 +194,7 @@ static VALUE rb_git_tree_get_entry_by_oid(VALUE self, VALUE rb_oid)
  *    tree.each { |entry| block }
  *    tree.each -> enumerator
  *
- *  Call +block+ with each of the entries of the subtree as a +Hash+. If no +block+
+ *  Call +block+ with each of the entries of the subtree as a +Rugged::Tree::Entry+. If no +block+
  *  is given, an +enumerator+ is returned instead.
  *
  *  Note that only the entries in the root of the tree are yielded; if you need to
@@ -245,7 +221,7 @@ static VALUE rb_git_tree_each(VALUE self)
 
 	for (i = 0; i < count; ++i) {
 		const git_tree_entry *entry = git_tree_entry_byindex(tree, i);
-		rb_yield(rb_git_treeentry_fromC(entry));
+		rb_yield(rugged_tree_entry_new(entry));
 	}
 
 	return Qnil;
@@ -258,7 +234,7 @@ static int rugged__treewalk_cb(const char *root, const git_tree_entry *entry, vo
 	VALUE rb_result, rb_args = rb_ary_new2(2);
 
 	rb_ary_push(rb_args, rb_str_new_utf8(root));
-	rb_ary_push(rb_args, rb_git_treeentry_fromC(entry));
+	rb_ary_push(rb_args, rugged_tree_entry_new(entry));
 
 	rb_result = rb_protect(rb_yield_splat, rb_args, exception);
 
@@ -279,7 +255,7 @@ static int rugged__treewalk_cb(const char *root, const git_tree_entry *entry, vo
  *    tree.walk(mode) -> Iterator
  *
  *  Walk +tree+ with the given mode (either +:preorder+ or +:postorder+) and yield
- *  to +block+ every entry in +tree+ and all its subtrees, as a +Hash+. The +block+
+ *  to +block+ every entry in +tree+ and all its subtrees, as a +Rugged::Tree::Entry+. The +block+
  *  also takes a +root+, the relative path in the traversal, starting from the root
  *  of the original tree.
  *
@@ -348,7 +324,7 @@ static VALUE rb_git_tree_path(VALUE self, VALUE rb_path)
 	error = git_tree_entry_bypath(&entry, tree, StringValueCStr(rb_path));
 	rugged_exception_check(error);
 
-	rb_entry = rb_git_treeentry_fromC(entry);
+	rb_entry = rugged_tree_entry_new(entry);
 	git_tree_entry_free(entry);
 
 	return rb_entry;
@@ -815,7 +791,7 @@ static VALUE rb_git_treebuilder_get(VALUE self, VALUE path)
 
 	Check_Type(path, T_STRING);
 
-	return rb_git_treeentry_fromC(git_treebuilder_get(builder, StringValueCStr(path)));
+	return rugged_tree_entry_new(git_treebuilder_get(builder, StringValueCStr(path)));
 }
 
 /*
@@ -829,10 +805,20 @@ static VALUE rb_git_treebuilder_insert(VALUE self, VALUE rb_entry)
 {
 	git_treebuilder *builder;
 	VALUE rb_path, rb_oid, rb_attr;
+	const char *name;
+	const git_oid *entry_oid;
+	git_filemode_t filemode;
 	git_oid oid;
 	int error;
 
 	Data_Get_Struct(self, git_treebuilder, builder);
+
+	if (rugged_tree_entry_fields(rb_entry, &name, &entry_oid, &filemode)) {
+		error = git_treebuilder_insert(NULL, builder, name, entry_oid, filemode);
+		rugged_exception_check(error);
+		return Qnil;
+	}
+
 	Check_Type(rb_entry, T_HASH);
 
 	rb_path = rb_hash_aref(rb_entry, CSTR2SYM("name"));
@@ -908,7 +894,7 @@ static VALUE rb_git_treebuilder_write(VALUE self)
 static int treebuilder_cb(const git_tree_entry *entry, void *opaque)
 {
 	VALUE proc = (VALUE)opaque;
-	VALUE ret = rb_funcall(proc, rb_intern("call"), 1, rb_git_treeentry_fromC(entry));
+	VALUE ret = rb_funcall(proc, rb_intern("call"), 1, rugged_tree_entry_new(entry));
 	return rugged_parse_bool(ret);
 }
 
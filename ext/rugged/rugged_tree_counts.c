@@ -0,0 +1,427 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2014 GitHub, Inc
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "rugged.h"
+
+extern VALUE rb_cRuggedTree;
+
+#define TREE_COUNTS_IVAR "__tree_counts_cache"
+/* How much memory the cache of a repository may use */
+#define TREE_COUNTS_CACHE_BYTES (8 * 1024 * 1024)
+
+struct tree_counts_entry {
+	git_oid tree;
+	struct rugged_tree_counts counts;
+	/* LRU list and hash chain links, as entry indexes + 1; 0 is none */
+	uint32_t prev, next, chain;
+};
+
+/*
+ * The counts of every tree seen so far, by tree OID. Trees are immutable,
+ * so entries never go stale; once the byte budget is reached, the least
+ * recently used entry makes room for the new one.
+ */
+struct tree_counts_cache {
+	pthread_mutex_t mutex;
+
+	struct tree_counts_entry *entries;
+	size_t nr_entries, alloc_entries, max_entries;
+
+	/* hash buckets, as entry indexes + 1 */
+	uint32_t *buckets;
+	size_t nr_buckets;
+
+	/* most and least recently used entries */
+	uint32_t head, tail;
+};
+
+static void tree_counts_cache__free(struct tree_counts_cache *cache)
+{
+	pthread_mutex_destroy(&cache->mutex);
+	free(cache->entries);
+	free(cache->buckets);
+	xfree(cache);
+}
+
+static struct tree_counts_cache *rugged_repo_tree_counts_cache(VALUE rb_repo)
+{
+	VALUE rb_cache = rb_iv_get(rb_repo, TREE_COUNTS_IVAR);
+	struct tree_counts_cache *cache;
+
+	if (NIL_P(rb_cache)) {
+		cache = xcalloc(1, sizeof(struct tree_counts_cache));
+		pthread_mutex_init(&cache->mutex, NULL);
+		cache->max_entries = TREE_COUNTS_CACHE_BYTES /
+			(sizeof(struct tree_counts_entry) + sizeof(uint32_t));
+
+		rb_cache = Data_Wrap_Struct(rb_cObject, NULL, &tree_counts_cache__free, cache);
+		rb_iv_set(rb_repo, TREE_COUNTS_IVAR, rb_cache);
+	}
+
+	Data_Get_Struct(rb_cache, struct tree_counts_cache, cache);
+	return cache;
+}
+
+#define ENTRY(cache, i) (&(cache)->entries[(i) - 1])
+
+static inline size_t tree_counts_bucket(const struct tree_counts_cache *cache, const git_oid *tree)
+{
+	/* OIDs are already uniformly distributed */
+	return (((size_t)tree->id[0] << 24) | ((size_t)tree->id[1] << 16) |
+		((size_t)tree->id[2] << 8) | (size_t)tree->id[3]) & (cache->nr_buckets - 1);
+}
+
+static void tree_counts_unlink(struct tree_counts_cache *cache, uint32_t i)
+{
+	struct tree_counts_entry *entry = ENTRY(cache, i);
+
+	if (entry->prev)
+		ENTRY(cache, entry->prev)->next = entry->next;
+	else
+		cache->head = entry->next;
+
+	if (entry->next)
+		ENTRY(cache, entry->next)->prev = entry->prev;
+	else
+		cache->tail = entry->prev;
+
+	entry->prev = entry->next = 0;
+}
+
+static void tree_counts_push_front(struct tree_counts_cache *cache, uint32_t i)
+{
+	struct tree_counts_entry *entry = ENTRY(cache, i);
+
+	entry->prev = 0;
+	entry->next = cache->head;
+	if (cache->head)
+		ENTRY(cache, cache->head)->prev = i;
+	cache->head = i;
+	if (!cache->tail)
+		cache->tail = i;
+}
+
+/* Must be called with the cache mutex held */
+static int tree_counts_find(struct tree_counts_cache *cache, const git_oid *tree,
+	struct rugged_tree_counts *out)
+{
+	uint32_t i;
+
+	if (cache->nr_buckets == 0)
+		return 0;
+
+	for (i = cache->buckets[tree_counts_bucket(cache, tree)]; i; i = ENTRY(cache, i)->chain) {
+		if (git_oid_equal(&ENTRY(cache, i)->tree, tree)) {
+			if (cache->head != i) {
+				tree_counts_unlink(cache, i);
+				tree_counts_push_front(cache, i);
+			}
+			*out = ENTRY(cache, i)->counts;
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static int tree_counts_grow(struct tree_counts_cache *cache)
+{
+	size_t alloc = cache->alloc_entries ? cache->alloc_entries * 2 : 1024, nr_buckets = 1, i;
+	struct tree_counts_entry *entries;
+	uint32_t *buckets;
+
+	if (alloc > cache->max_entries)
+		alloc = cache->max_entries;
+	while (nr_buckets < alloc)
+		nr_buckets <<= 1;
+
+	entries = realloc(cache->entries, alloc * sizeof(struct tree_counts_entry));
+	if (entries == NULL)
+		return -1;
+	cache->entries = entries;
+
+	buckets = calloc(nr_buckets, sizeof(uint32_t));
+	if (buckets == NULL)
+		return -1;
+
+	free(cache->buckets);
+	cache->buckets = buckets;
+	cache->nr_buckets = nr_buckets;
+	cache->alloc_entries = alloc;
+
+	for (i = 1; i <= cache->nr_entries; ++i) {
+		size_t bucket = tree_counts_bucket(cache, &ENTRY(cache, i)->tree);
+		ENTRY(cache, i)->chain = cache->buckets[bucket];
+		cache->buckets[bucket] = (uint32_t)i;
+	}
+
+	return 0;
+}
+
+/* Drop the least recently used entry, and return its slot */
+static uint32_t tree_counts_evict(struct tree_counts_cache *cache)
+{
+	uint32_t i = cache->tail, *link;
+
+	link = &cache->buckets[tree_counts_bucket(cache, &ENTRY(cache, i)->tree)];
+	while (*link != i)
+		link = &ENTRY(cache, *link)->chain;
+	*link = ENTRY(cache, i)->chain;
+
+	tree_counts_unlink(cache, i);
+	return i;
+}
+
+/* Must be called with the cache mutex held; a failed allocation just skips caching */
+static void tree_counts_add(struct tree_counts_cache *cache, const git_oid *tree,
+	const struct rugged_tree_counts *counts)
+{
+	struct rugged_tree_counts existing;
+	size_t bucket;
+	uint32_t i;
+
+	if (tree_counts_find(cache, tree, &existing))
+		return;
+
+	if (cache->nr_entries < cache->alloc_entries) {
+		i = (uint32_t)++cache->nr_entries;
+	} else if (cache->alloc_entries < cache->max_entries) {
+		if (tree_counts_grow(cache) < 0)
+			return;
+		i = (uint32_t)++cache->nr_entries;
+	} else {
+		i = tree_counts_evict(cache);
+	}
+
+	git_oid_cpy(&ENTRY(cache, i)->tree, tree);
+	ENTRY(cache, i)->counts = *counts;
+
+	bucket = tree_counts_bucket(cache, tree);
+	ENTRY(cache, i)->chain = cache->buckets[bucket];
+	cache->buckets[bucket] = i;
+
+	tree_counts_push_front(cache, i);
+}
+
+struct tree_counter {
+	git_repository *repo;
+	git_odb *odb;
+	git_tree *tree;
+	struct tree_counts_cache *cache;
+	struct rugged_tree_counts counts;
+	volatile int interrupted;
+	int error;
+};
+
+static int tree_counter_lookup(struct tree_counter *tc, const git_oid *tree, struct rugged_tree_counts *out)
+{
+	int found;
+
+	pthread_mutex_lock(&tc->cache->mutex);
+	found = tree_counts_find(tc->cache, tree, out);
+	pthread_mutex_unlock(&tc->cache->mutex);
+
+	return found;
+}
+
+/*
+ * Count +tree+, only descending into the subtrees that aren't cached yet.
+ * Every subtree is cached once counted, so an interrupted count loses
+ * little work.
+ */
+static int tree_counter_count(struct tree_counter *tc, const git_tree *tree, struct rugged_tree_counts *out)
+{
+	size_t i, count = git_tree_entrycount(tree);
+	int error = GIT_OK;
+
+	memset(out, 0, sizeof(*out));
+
+	for (i = 0; i < count && error == GIT_OK; ++i) {
+		const git_tree_entry *entry = git_tree_entry_byindex(tree, i);
+		const git_oid *id = git_tree_entry_id(entry);
+		struct rugged_tree_counts sub;
+		git_tree *subtree;
+		git_otype type;
+		size_t size;
+
+		switch (git_tree_entry_type(entry)) {
+		case GIT_OBJ_TREE:
+			if (!tree_counter_lookup(tc, id, &sub)) {
+				if (tc->interrupted)
+					return GIT_EUSER;
+				if ((error = git_tree_lookup(&subtree, tc->repo, id)) < 0)
+					break;
+
+				error = tree_counter_count(tc, subtree, &sub);
+				git_tree_free(subtree);
+				if (error < 0)
+					break;
+			}
+
+			out->files += sub.files;
+			out->dirs += sub.dirs + 1;
+			out->bytes += sub.bytes;
+			break;
+
+		case GIT_OBJ_BLOB:
+			if ((error = git_odb_read_header(&size, &type, tc->odb, id)) < 0)
+				break;
+
+			out->files++;
+			out->bytes += size;
+			break;
+
+		default:
+			/* Submodules count as files, like in Tree#count_recursive */
+			out->files++;
+			break;
+		}
+	}
+
+	if (error < 0)
+		return error;
+
+	pthread_mutex_lock(&tc->cache->mutex);
+	tree_counts_add(tc->cache, git_tree_id(tree), out);
+	pthread_mutex_unlock(&tc->cache->mutex);
+
+	return GIT_OK;
+}
+
+static void *tree_counter_run(void *payload)
+{
+	struct tree_counter *tc = payload;
+
+	tc->error = tree_counter_count(tc, tc->tree, &tc->counts);
+	return NULL;
+}
+
+static void tree_counter_interrupt(void *payload)
+{
+	((struct tree_counter *)payload)->interrupted = 1;
+}
+
+static VALUE tree_counter_check_ints(VALUE unused)
+{
+	rb_thread_check_ints();
+	return Qnil;
+}
+
+/*
+ * Look the counts of +rb_tree+ up in the cache of its repository, without
+ * counting anything. Returns 1 if they were there.
+ */
+int rugged_tree_counts_cached(VALUE rb_tree, struct rugged_tree_counts *out)
+{
+	struct tree_counts_cache *cache = rugged_repo_tree_counts_cache(rugged_owner(rb_tree));
+	git_tree *tree;
+	int found;
+
+	Data_Get_Struct(rb_tree, git_tree, tree);
+
+	pthread_mutex_lock(&cache->mutex);
+	found = tree_counts_find(cache, git_tree_id(tree), out);
+	pthread_mutex_unlock(&cache->mutex);
+
+	return found;
+}
+
+/*
+ * Count the files, directories and blob bytes of +rb_tree+ and all its
+ * subtrees, without holding the GVL. Raises on errors.
+ */
+void rugged_tree_counts(VALUE rb_tree, struct rugged_tree_counts *out)
+{
+	VALUE rb_repo = rugged_owner(rb_tree);
+	struct tree_counter tc;
+	int exception = 0;
+
+	if (rugged_tree_counts_cached(rb_tree, out))
+		return;
+
+	memset(&tc, 0, sizeof(tc));
+	Data_Get_Struct(rb_tree, git_tree, tc.tree);
+	Data_Get_Struct(rb_repo, git_repository, tc.repo);
+	tc.cache = rugged_repo_tree_counts_cache(rb_repo);
+
+	rugged_exception_check(git_repository_odb(&tc.odb, tc.repo));
+
+	for (;;) {
+		tc.interrupted = 0;
+		rugged_without_gvl(tree_counter_run, &tc, tree_counter_interrupt, &tc);
+
+		if (tc.error != GIT_EUSER || !tc.interrupted)
+			break;
+
+		/* Raise if there's a pending exception, resume otherwise: the cache kept our progress */
+		rb_protect(tree_counter_check_ints, Qnil, &exception);
+		if (exception)
+			break;
+	}
+
+	git_odb_free(tc.odb);
+	RB_GC_GUARD(rb_repo);
+
+	if (exception)
+		rb_jump_tag(exception);
+	rugged_exception_check(tc.error);
+
+	*out = tc.counts;
+}
+
+/*
+ *  call-seq:
+ *    tree.counts -> hash
+ *
+ *  Return the number of files and directories in the tree and all its
+ *  subtrees, and the total size of its blobs:
+ *
+ *    tree.counts #=> {:files => 1024, :dirs => 87, :bytes => 2932847}
+ *
+ *  Submodules count as files, of size 0.
+ *
+ *  The counts of every subtree are cached on the repository by tree OID,
+ *  so counting the tree of a commit after the tree of its parent only
+ *  visits the subtrees that changed. The cache keeps the most recently
+ *  used entries within a fixed memory budget.
+ */
+static VALUE rb_git_tree_counts(VALUE self)
+{
+	struct rugged_tree_counts counts;
+	VALUE rb_result;
+
+	rugged_tree_counts(self, &counts);
+
+	rb_result = rb_hash_new();
+	rb_hash_aset(rb_result, CSTR2SYM("files"), SIZET2NUM(counts.files));
+	rb_hash_aset(rb_result, CSTR2SYM("dirs"), SIZET2NUM(counts.dirs));
+	rb_hash_aset(rb_result, CSTR2SYM("bytes"), ULL2NUM(counts.bytes));
+
+	return rb_result;
+}
+
+void Init_rugged_tree_counts(void)
+{
+	rb_define_method(rb_cRuggedTree, "counts", rb_git_tree_counts, 0);
+}
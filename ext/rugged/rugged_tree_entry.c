@@ -0,0 +1,291 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2014 GitHub, Inc
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "rugged.h"
+#include <stddef.h>
+
+extern VALUE rb_cRuggedTree;
+VALUE rb_cRuggedTreeEntry;
+
+static ID id_name, id_oid, id_type, id_filemode;
+
+/*
+ * A copy of a tree entry: the raw OID and mode plus the name, all in
+ * one allocation. Ruby values are only built when a field is read.
+ */
+struct rugged_tree_entry {
+	git_oid oid;
+	git_filemode_t filemode;
+	git_otype type;
+	size_t name_len;
+	char name[1];
+};
+
+static void rb_git_treeentry__free(struct rugged_tree_entry *entry)
+{
+	xfree(entry);
+}
+
+VALUE rugged_tree_entry_new(const git_tree_entry *entry)
+{
+	struct rugged_tree_entry *rb_entry;
+	const char *name;
+	size_t name_len;
+
+	if (!entry)
+		return Qnil;
+
+	name = git_tree_entry_name(entry);
+	name_len = strlen(name);
+
+	rb_entry = xmalloc(offsetof(struct rugged_tree_entry, name) + name_len + 1);
+	git_oid_cpy(&rb_entry->oid, git_tree_entry_id(entry));
+	rb_entry->filemode = git_tree_entry_filemode(entry);
+	rb_entry->type = git_tree_entry_type(entry);
+	rb_entry->name_len = name_len;
+	memcpy(rb_entry->name, name, name_len + 1);
+
+	return rb_obj_freeze(Data_Wrap_Struct(rb_cRuggedTreeEntry, NULL, rb_git_treeentry__free, rb_entry));
+}
+
+int rugged_tree_entry_fields(VALUE rb_entry,
+	const char **name, const git_oid **oid, git_filemode_t *filemode)
+{
+	struct rugged_tree_entry *entry;
+
+	if (!rb_obj_is_kind_of(rb_entry, rb_cRuggedTreeEntry))
+		return 0;
+
+	Data_Get_Struct(rb_entry, struct rugged_tree_entry, entry);
+	*name = entry->name;
+	*oid = &entry->oid;
+	*filemode = entry->filemode;
+	return 1;
+}
+
+static VALUE rugged_tree_entry_type(git_otype type)
+{
+	switch (type) {
+	case GIT_OBJ_TREE:
+		return CSTR2SYM("tree");
+	case GIT_OBJ_BLOB:
+		return CSTR2SYM("blob");
+	case GIT_OBJ_COMMIT:
+		return CSTR2SYM("commit");
+	default:
+		return Qnil;
+	}
+}
+
+/*
+ *  call-seq:
+ *    entry.name -> name
+ *
+ *  Return the name of +entry+, relative to the tree containing it.
+ */
+static VALUE rb_git_treeentry_name(VALUE self)
+{
+	struct rugged_tree_entry *entry;
+	Data_Get_Struct(self, struct rugged_tree_entry, entry);
+
+	return rb_enc_str_new(entry->name, entry->name_len, rb_utf8_encoding());
+}
+
+/*
+ *  call-seq:
+ *    entry.oid -> oid
+ *
+ *  Return the OID of the object +entry+ points to, as a hex string.
+ */
+static VALUE rb_git_treeentry_oid(VALUE self)
+{
+	struct rugged_tree_entry *entry;
+	Data_Get_Struct(self, struct rugged_tree_entry, entry);
+
+	return rugged_create_oid(&entry->oid);
+}
+
+/*
+ *  call-seq:
+ *    entry.type -> type
+ *
+ *  Return the type of the object +entry+ points to: +:blob+, +:tree+
+ *  or +:commit+ (for submodules).
+ */
+static VALUE rb_git_treeentry_type(VALUE self)
+{
+	struct rugged_tree_entry *entry;
+	Data_Get_Struct(self, struct rugged_tree_entry, entry);
+
+	return rugged_tree_entry_type(entry->type);
+}
+
+/*
+ *  call-seq:
+ *    entry.filemode -> mode
+ *
+ *  Return the file mode of +entry+ as an integer, e.g. +0100644+.
+ */
+static VALUE rb_git_treeentry_filemode(VALUE self)
+{
+	struct rugged_tree_entry *entry;
+	Data_Get_Struct(self, struct rugged_tree_entry, entry);
+
+	return INT2FIX(entry->filemode);
+}
+
+/*
+ *  call-seq:
+ *    entry[key] -> value
+ *
+ *  Return the field of +entry+ named by +key+, which is one of +:name+,
+ *  +:oid+, +:type+ or +:filemode+. Returns +nil+ for any other key, like
+ *  the +Hash+ tree entries used to be.
+ */
+static VALUE rb_git_treeentry_aref(VALUE self, VALUE rb_key)
+{
+	ID id;
+
+	if (!SYMBOL_P(rb_key))
+		return Qnil;
+
+	id = SYM2ID(rb_key);
+	if (id == id_name)
+		return rb_git_treeentry_name(self);
+	if (id == id_oid)
+		return rb_git_treeentry_oid(self);
+	if (id == id_type)
+		return rb_git_treeentry_type(self);
+	if (id == id_filemode)
+		return rb_git_treeentry_filemode(self);
+
+	return Qnil;
+}
+
+/*
+ *  call-seq:
+ *    entry.to_h -> hash
+ *    entry.to_hash -> hash
+ *
+ *  Return the fields of +entry+ as a +Hash+ with the keys +:name+, +:oid+,
+ *  +:filemode+ and +:type+.
+ */
+static VALUE rb_git_treeentry_to_h(VALUE self)
+{
+	VALUE rb_hash = rb_hash_new();
+
+	rb_hash_aset(rb_hash, CSTR2SYM("name"), rb_git_treeentry_name(self));
+	rb_hash_aset(rb_hash, CSTR2SYM("oid"), rb_git_treeentry_oid(self));
+	rb_hash_aset(rb_hash, CSTR2SYM("filemode"), rb_git_treeentry_filemode(self));
+	rb_hash_aset(rb_hash, CSTR2SYM("type"), rb_git_treeentry_type(self));
+
+	return rb_hash;
+}
+
+static int rugged_tree_entry_equal(VALUE rb_a, VALUE rb_b)
+{
+	struct rugged_tree_entry *a, *b;
+
+	Data_Get_Struct(rb_a, struct rugged_tree_entry, a);
+	Data_Get_Struct(rb_b, struct rugged_tree_entry, b);
+
+	return a->filemode == b->filemode &&
+		a->name_len == b->name_len &&
+		git_oid_equal(&a->oid, &b->oid) &&
+		memcmp(a->name, b->name, a->name_len) == 0;
+}
+
+/*
+ *  call-seq:
+ *    entry == other -> true or false
+ *
+ *  Return +true+ if +other+ is an entry with the same name, OID and mode,
+ *  or a +Hash+ equal to <tt>entry.to_h</tt>.
+ */
+static VALUE rb_git_treeentry_equal(VALUE self, VALUE rb_other)
+{
+	if (rb_obj_is_kind_of(rb_other, rb_cRuggedTreeEntry))
+		return rugged_tree_entry_equal(self, rb_other) ? Qtrue : Qfalse;
+
+	if (TYPE(rb_other) == T_HASH)
+		return rb_equal(rb_git_treeentry_to_h(self), rb_other);
+
+	return Qfalse;
+}
+
+/*
+ *  call-seq:
+ *    entry.eql?(other) -> true or false
+ *
+ *  Return +true+ if +other+ is an entry with the same name, OID and mode.
+ */
+static VALUE rb_git_treeentry_eql(VALUE self, VALUE rb_other)
+{
+	if (!rb_obj_is_kind_of(rb_other, rb_cRuggedTreeEntry))
+		return Qfalse;
+
+	return rugged_tree_entry_equal(self, rb_other) ? Qtrue : Qfalse;
+}
+
+/*
+ *  call-seq:
+ *    entry.hash -> integer
+ *
+ *  Return a hash code for +entry+, so entries can be used as +Hash+ keys.
+ */
+static VALUE rb_git_treeentry_hash(VALUE self)
+{
+	struct rugged_tree_entry *entry;
+	uint32_t h;
+
+	Data_Get_Struct(self, struct rugged_tree_entry, entry);
+
+	memcpy(&h, entry->oid.id, sizeof(h));
+	h ^= (uint32_t)entry->filemode * 31;
+	h ^= (uint32_t)entry->name_len * 131;
+
+	return UINT2NUM(h);
+}
+
+void Init_rugged_tree_entry(void)
+{
+	id_name = rb_intern("name");
+	id_oid = rb_intern("oid");
+	id_type = rb_intern("type");
+	id_filemode = rb_intern("filemode");
+
+	rb_cRuggedTreeEntry = rb_define_class_under(rb_cRuggedTree, "Entry", rb_cObject);
+	rb_undef_alloc_func(rb_cRuggedTreeEntry);
+
+	rb_define_method(rb_cRuggedTreeEntry, "name", rb_git_treeentry_name, 0);
+	rb_define_method(rb_cRuggedTreeEntry, "oid", rb_git_treeentry_oid, 0);
+	rb_define_method(rb_cRuggedTreeEntry, "type", rb_git_treeentry_type, 0);
+	rb_define_method(rb_cRuggedTreeEntry, "filemode", rb_git_treeentry_filemode, 0);
+	rb_define_method(rb_cRuggedTreeEntry, "[]", rb_git_treeentry_aref, 1);
+	rb_define_method(rb_cRuggedTreeEntry, "to_h", rb_git_treeentry_to_h, 0);
+	rb_define_method(rb_cRuggedTreeEntry, "to_hash", rb_git_treeentry_to_h, 0);
+	rb_define_method(rb_cRuggedTreeEntry, "==", rb_git_treeentry_equal, 1);
+	rb_define_method(rb_cRuggedTreeEntry, "eql?", rb_git_treeentry_eql, 1);
+	rb_define_method(rb_cRuggedTreeEntry, "hash", rb_git_treeentry_hash, 0);
+}
@@ -0,0 +1,1231 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2014 GitHub, Inc
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "rugged.h"
+
+extern VALUE rb_cRuggedTree;
+
+/*
+ * Tree#language_stats walks a tree on the calling thread (without the
+ * GVL), classifies every blob by its name and the `linguist-*` attributes
+ * of the `.gitattributes` files found in the tree itself, and inflates
+ * the blobs on the shared thread pool to count their lines.
+ *
+ * The totals of every subtree are cached on the repository, keyed by the
+ * subtree OID and a fingerprint of the `.gitattributes` rules inherited
+ * from its parents: a subtree that didn't change between two commits (and
+ * isn't affected by a changed rule) is never walked again.
+ */
+#define LANG_CACHE_IVAR "__language_stats_cache"
+#define LANG_CACHE_MAX_ENTRIES (1 << 16)
+#define LANG_TASK_BLOCK 1024
+#define LANG_NO_PARENT SIZE_MAX
+
+static const struct lang_extension {
+	const char *extension;
+	const char *language;
+} lang_extensions[] = {
+	/* sorted by extension, for bsearch() */
+	{ "asm", "Assembly" },
+	{ "bash", "Shell" },
+	{ "c", "C" },
+	{ "c++", "C++" },
+	{ "cc", "C++" },
+	{ "clj", "Clojure" },
+	{ "cljs", "Clojure" },
+	{ "coffee", "CoffeeScript" },
+	{ "cpp", "C++" },
+	{ "cs", "C#" },
+	{ "css", "CSS" },
+	{ "cxx", "C++" },
+	{ "dart", "Dart" },
+	{ "erb", "HTML+ERB" },
+	{ "erl", "Erlang" },
+	{ "ex", "Elixir" },
+	{ "exs", "Elixir" },
+	{ "f90", "Fortran" },
+	{ "fs", "F#" },
+	{ "go", "Go" },
+	{ "groovy", "Groovy" },
+	{ "h", "C" },
+	{ "haml", "Haml" },
+	{ "hh", "C++" },
+	{ "hpp", "C++" },
+	{ "hrl", "Erlang" },
+	{ "hs", "Haskell" },
+	{ "htm", "HTML" },
+	{ "html", "HTML" },
+	{ "hxx", "C++" },
+	{ "java", "Java" },
+	{ "jl", "Julia" },
+	{ "js", "JavaScript" },
+	{ "jsx", "JavaScript" },
+	{ "kt", "Kotlin" },
+	{ "kts", "Kotlin" },
+	{ "less", "Less" },
+	{ "lua", "Lua" },
+	{ "m", "Objective-C" },
+	{ "mjs", "JavaScript" },
+	{ "ml", "OCaml" },
+	{ "mli", "OCaml" },
+	{ "mm", "Objective-C++" },
+	{ "php", "PHP" },
+	{ "pl", "Perl" },
+	{ "pm", "Perl" },
+	{ "ps1", "PowerShell" },
+	{ "py", "Python" },
+	{ "r", "R" },
+	{ "rake", "Ruby" },
+	{ "rb", "Ruby" },
+	{ "rs", "Rust" },
+	{ "sass", "Sass" },
+	{ "scala", "Scala" },
+	{ "scss", "SCSS" },
+	{ "sh", "Shell" },
+	{ "sql", "SQL" },
+	{ "swift", "Swift" },
+	{ "tcl", "Tcl" },
+	{ "tex", "TeX" },
+	{ "ts", "TypeScript" },
+	{ "tsx", "TypeScript" },
+	{ "vim", "Vim script" },
+	{ "vue", "Vue" },
+	{ "xs", "XS" },
+	{ "zsh", "Shell" },
+};
+
+static const struct lang_extension lang_filenames[] = {
+	/* sorted by name, for bsearch() */
+	{ "CMakeLists.txt", "CMake" },
+	{ "Dockerfile", "Dockerfile" },
+	{ "GNUmakefile", "Makefile" },
+	{ "Gemfile", "Ruby" },
+	{ "Makefile", "Makefile" },
+	{ "Rakefile", "Ruby" },
+	{ "Vagrantfile", "Ruby" },
+	{ "makefile", "Makefile" },
+};
+
+static int lang_extension_cmp(const void *key, const void *entry)
+{
+	return strcmp((const char *)key, ((const struct lang_extension *)entry)->extension);
+}
+
+static const char *lang_from_name(const char *name)
+{
+	const struct lang_extension *found;
+	const char *dot = strrchr(name, '.');
+	char extension[16];
+	size_t i;
+
+	found = bsearch(name, lang_filenames, sizeof(lang_filenames) / sizeof(lang_filenames[0]),
+		sizeof(lang_filenames[0]), lang_extension_cmp);
+	if (found)
+		return found->language;
+
+	if (dot == NULL || dot == name || strlen(dot + 1) >= sizeof(extension))
+		return NULL;
+
+	for (i = 0; dot[i + 1]; ++i)
+		extension[i] = (char)tolower((unsigned char)dot[i + 1]);
+	extension[i] = '\0';
+
+	found = bsearch(extension, lang_extensions, sizeof(lang_extensions) / sizeof(lang_extensions[0]),
+		sizeof(lang_extensions[0]), lang_extension_cmp);
+
+	return found ? found->language : NULL;
+}
+
+struct lang_total {
+	size_t language;
+	size_t files, bytes, lines;
+};
+
+struct lang_totals {
+	struct lang_total *items;
+	size_t nr, alloc;
+};
+
+static int lang_totals_add(struct lang_totals *totals, size_t language,
+	size_t files, size_t bytes, size_t lines)
+{
+	size_t i;
+
+	for (i = 0; i < totals->nr && totals->items[i].language != language; ++i)
+		;
+
+	if (i == totals->nr) {
+		if (totals->nr == totals->alloc) {
+			size_t alloc = totals->alloc ? totals->alloc * 2 : 4;
+			struct lang_total *items = realloc(totals->items, alloc * sizeof(struct lang_total));
+
+			if (items == NULL)
+				return -1;
+
+			totals->items = items;
+			totals->alloc = alloc;
+		}
+
+		memset(&totals->items[i], 0, sizeof(struct lang_total));
+		totals->items[i].language = language;
+		totals->nr++;
+	}
+
+	totals->items[i].files += files;
+	totals->items[i].bytes += bytes;
+	totals->items[i].lines += lines;
+	return 0;
+}
+
+static int lang_totals_merge(struct lang_totals *into, const struct lang_totals *from)
+{
+	size_t i;
+
+	for (i = 0; i < from->nr; ++i) {
+		const struct lang_total *total = &from->items[i];
+		if (lang_totals_add(into, total->language, total->files, total->bytes, total->lines) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+struct lang_cache_entry {
+	git_oid tree;
+	uint64_t context;
+	struct lang_totals totals;
+};
+
+struct language_stats_cache {
+	pthread_mutex_t mutex;
+
+	/* interned language names; a language is an index in here */
+	char **languages;
+	size_t nr_languages, alloc_languages;
+
+	struct lang_cache_entry *entries;
+	size_t nr_entries, alloc_entries;
+
+	/* open-addressing table of entry indexes + 1, 0 is empty */
+	uint32_t *table;
+	size_t table_size;
+};
+
+static void language_stats_cache_clear(struct language_stats_cache *cache)
+{
+	size_t i;
+
+	for (i = 0; i < cache->nr_entries; ++i)
+		free(cache->entries[i].totals.items);
+
+	cache->nr_entries = 0;
+	if (cache->table)
+		memset(cache->table, 0, cache->table_size * sizeof(uint32_t));
+}
+
+static void language_stats_cache__free(struct language_stats_cache *cache)
+{
+	size_t i;
+
+	language_stats_cache_clear(cache);
+	for (i = 0; i < cache->nr_languages; ++i)
+		free(cache->languages[i]);
+
+	free(cache->languages);
+	free(cache->entries);
+	free(cache->table);
+	pthread_mutex_destroy(&cache->mutex);
+	xfree(cache);
+}
+
+static struct language_stats_cache *rugged_repo_language_stats_cache(VALUE rb_repo)
+{
+	VALUE rb_cache = rb_iv_get(rb_repo, LANG_CACHE_IVAR);
+	struct language_stats_cache *cache;
+
+	if (NIL_P(rb_cache)) {
+		cache = xcalloc(1, sizeof(struct language_stats_cache));
+		pthread_mutex_init(&cache->mutex, NULL);
+
+		rb_cache = Data_Wrap_Struct(rb_cObject, NULL, &language_stats_cache__free, cache);
+		rb_iv_set(rb_repo, LANG_CACHE_IVAR, rb_cache);
+	}
+
+	Data_Get_Struct(rb_cache, struct language_stats_cache, cache);
+	return cache;
+}
+
+static inline size_t lang_cache_hash(const git_oid *tree, uint64_t context)
+{
+	/* OIDs are already uniformly distributed */
+	return (((size_t)tree->id[0] << 24) | ((size_t)tree->id[1] << 16) |
+		((size_t)tree->id[2] << 8) | (size_t)tree->id[3]) ^ (size_t)context;
+}
+
+/* Must be called with the cache mutex held */
+static struct lang_cache_entry *lang_cache_find(struct language_stats_cache *cache,
+	const git_oid *tree, uint64_t context)
+{
+	size_t i, mask = cache->table_size - 1;
+
+	if (cache->table_size == 0)
+		return NULL;
+
+	for (i = lang_cache_hash(tree, context) & mask; cache->table[i]; i = (i + 1) & mask) {
+		struct lang_cache_entry *entry = &cache->entries[cache->table[i] - 1];
+		if (entry->context == context && git_oid_equal(&entry->tree, tree))
+			return entry;
+	}
+
+	return NULL;
+}
+
+/* Must be called with the cache mutex held. Takes ownership of +totals+ */
+static int lang_cache_add(struct language_stats_cache *cache,
+	const git_oid *tree, uint64_t context, struct lang_totals *totals)
+{
+	struct lang_cache_entry *entry;
+	size_t i, mask;
+
+	if (lang_cache_find(cache, tree, context))
+		return 0;
+
+	if (cache->nr_entries >= LANG_CACHE_MAX_ENTRIES)
+		language_stats_cache_clear(cache);
+
+	if (cache->nr_entries == cache->alloc_entries) {
+		size_t alloc = cache->alloc_entries ? cache->alloc_entries * 2 : 256;
+		struct lang_cache_entry *entries = realloc(cache->entries, alloc * sizeof(struct lang_cache_entry));
+
+		if (entries == NULL)
+			return -1;
+
+		cache->entries = entries;
+		cache->alloc_entries = alloc;
+	}
+
+	if ((cache->nr_entries + 1) * 2 > cache->table_size) {
+		size_t table_size = cache->table_size ? cache->table_size * 2 : 512;
+		uint32_t *table = calloc(table_size, sizeof(uint32_t));
+
+		if (table == NULL)
+			return -1;
+
+		free(cache->table);
+		cache->table = table;
+		cache->table_size = table_size;
+		mask = table_size - 1;
+
+		for (i = 0; i < cache->nr_entries; ++i) {
+			size_t j = lang_cache_hash(&cache->entries[i].tree, cache->entries[i].context) & mask;
+			while (cache->table[j])
+				j = (j + 1) & mask;
+			cache->table[j] = (uint32_t)(i + 1);
+		}
+	}
+
+	entry = &cache->entries[cache->nr_entries];
+	git_oid_cpy(&entry->tree, tree);
+	entry->context = context;
+	entry->totals = *totals;
+	memset(totals, 0, sizeof(*totals));
+
+	mask = cache->table_size - 1;
+	for (i = lang_cache_hash(tree, context) & mask; cache->table[i]; i = (i + 1) & mask)
+		;
+	cache->table[i] = (uint32_t)(++cache->nr_entries);
+
+	return 0;
+}
+
+/* Must be called with the cache mutex held */
+static int lang_cache_intern(struct language_stats_cache *cache, const char *name, size_t *out)
+{
+	size_t i;
+	char *copy;
+
+	for (i = 0; i < cache->nr_languages; ++i) {
+		if (strcmp(cache->languages[i], name) == 0) {
+			*out = i;
+			return 0;
+		}
+	}
+
+	if (cache->nr_languages == cache->alloc_languages) {
+		size_t alloc = cache->alloc_languages ? cache->alloc_languages * 2 : 32;
+		char **languages = realloc(cache->languages, alloc * sizeof(char *));
+
+		if (languages == NULL)
+			return -1;
+
+		cache->languages = languages;
+		cache->alloc_languages = alloc;
+	}
+
+	if ((copy = strdup(name)) == NULL)
+		return -1;
+
+	cache->languages[cache->nr_languages] = copy;
+	*out = cache->nr_languages++;
+	return 0;
+}
+
+/* A `.gitattributes` line that sets at least one linguist-* attribute */
+struct lang_rule {
+	/* directory holding the .gitattributes, "" or "dir/" */
+	char *base;
+	char *pattern;
+
+	/* -1 when the rule doesn't say, 0 or 1 otherwise */
+	int vendored, generated, documentation;
+	char *language;
+};
+
+struct lang_rules {
+	struct lang_rule *rules;
+	size_t nr, alloc;
+};
+
+static void lang_rule_free(struct lang_rule *rule)
+{
+	free(rule->base);
+	free(rule->pattern);
+	free(rule->language);
+}
+
+static int lang_attr_value(const char *token, const char *name, int *out)
+{
+	size_t len = strlen(name);
+	int value = 1;
+
+	if (*token == '-') {
+		value = 0;
+		token++;
+	} else if (*token == '!') {
+		value = -1;
+		token++;
+	}
+
+	if (strncmp(token, name, len) != 0)
+		return 0;
+
+	if (token[len] == '\0') {
+		*out = value;
+		return 1;
+	}
+
+	if (token[len] == '=' && value == 1) {
+		*out = strcmp(token + len + 1, "false") != 0;
+		return 1;
+	}
+
+	return 0;
+}
+
+/* Cut the next blank-separated token off +*cursor+; NULL at the end of the line */
+static char *lang_next_token(char **cursor)
+{
+	char *token = *cursor, *end;
+
+	while (*token == ' ' || *token == '\t' || *token == '\r')
+		token++;
+
+	if (*token == '\0') {
+		*cursor = token;
+		return NULL;
+	}
+
+	for (end = token; *end && *end != ' ' && *end != '\t' && *end != '\r'; ++end)
+		;
+	if (*end)
+		*end++ = '\0';
+
+	*cursor = end;
+	return token;
+}
+
+static int lang_rules_parse(struct lang_rules *rules, const char *base, const char *content, size_t size)
+{
+	const char *line = content, *end = content + size;
+
+	while (line < end) {
+		const char *eol = memchr(line, '\n', end - line);
+		char *buf, *token, *cursor;
+		struct lang_rule rule;
+		int interesting = 0;
+
+		if (eol == NULL)
+			eol = end;
+
+		if ((buf = malloc(eol - line + 1)) == NULL)
+			return -1;
+		memcpy(buf, line, eol - line);
+		buf[eol - line] = '\0';
+		line = eol + 1;
+
+		memset(&rule, 0, sizeof(rule));
+		rule.vendored = rule.generated = rule.documentation = -1;
+
+		cursor = buf;
+		token = lang_next_token(&cursor);
+		if (token == NULL || *token == '#' || strncmp(token, "[attr]", 6) == 0) {
+			free(buf);
+			continue;
+		}
+		if ((rule.pattern = strdup(token)) == NULL) {
+			free(buf);
+			return -1;
+		}
+
+		while ((token = lang_next_token(&cursor)) != NULL) {
+			if (lang_attr_value(token, "linguist-vendored", &rule.vendored) ||
+				lang_attr_value(token, "linguist-generated", &rule.generated) ||
+				lang_attr_value(token, "linguist-documentation", &rule.documentation)) {
+				interesting = 1;
+			} else if (strncmp(token, "linguist-language=", 18) == 0) {
+				free(rule.language);
+				rule.language = strdup(token + 18);
+				interesting = 1;
+			}
+		}
+
+		free(buf);
+
+		if (!interesting) {
+			lang_rule_free(&rule);
+			continue;
+		}
+
+		if ((rule.base = strdup(base)) == NULL) {
+			lang_rule_free(&rule);
+			return -1;
+		}
+
+		if (rules->nr == rules->alloc) {
+			size_t alloc = rules->alloc ? rules->alloc * 2 : 16;
+			struct lang_rule *grown = realloc(rules->rules, alloc * sizeof(struct lang_rule));
+
+			if (grown == NULL) {
+				lang_rule_free(&rule);
+				return -1;
+			}
+
+			rules->rules = grown;
+			rules->alloc = alloc;
+		}
+
+		rules->rules[rules->nr++] = rule;
+	}
+
+	return 0;
+}
+
+static void lang_rules_truncate(struct lang_rules *rules, size_t nr)
+{
+	while (rules->nr > nr)
+		lang_rule_free(&rules->rules[--rules->nr]);
+}
+
+/*
+ * Match the character class starting after the "[" at +p+ against +c+.
+ * Returns the pattern past the closing "]", or NULL if there is none and
+ * the "[" is just a character.
+ */
+static const char *lang_glob_class(const char *p, char c, int *matched)
+{
+	int negate = 0, found = 0;
+
+	if (*p == '!' || *p == '^') {
+		negate = 1;
+		p++;
+	}
+
+	/* A "]" right after the "[" is part of the class */
+	if (*p == ']') {
+		found = (c == ']');
+		p++;
+	}
+
+	while (*p && *p != ']') {
+		unsigned char lo, hi;
+
+		if (*p == '\\' && p[1])
+			p++;
+		lo = hi = (unsigned char)*p++;
+
+		if (*p == '-' && p[1] && p[1] != ']') {
+			if (p[1] == '\\' && p[2])
+				p++;
+			hi = (unsigned char)p[1];
+			p += 2;
+		}
+
+		if ((unsigned char)c >= lo && (unsigned char)c <= hi)
+			found = 1;
+	}
+
+	if (*p != ']')
+		return NULL;
+
+	*matched = (found != negate);
+	return p + 1;
+}
+
+/*
+ * Glob matching with "*", "?", "[...]" and backslash escapes, like
+ * fnmatch(). With +pathname+, wildcards don't match a slash, like
+ * FNM_PATHNAME.
+ */
+static int lang_glob(const char *p, const char *s, int pathname)
+{
+	const char *star_p = NULL, *star_s = NULL;
+
+	while (*s) {
+		const char *next = NULL;
+		int matched = 0;
+
+		if (*p == '*') {
+			while (*p == '*')
+				p++;
+			star_p = p;
+			star_s = s;
+			continue;
+		}
+
+		if (*p == '?') {
+			matched = !(pathname && *s == '/');
+			next = p + 1;
+		} else if (*p == '[' && (next = lang_glob_class(p + 1, *s, &matched)) != NULL) {
+			if (pathname && *s == '/')
+				matched = 0;
+		} else if (*p == '\\' && p[1]) {
+			matched = (p[1] == *s);
+			next = p + 2;
+		} else if (*p) {
+			matched = (*p == *s);
+			next = p + 1;
+		}
+
+		if (matched) {
+			p = next;
+			s++;
+			continue;
+		}
+
+		/* Let the last star take one more character, if it can */
+		if (star_p == NULL || (pathname && *star_s == '/'))
+			return 0;
+		p = star_p;
+		s = ++star_s;
+	}
+
+	while (*p == '*')
+		p++;
+	return *p == '\0';
+}
+
+/* Path matching, where a pattern ending in a slash and "**" matches everything below */
+static int lang_path_glob(const char *pattern, const char *path)
+{
+	size_t len = strlen(pattern);
+	const char *slash;
+	char *prefix, *dir_pattern;
+	int matched = 0;
+
+	if (len < 3 || strcmp(pattern + len - 3, "/**") != 0)
+		return lang_glob(pattern, path, 1);
+
+	prefix = malloc(strlen(path) + 1);
+	if ((dir_pattern = malloc(len - 2)) != NULL) {
+		memcpy(dir_pattern, pattern, len - 3);
+		dir_pattern[len - 3] = '\0';
+	}
+
+	for (slash = strchr(path, '/'); prefix && dir_pattern && slash && !matched; slash = strchr(slash + 1, '/')) {
+		memcpy(prefix, path, slash - path);
+		prefix[slash - path] = '\0';
+		matched = lang_glob(dir_pattern, prefix, 1);
+	}
+
+	free(prefix);
+	free(dir_pattern);
+	return matched;
+}
+
+static int lang_rule_matches(const struct lang_rule *rule, const char *path, const char *name)
+{
+	size_t base_len = strlen(rule->base);
+	const char *pattern = rule->pattern, *rel;
+
+	if (strncmp(path, rule->base, base_len) != 0)
+		return 0;
+	rel = path + base_len;
+
+	/* Patterns without a slash match the file name at any depth */
+	if (strchr(pattern, '/') == NULL)
+		return lang_glob(pattern, name, 0);
+
+	if (*pattern == '/')
+		pattern++;
+
+	if (strncmp(pattern, "**/", 3) == 0) {
+		for (pattern += 3; rel; rel = strchr(rel, '/') ? strchr(rel, '/') + 1 : NULL) {
+			if (lang_path_glob(pattern, rel))
+				return 1;
+		}
+		return 0;
+	}
+
+	return lang_path_glob(pattern, rel);
+}
+
+/*
+ * Fingerprint of the rules inherited at +path+. Subtree totals are cached
+ * under it, so two different rule sets must not collide: it is 64 bits
+ * wide, and a missing language is hashed apart from an empty one.
+ */
+static uint64_t lang_rules_fingerprint(const struct lang_rules *rules, const char *path)
+{
+	uint64_t hash = 14695981039346656037ull;
+	size_t i;
+
+#define FNV_BYTE(b) do { hash ^= (unsigned char)(b); hash *= 1099511628211ull; } while (0)
+#define FNV_STR(s) do { const char *_s = (s); if (!_s) { FNV_BYTE(0xfe); break; } for (; *_s; ++_s) FNV_BYTE(*_s); FNV_BYTE(0xff); } while (0)
+#define FNV_INT(v) FNV_BYTE((v) + 2)
+
+	if (rules->nr == 0)
+		return 0;
+
+	/* Inherited rules can match on the path of the subtree, so it's part of the key */
+	FNV_STR(path);
+	for (i = 0; i < rules->nr; ++i) {
+		FNV_STR(rules->rules[i].base);
+		FNV_STR(rules->rules[i].pattern);
+		FNV_STR(rules->rules[i].language);
+		FNV_INT(rules->rules[i].vendored);
+		FNV_INT(rules->rules[i].generated);
+		FNV_INT(rules->rules[i].documentation);
+	}
+
+#undef FNV_BYTE
+#undef FNV_STR
+#undef FNV_INT
+
+	return hash ? hash : 1;
+}
+
+struct lang_node {
+	git_oid tree;
+	uint64_t context;
+	size_t parent;
+	int cached;
+	struct lang_totals totals;
+};
+
+typedef struct {
+	rugged_pool_task task;
+
+	git_repository *repo;
+	git_oid blob;
+	size_t node, language;
+
+	size_t bytes, lines;
+	int binary;
+
+	int error;
+	int error_class;
+	char *error_message;
+} lang_blob_task;
+
+struct lang_task_block {
+	struct lang_task_block *next;
+	size_t nr;
+	lang_blob_task tasks[LANG_TASK_BLOCK];
+};
+
+struct language_stats {
+	git_repository *repo;
+	git_tree *tree;
+	struct language_stats_cache *cache;
+
+	struct lang_rules rules;
+
+	struct lang_node *nodes;
+	size_t nr_nodes, alloc_nodes;
+
+	struct lang_task_block *blocks;
+	rugged_pool_group group;
+
+	char *path;
+	size_t path_len, path_alloc;
+
+	int error, os_errno;
+	int error_class;
+	char *error_message;
+	volatile int interrupted;
+};
+
+static void lang_blob_task_run(void *payload)
+{
+	lang_blob_task *task = payload;
+	git_blob *blob;
+	struct rugged_text_scan scan;
+	int error;
+
+	if ((error = git_blob_lookup(&blob, task->repo, &task->blob)) < 0) {
+		const git_error *err = giterr_last();
+
+		task->error = error;
+		task->error_class = err ? err->klass : GITERR_INVALID;
+		task->error_message = strdup(err ? err->message : "failed to read blob");
+		return;
+	}
+
+	task->bytes = (size_t)git_blob_rawsize(blob);
+
+	/* Like linguist, binary files don't count towards any language */
+	if ((task->binary = git_blob_is_binary(blob)) == 0) {
+		memset(&scan, 0, sizeof(scan));
+		scan.data = git_blob_rawcontent(blob);
+		scan.size = task->bytes;
+		rugged_text_scan(&scan);
+		task->lines = scan.sloc;
+	}
+
+	git_blob_free(blob);
+}
+
+static int lang_submit_blob(struct language_stats *ls, const git_oid *oid, size_t node, size_t language)
+{
+	struct lang_task_block *block = ls->blocks;
+	lang_blob_task *task;
+	int error;
+
+	if (block == NULL || block->nr == LANG_TASK_BLOCK) {
+		if ((block = calloc(1, sizeof(struct lang_task_block))) == NULL)
+			return ENOMEM;
+		block->next = ls->blocks;
+		ls->blocks = block;
+	}
+
+	task = &block->tasks[block->nr];
+	task->repo = ls->repo;
+	git_oid_cpy(&task->blob, oid);
+	task->node = node;
+	task->language = language;
+
+	if ((error = rugged_pool_submit(&ls->group, &task->task, lang_blob_task_run, task)) != 0)
+		return error;
+
+	block->nr++;
+	return 0;
+}
+
+static int lang_path_push(struct language_stats *ls, const char *name, int dir)
+{
+	size_t len = strlen(name) + (dir ? 1 : 0);
+
+	if (ls->path_len + len + 1 > ls->path_alloc) {
+		size_t alloc = (ls->path_len + len + 1) * 2;
+		char *path = realloc(ls->path, alloc);
+
+		if (path == NULL)
+			return -1;
+
+		ls->path = path;
+		ls->path_alloc = alloc;
+	}
+
+	memcpy(ls->path + ls->path_len, name, strlen(name));
+	ls->path_len += len;
+	if (dir)
+		ls->path[ls->path_len - 1] = '/';
+	ls->path[ls->path_len] = '\0';
+	return 0;
+}
+
+static int lang_add_node(struct language_stats *ls, const git_oid *tree, uint64_t context, size_t parent)
+{
+	struct lang_node *node;
+
+	if (ls->nr_nodes == ls->alloc_nodes) {
+		size_t alloc = ls->alloc_nodes ? ls->alloc_nodes * 2 : 64;
+		struct lang_node *nodes = realloc(ls->nodes, alloc * sizeof(struct lang_node));
+
+		if (nodes == NULL)
+			return -1;
+
+		ls->nodes = nodes;
+		ls->alloc_nodes = alloc;
+	}
+
+	node = &ls->nodes[ls->nr_nodes++];
+	memset(node, 0, sizeof(*node));
+	git_oid_cpy(&node->tree, tree);
+	node->context = context;
+	node->parent = parent;
+	return 0;
+}
+
+static void lang_set_error(struct language_stats *ls, int error)
+{
+	const git_error *err = giterr_last();
+
+	ls->error = error;
+	ls->error_class = err ? err->klass : GITERR_INVALID;
+	ls->error_message = strdup(err ? err->message : "failed to walk tree");
+}
+
+/* Returns -1 with ls->error or ls->os_errno set on failure */
+static int lang_visit_tree(struct language_stats *ls, const git_tree *tree, size_t parent)
+{
+	const git_tree_entry *entry;
+	struct lang_cache_entry *cached;
+	size_t i, count, node, nr_rules = ls->rules.nr, path_len = ls->path_len;
+	uint64_t context = lang_rules_fingerprint(&ls->rules, ls->path);
+	int error, result = 0;
+
+	if (ls->interrupted)
+		return -1;
+
+	if (lang_add_node(ls, git_tree_id(tree), context, parent) < 0) {
+		ls->os_errno = ENOMEM;
+		return -1;
+	}
+	node = ls->nr_nodes - 1;
+
+	pthread_mutex_lock(&ls->cache->mutex);
+	cached = lang_cache_find(ls->cache, git_tree_id(tree), context);
+	if (cached && lang_totals_merge(&ls->nodes[node].totals, &cached->totals) < 0)
+		ls->os_errno = ENOMEM;
+	pthread_mutex_unlock(&ls->cache->mutex);
+
+	if (cached) {
+		ls->nodes[node].cached = 1;
+		return ls->os_errno ? -1 : 0;
+	}
+
+	/* This directory's own rules apply to everything below it */
+	entry = git_tree_entry_byname(tree, ".gitattributes");
+	if (entry && git_tree_entry_type(entry) == GIT_OBJ_BLOB) {
+		git_blob *blob;
+
+		if ((error = git_blob_lookup(&blob, ls->repo, git_tree_entry_id(entry))) < 0) {
+			lang_set_error(ls, error);
+			return -1;
+		}
+
+		error = lang_rules_parse(&ls->rules, ls->path, git_blob_rawcontent(blob), (size_t)git_blob_rawsize(blob));
+		git_blob_free(blob);
+
+		if (error < 0) {
+			ls->os_errno = ENOMEM;
+			return -1;
+		}
+	}
+
+	count = git_tree_entrycount(tree);
+	for (i = 0; i < count && result == 0 && !ls->interrupted; ++i) {
+		const char *name, *language = NULL;
+		int vendored = 0, generated = 0, documentation = 0;
+		size_t j, language_id;
+
+		entry = git_tree_entry_byindex(tree, i);
+		name = git_tree_entry_name(entry);
+
+		if (git_tree_entry_type(entry) == GIT_OBJ_TREE) {
+			git_tree *subtree;
+
+			if ((error = git_tree_lookup(&subtree, ls->repo, git_tree_entry_id(entry))) < 0) {
+				lang_set_error(ls, error);
+				result = -1;
+			} else if (lang_path_push(ls, name, 1) < 0) {
+				ls->os_errno = ENOMEM;
+				result = -1;
+				git_tree_free(subtree);
+			} else {
+				result = lang_visit_tree(ls, subtree, node);
+				git_tree_free(subtree);
+				ls->path_len = path_len;
+				ls->path[path_len] = '\0';
+			}
+			continue;
+		}
+
+		/* Skip submodules and symlinks */
+		if (git_tree_entry_type(entry) != GIT_OBJ_BLOB || git_tree_entry_filemode(entry) == GIT_FILEMODE_LINK)
+			continue;
+
+		if (lang_path_push(ls, name, 0) < 0) {
+			ls->os_errno = ENOMEM;
+			result = -1;
+			break;
+		}
+
+		for (j = 0; j < ls->rules.nr; ++j) {
+			const struct lang_rule *rule = &ls->rules.rules[j];
+
+			if (!lang_rule_matches(rule, ls->path, name))
+				continue;
+
+			if (rule->vendored >= 0)
+				vendored = rule->vendored;
+			if (rule->generated >= 0)
+				generated = rule->generated;
+			if (rule->documentation >= 0)
+				documentation = rule->documentation;
+			if (rule->language)
+				language = rule->language;
+		}
+
+		ls->path_len = path_len;
+		ls->path[path_len] = '\0';
+
+		if (vendored || generated || documentation)
+			continue;
+		if (language == NULL && (language = lang_from_name(name)) == NULL)
+			continue;
+
+		pthread_mutex_lock(&ls->cache->mutex);
+		error = lang_cache_intern(ls->cache, language, &language_id);
+		pthread_mutex_unlock(&ls->cache->mutex);
+
+		if (error < 0 || (error = lang_submit_blob(ls, git_tree_entry_id(entry), node, language_id)) != 0) {
+			ls->os_errno = error < 0 ? ENOMEM : error;
+			result = -1;
+		}
+	}
+
+	lang_rules_truncate(&ls->rules, nr_rules);
+	return ls->interrupted ? -1 : result;
+}
+
+static void *language_stats_run(void *payload)
+{
+	struct language_stats *ls = payload;
+	struct lang_task_block *block;
+	size_t i;
+
+	ls->path_len = 0;
+	if (lang_path_push(ls, "", 0) < 0) {
+		ls->os_errno = ENOMEM;
+		return NULL;
+	}
+
+	lang_visit_tree(ls, ls->tree, LANG_NO_PARENT);
+
+	/* Tasks that already started have to finish, whatever happened */
+	if (ls->interrupted || ls->error || ls->os_errno)
+		rugged_pool_cancel(&ls->group);
+	rugged_pool_drain(&ls->group);
+
+	if (ls->interrupted || ls->error || ls->os_errno)
+		return NULL;
+
+	for (block = ls->blocks; block; block = block->next) {
+		for (i = 0; i < block->nr; ++i) {
+			lang_blob_task *task = &block->tasks[i];
+
+			if (task->error < 0) {
+				if (!ls->error) {
+					ls->error = task->error;
+					ls->error_class = task->error_class;
+					ls->error_message = task->error_message;
+					task->error_message = NULL;
+				}
+				continue;
+			}
+
+			if (!task->binary &&
+				lang_totals_add(&ls->nodes[task->node].totals, task->language, 1, task->bytes, task->lines) < 0)
+				ls->os_errno = ENOMEM;
+		}
+	}
+
+	if (ls->error || ls->os_errno)
+		return NULL;
+
+	/* Children always come after their parent: fold the totals upwards */
+	for (i = ls->nr_nodes; i-- > 1; ) {
+		if (lang_totals_merge(&ls->nodes[ls->nodes[i].parent].totals, &ls->nodes[i].totals) < 0) {
+			ls->os_errno = ENOMEM;
+			return NULL;
+		}
+	}
+
+	pthread_mutex_lock(&ls->cache->mutex);
+	for (i = 0; i < ls->nr_nodes; ++i) {
+		struct lang_node *node = &ls->nodes[i];
+		struct lang_totals copy = {NULL, 0, 0};
+
+		if (node->cached)
+			continue;
+
+		/* The cache may be cleared while we add to it: give it its own copy */
+		if (lang_totals_merge(&copy, &node->totals) < 0 ||
+			lang_cache_add(ls->cache, &node->tree, node->context, &copy) < 0)
+			free(copy.items);
+	}
+	pthread_mutex_unlock(&ls->cache->mutex);
+
+	return NULL;
+}
+
+static void language_stats_interrupt(void *payload)
+{
+	struct language_stats *ls = payload;
+
+	ls->interrupted = 1;
+	rugged_pool_cancel(&ls->group);
+	rugged_pool_interrupt(&ls->group);
+}
+
+static void language_stats_reset(struct language_stats *ls)
+{
+	struct lang_task_block *block;
+	size_t i;
+
+	while ((block = ls->blocks) != NULL) {
+		ls->blocks = block->next;
+		for (i = 0; i < block->nr; ++i)
+			free(block->tasks[i].error_message);
+		free(block);
+	}
+
+	for (i = 0; i < ls->nr_nodes; ++i)
+		free(ls->nodes[i].totals.items);
+	ls->nr_nodes = 0;
+
+	lang_rules_truncate(&ls->rules, 0);
+
+	free(ls->error_message);
+	ls->error_message = NULL;
+	ls->error = ls->os_errno = 0;
+}
+
+static VALUE language_stats_check_ints(VALUE unused)
+{
+	rb_thread_check_ints();
+	return Qnil;
+}
+
+/*
+ *  call-seq:
+ *    tree.language_stats -> hash
+ *
+ *  Return the size of every programming language in the tree and all its
+ *  subtrees, as a Hash of language names to totals:
+ *
+ *    tree.language_stats
+ *    #=> {"Ruby" => {:files => 12, :bytes => 18345, :lines => 520}, ...}
+ *
+ *  Files are classified by their extension or name, unless a
+ *  `.gitattributes` file in the tree sets +linguist-language+ for them.
+ *  Files marked +linguist-vendored+, +linguist-generated+ or
+ *  +linguist-documentation+ are left out, as are binary files and files
+ *  in no known language. +:lines+ counts non-empty lines, like Blob#sloc.
+ *
+ *  The blobs are read on the shared thread pool, without holding the GVL.
+ *  The totals of every subtree are cached on the repository, so asking
+ *  again for a tree that shares most of its subtrees with one seen before
+ *  (e.g. the tree of the next commit) only reads what changed.
+ */
+static VALUE rb_git_tree_language_stats(VALUE self)
+{
+	struct language_stats ls;
+	VALUE rb_repo = rugged_owner(self), rb_result = Qnil;
+	int exception = 0;
+	size_t i;
+
+	memset(&ls, 0, sizeof(ls));
+	Data_Get_Struct(self, git_tree, ls.tree);
+	Data_Get_Struct(rb_repo, git_repository, ls.repo);
+	ls.cache = rugged_repo_language_stats_cache(rb_repo);
+
+	rugged_pool_group_init(&ls.group);
+
+	for (;;) {
+		ls.interrupted = 0;
+		rugged_without_gvl(language_stats_run, &ls, language_stats_interrupt, &ls);
+
+		if (!ls.interrupted || ls.error || ls.os_errno)
+			break;
+
+		/* Raise if there's a pending exception, start over otherwise */
+		rb_protect(language_stats_check_ints, Qnil, &exception);
+		if (exception)
+			break;
+
+		language_stats_reset(&ls);
+	}
+
+	if (!exception && !ls.error && !ls.os_errno) {
+		struct lang_totals *totals = &ls.nodes[0].totals;
+
+		rb_result = rb_hash_new();
+		for (i = 0; i < totals->nr; ++i) {
+			VALUE rb_total = rb_hash_new();
+			const char *language;
+
+			rb_hash_aset(rb_total, CSTR2SYM("files"), SIZET2NUM(totals->items[i].files));
+			rb_hash_aset(rb_total, CSTR2SYM("bytes"), SIZET2NUM(totals->items[i].bytes));
+			rb_hash_aset(rb_total, CSTR2SYM("lines"), SIZET2NUM(totals->items[i].lines));
+
+			pthread_mutex_lock(&ls.cache->mutex);
+			language = ls.cache->languages[totals->items[i].language];
+			pthread_mutex_unlock(&ls.cache->mutex);
+
+			rb_hash_aset(rb_result, rb_str_new_utf8(language), rb_total);
+		}
+	}
+
+	if (ls.error)
+		giterr_set_str(ls.error_class, ls.error_message);
+
+	{
+		int error = ls.error, os_errno = ls.os_errno;
+
+		language_stats_reset(&ls);
+		free(ls.nodes);
+		free(ls.rules.rules);
+		free(ls.path);
+		rugged_pool_group_free(&ls.group);
+		RB_GC_GUARD(rb_repo);
+
+		if (exception)
+			rb_jump_tag(exception);
+		if (os_errno) {
+			VALUE rb_errno = INT2FIX(os_errno);
+			rb_exc_raise(rb_class_new_instance(1, &rb_errno, rb_eSystemCallError));
+		}
+		rugged_exception_check(error);
+	}
+
+	return rb_result;
+}
+
+void Init_rugged_tree_language_stats(void)
+{
+	rb_define_method(rb_cRuggedTree, "language_stats", rb_git_tree_language_stats, 0);
+}
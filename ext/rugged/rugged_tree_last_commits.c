@@ -0,0 +1,463 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2014 GitHub, Inc
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include "rugged.h"
+
+extern VALUE rb_cRuggedTree;
+
+#define LAST_COMMITS_CACHE_IVAR "__last_commits_cache"
+#define LAST_COMMITS_CACHE_BYTES_IVAR "__last_commits_cache_bytes"
+#define LAST_COMMITS_CACHE_BYTES (8 * 1024 * 1024)
+
+#define LAST_COMMITS_UNRESOLVED UINT32_MAX
+
+/* The last commit of one entry, and how many commits in the walk it was */
+struct last_commit {
+	git_oid commit;
+	uint32_t depth;
+};
+
+/*
+ * A cached walk: the header is followed by one struct last_commit per
+ * entry of the tree, in tree order. The cache only lives in memory, so
+ * it is kept in native byte order.
+ */
+struct last_commits_header {
+	uint32_t walked;
+	uint32_t complete;
+};
+
+struct last_commits {
+	git_repository *repo;
+	git_revwalk *walk;
+	const git_tree *tree;
+	char *prefix;
+
+	struct last_commit *results;
+	size_t unresolved;
+
+	uint32_t walked, limit;
+	int complete;
+
+	volatile int interrupted;
+	int error;
+};
+
+/*
+ * Find the OID of the directory at the prefix in the tree +root_id+.
+ * Returns 0 with +found+ cleared if there's no such directory.
+ */
+static int last_commits_dir_id(git_oid *out, int *found, struct last_commits *lc, const git_oid *root_id)
+{
+	git_tree *root;
+	git_tree_entry *entry;
+	int error;
+
+	*found = 0;
+
+	if (!lc->prefix) {
+		git_oid_cpy(out, root_id);
+		*found = 1;
+		return 0;
+	}
+
+	if ((error = git_tree_lookup(&root, lc->repo, root_id)) < 0)
+		return error;
+
+	error = git_tree_entry_bypath(&entry, root, lc->prefix);
+	git_tree_free(root);
+
+	if (error == GIT_ENOTFOUND) {
+		giterr_clear();
+		return 0;
+	}
+	if (error < 0)
+		return error;
+
+	if (git_tree_entry_type(entry) == GIT_OBJ_TREE) {
+		git_oid_cpy(out, git_tree_entry_id(entry));
+		*found = 1;
+	}
+
+	git_tree_entry_free(entry);
+	return 0;
+}
+
+/*
+ * Resolve every entry that +commit+ changed against its first parent,
+ * with the same rules as a Walker walk with +path_only+. The directory
+ * itself is compared first, so commits that don't touch it cost two
+ * lookups no matter how many entries are left.
+ */
+static int last_commits_check(struct last_commits *lc, const git_oid *commit_id)
+{
+	git_commit *commit, *parent = NULL;
+	git_tree *dir = NULL, *parent_dir = NULL;
+	git_oid dir_id, parent_dir_id;
+	int found, parent_found = 0, error;
+	size_t i, count;
+
+	if ((error = git_commit_lookup(&commit, lc->repo, commit_id)) < 0)
+		return error;
+
+	if (git_commit_parentcount(commit) > 0 &&
+		(error = git_commit_parent(&parent, commit, 0)) < 0)
+		goto cleanup;
+
+	if ((error = last_commits_dir_id(&dir_id, &found, lc, git_commit_tree_id(commit))) < 0)
+		goto cleanup;
+
+	if (parent && (error = last_commits_dir_id(&parent_dir_id, &parent_found, lc, git_commit_tree_id(parent))) < 0)
+		goto cleanup;
+
+	if (found == parent_found && (!found || git_oid_equal(&dir_id, &parent_dir_id)))
+		goto cleanup;
+
+	if (found && (error = git_tree_lookup(&dir, lc->repo, &dir_id)) < 0)
+		goto cleanup;
+
+	if (parent_found && (error = git_tree_lookup(&parent_dir, lc->repo, &parent_dir_id)) < 0)
+		goto cleanup;
+
+	count = git_tree_entrycount(lc->tree);
+	for (i = 0; i < count; ++i) {
+		const char *name;
+		const git_tree_entry *entry = NULL, *parent_entry = NULL;
+		int changed;
+
+		if (lc->results[i].depth != LAST_COMMITS_UNRESOLVED)
+			continue;
+
+		name = git_tree_entry_name(git_tree_entry_byindex(lc->tree, i));
+		if (dir)
+			entry = git_tree_entry_byname(dir, name);
+		if (parent_dir)
+			parent_entry = git_tree_entry_byname(parent_dir, name);
+
+		if (entry && parent_entry) {
+			changed = !git_oid_equal(git_tree_entry_id(entry), git_tree_entry_id(parent_entry)) ||
+				git_tree_entry_filemode(entry) != git_tree_entry_filemode(parent_entry);
+		} else {
+			changed = entry || parent_entry;
+		}
+
+		if (changed) {
+			git_oid_cpy(&lc->results[i].commit, commit_id);
+			lc->results[i].depth = lc->walked;
+			lc->unresolved--;
+		}
+	}
+
+cleanup:
+	git_tree_free(dir);
+	git_tree_free(parent_dir);
+	git_commit_free(parent);
+	git_commit_free(commit);
+	return error;
+}
+
+static int last_commits_step(struct last_commits *lc)
+{
+	git_oid oid;
+	int error;
+
+	while (lc->unresolved > 0 && lc->walked < lc->limit) {
+		if (lc->interrupted)
+			return GIT_EUSER;
+
+		error = git_revwalk_next(&oid, lc->walk);
+		if (error == GIT_ITEROVER) {
+			giterr_clear();
+			lc->complete = 1;
+			return GIT_OK;
+		}
+		if (error < 0)
+			return error;
+
+		if ((error = last_commits_check(lc, &oid)) < 0)
+			return error;
+
+		lc->walked++;
+	}
+
+	if (lc->unresolved == 0)
+		lc->complete = 1;
+
+	return GIT_OK;
+}
+
+static void *last_commits_run(void *payload)
+{
+	struct last_commits *lc = payload;
+
+	lc->error = last_commits_step(lc);
+	return NULL;
+}
+
+static void last_commits_interrupt(void *payload)
+{
+	((struct last_commits *)payload)->interrupted = 1;
+}
+
+static VALUE last_commits_check_ints(VALUE unused)
+{
+	rb_thread_check_ints();
+	return Qnil;
+}
+
+/*
+ * Walk the history from +commit_id+ until every entry is resolved, the
+ * history runs out or +limit+ commits have been looked at. The walk can
+ * be interrupted and carries on where it stopped.
+ */
+static VALUE last_commits_walk(git_repository *repo, const git_tree *tree,
+	const git_oid *commit_id, const char *prefix, uint32_t limit)
+{
+	struct last_commits lc;
+	struct last_commits_header header;
+	VALUE rb_walk = Qnil;
+	size_t i, count = git_tree_entrycount(tree);
+	int exception = 0;
+
+	memset(&lc, 0, sizeof(lc));
+	lc.repo = repo;
+	lc.tree = tree;
+	lc.limit = limit;
+	lc.unresolved = count;
+
+	if (prefix && *prefix) {
+		size_t len = strlen(prefix);
+
+		while (len > 0 && prefix[len - 1] == '/')
+			len--;
+		if (len > 0) {
+			lc.prefix = xmalloc(len + 1);
+			memcpy(lc.prefix, prefix, len);
+			lc.prefix[len] = '\0';
+		}
+	}
+
+	lc.results = xmalloc((count ? count : 1) * sizeof(struct last_commit));
+	for (i = 0; i < count; ++i) {
+		memset(&lc.results[i].commit, 0, sizeof(git_oid));
+		lc.results[i].depth = LAST_COMMITS_UNRESOLVED;
+	}
+
+	lc.error = git_revwalk_new(&lc.walk, repo);
+	if (!lc.error) {
+		git_revwalk_sorting(lc.walk, GIT_SORT_TIME);
+		lc.error = git_revwalk_push(lc.walk, commit_id);
+	}
+
+	while (lc.error == GIT_OK) {
+		lc.interrupted = 0;
+		rugged_without_gvl(last_commits_run, &lc, last_commits_interrupt, &lc);
+
+		if (lc.error != GIT_EUSER || !lc.interrupted)
+			break;
+
+		/* Raise if there's a pending exception, carry on otherwise */
+		lc.error = GIT_OK;
+		rb_protect(last_commits_check_ints, Qnil, &exception);
+		if (exception)
+			break;
+	}
+
+	if (!exception && lc.error == GIT_OK) {
+		header.walked = lc.walked;
+		header.complete = lc.complete;
+
+		rb_walk = rb_str_new(NULL, sizeof(header) + count * sizeof(struct last_commit));
+		memcpy(RSTRING_PTR(rb_walk), &header, sizeof(header));
+		memcpy(RSTRING_PTR(rb_walk) + sizeof(header), lc.results, count * sizeof(struct last_commit));
+		rb_obj_freeze(rb_walk);
+	}
+
+	git_revwalk_free(lc.walk);
+	xfree(lc.results);
+	xfree(lc.prefix);
+
+	if (exception)
+		rb_jump_tag(exception);
+	rugged_exception_check(lc.error);
+
+	return rb_walk;
+}
+
+/*
+ * Whether a cached walk can answer for +limit+: it has to be complete,
+ * or to have looked at least as far back.
+ */
+static int last_commits_usable(VALUE rb_walk, uint32_t limit)
+{
+	struct last_commits_header header;
+
+	memcpy(&header, RSTRING_PTR(rb_walk), sizeof(header));
+	return header.complete || header.walked >= limit;
+}
+
+static VALUE last_commits_cached(VALUE rb_repo, git_repository *repo, const git_tree *tree,
+	const git_oid *commit_id, VALUE rb_prefix, uint32_t limit)
+{
+	VALUE rb_cache, rb_bytes, rb_key, rb_walk;
+	long bytes;
+
+	rb_cache = rb_iv_get(rb_repo, LAST_COMMITS_CACHE_IVAR);
+	if (NIL_P(rb_cache)) {
+		rb_cache = rb_hash_new();
+		rb_iv_set(rb_repo, LAST_COMMITS_CACHE_IVAR, rb_cache);
+		rb_iv_set(rb_repo, LAST_COMMITS_CACHE_BYTES_IVAR, INT2FIX(0));
+	}
+
+	/* The same directory has a different history at another path */
+	rb_key = rb_str_new((const char *)commit_id->id, GIT_OID_RAWSZ);
+	rb_str_cat(rb_key, (const char *)git_tree_id(tree)->id, GIT_OID_RAWSZ);
+	if (!NIL_P(rb_prefix))
+		rb_str_append(rb_key, rb_prefix);
+
+	rb_walk = rb_hash_aref(rb_cache, rb_key);
+	if (!NIL_P(rb_walk) && last_commits_usable(rb_walk, limit))
+		return rb_walk;
+
+	rb_walk = last_commits_walk(repo, tree, commit_id,
+		NIL_P(rb_prefix) ? NULL : StringValueCStr(rb_prefix), limit);
+
+	if (RSTRING_LEN(rb_walk) > LAST_COMMITS_CACHE_BYTES)
+		return rb_walk;
+
+	rb_bytes = rb_iv_get(rb_repo, LAST_COMMITS_CACHE_BYTES_IVAR);
+	bytes = NIL_P(rb_bytes) ? 0 : FIX2LONG(rb_bytes);
+
+	/* Replace a shorter walk of the same directory */
+	if (rb_hash_lookup2(rb_cache, rb_key, Qundef) != Qundef)
+		bytes -= RSTRING_LEN(rb_hash_delete(rb_cache, rb_key));
+
+	/* Evict the oldest walks until the new one fits */
+	while (bytes + RSTRING_LEN(rb_walk) > LAST_COMMITS_CACHE_BYTES && RHASH_SIZE(rb_cache) > 0) {
+		VALUE rb_oldest = rb_funcall(rb_cache, rb_intern("shift"), 0);
+		bytes -= RSTRING_LEN(rb_ary_entry(rb_oldest, 1));
+	}
+
+	rb_hash_aset(rb_cache, rb_key, rb_walk);
+	rb_iv_set(rb_repo, LAST_COMMITS_CACHE_BYTES_IVAR, LONG2FIX(bytes + RSTRING_LEN(rb_walk)));
+
+	return rb_walk;
+}
+
+/*
+ *  call-seq:
+ *    tree.last_commits(commit, path_prefix = nil, limit_depth: nil) -> hash
+ *
+ *  Find the last commit that touched each entry of +tree+, starting from
+ *  +commit+ (a Rugged::Commit or a revision string). +path_prefix+ is the
+ *  path of +tree+ in the tree of +commit+; +nil+ for the root tree.
+ *
+ *  Returns a Hash from each entry name to its last Rugged::Commit, in tree
+ *  order. A commit touches an entry when the entry differs from the one
+ *  in its first parent, exactly like in a Walker walk with +path_only+.
+ *
+ *  The history is walked once for all entries and stops as soon as every
+ *  entry is resolved. With +:limit_depth+, at most that many commits are
+ *  looked at, and the entries that are still unresolved map to +nil+.
+ *
+ *    tree = repo.head.target.tree
+ *    tree.last_commits(repo.head.target)
+ *    #=> {"README" => #<Rugged::Commit:...>, "lib" => #<Rugged::Commit:...>, ...}
+ *
+ *  Results are cached in the repository by commit, +path_prefix+ and tree
+ *  OID, so listing the same directory again doesn't walk the history.
+ */
+static VALUE rb_git_tree_last_commits(int argc, VALUE *argv, VALUE self)
+{
+	VALUE rb_commit, rb_prefix, rb_options, rb_walk, rb_result, rb_commits;
+	VALUE rb_repo = rugged_owner(self);
+	git_repository *repo;
+	git_tree *tree;
+	git_oid commit_id;
+	uint32_t limit = LAST_COMMITS_UNRESOLVED;
+	const struct last_commit *results;
+	size_t i, count;
+
+	rb_scan_args(argc, argv, "11:", &rb_commit, &rb_prefix, &rb_options);
+
+	Data_Get_Struct(self, git_tree, tree);
+	Data_Get_Struct(rb_repo, git_repository, repo);
+
+	if (!NIL_P(rb_prefix)) {
+		Check_Type(rb_prefix, T_STRING);
+		if (RSTRING_LEN(rb_prefix) == 0)
+			rb_prefix = Qnil;
+	}
+
+	if (!NIL_P(rb_options)) {
+		VALUE rb_value = rb_hash_aref(rb_options, CSTR2SYM("limit_depth"));
+
+		if (!NIL_P(rb_value)) {
+			long depth = NUM2LONG(rb_value);
+
+			if (depth <= 0)
+				rb_raise(rb_eArgError, "limit_depth must be positive");
+			if ((unsigned long)depth < LAST_COMMITS_UNRESOLVED)
+				limit = (uint32_t)depth;
+		}
+	}
+
+	rugged_exception_check(rugged_oid_get(&commit_id, repo, rb_commit));
+
+	rb_walk = last_commits_cached(rb_repo, repo, tree, &commit_id, rb_prefix, limit);
+	results = (const struct last_commit *)(RSTRING_PTR(rb_walk) + sizeof(struct last_commits_header));
+
+	rb_result = rb_hash_new();
+	rb_commits = rb_hash_new();
+	count = git_tree_entrycount(tree);
+
+	for (i = 0; i < count; ++i) {
+		VALUE rb_name = rb_str_new_utf8(git_tree_entry_name(git_tree_entry_byindex(tree, i)));
+		VALUE rb_last = Qnil;
+
+		if (results[i].depth < limit) {
+			VALUE rb_oid = rugged_create_oid(&results[i].commit);
+
+			rb_last = rb_hash_aref(rb_commits, rb_oid);
+			if (NIL_P(rb_last)) {
+				git_commit *commit;
+
+				rugged_exception_check(git_commit_lookup(&commit, repo, &results[i].commit));
+				rb_last = rugged_object_new(rb_repo, (git_object *)commit);
+				rb_hash_aset(rb_commits, rb_oid, rb_last);
+			}
+		}
+
+		rb_hash_aset(rb_result, rb_name, rb_last);
+	}
+
+	RB_GC_GUARD(rb_walk);
+	return rb_result;
+}
+
+void Init_rugged_tree_last_commits(void)
+{
+	rb_define_method(rb_cRuggedTree, "last_commits", rb_git_tree_last_commits, -1);
+}
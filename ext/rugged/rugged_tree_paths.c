@@ -0,0 +1,811 @@
+/*
+ * The MIT License
+ *
+ * Copyright (c) 2014 GitHub, Inc
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "rugged.h"
+
+extern VALUE rb_cRuggedTree;
+
+struct path_match {
+	uint32_t target;
+	char *path;
+};
+
+/* The matches inside one subtree, with paths relative to it */
+struct path_list {
+	git_oid tree;
+	struct path_match *items;
+	size_t nr, alloc;
+};
+
+struct paths_finder {
+	git_repository *repo;
+	git_tree *tree;
+
+	/* the OIDs we look for, sorted */
+	git_oid *targets;
+	size_t nr_targets;
+
+	/* every subtree seen so far, open-addressing table of indexes + 1 */
+	struct path_list *lists;
+	size_t nr_lists, alloc_lists;
+	uint32_t *table;
+	size_t table_size;
+
+	struct path_list result;
+	volatile int interrupted;
+	int error;
+};
+
+static inline size_t paths_hash(const git_oid *oid)
+{
+	/* OIDs are already uniformly distributed */
+	return ((size_t)oid->id[0] << 24) | ((size_t)oid->id[1] << 16) |
+		((size_t)oid->id[2] << 8) | (size_t)oid->id[3];
+}
+
+static int paths_oid_cmp(const void *a, const void *b)
+{
+	return git_oid_cmp(a, b);
+}
+
+static int paths_target(const struct paths_finder *pf, const git_oid *oid)
+{
+	const git_oid *found = bsearch(oid, pf->targets, pf->nr_targets, sizeof(git_oid), paths_oid_cmp);
+	return found ? (int)(found - pf->targets) : -1;
+}
+
+static void path_list_clear(struct path_list *list)
+{
+	size_t i;
+
+	for (i = 0; i < list->nr; ++i)
+		free(list->items[i].path);
+	free(list->items);
+	list->items = NULL;
+	list->nr = list->alloc = 0;
+}
+
+static int path_list_add(struct path_list *list, uint32_t target, const char *prefix, const char *path)
+{
+	size_t prefix_len = prefix ? strlen(prefix) : 0, path_len = strlen(path);
+	char *full;
+
+	if (list->nr == list->alloc) {
+		size_t alloc = list->alloc ? list->alloc * 2 : 8;
+		struct path_match *items = realloc(list->items, alloc * sizeof(struct path_match));
+
+		if (items == NULL)
+			goto oom;
+		list->items = items;
+		list->alloc = alloc;
+	}
+
+	if ((full = malloc(prefix_len + 1 + path_len + 1)) == NULL)
+		goto oom;
+
+	if (prefix) {
+		memcpy(full, prefix, prefix_len);
+		full[prefix_len] = '/';
+		memcpy(full + prefix_len + 1, path, path_len + 1);
+	} else {
+		memcpy(full, path, path_len + 1);
+	}
+
+	list->items[list->nr].target = target;
+	list->items[list->nr].path = full;
+	list->nr++;
+	return 0;
+
+oom:
+	giterr_set_oom();
+	return -1;
+}
+
+static struct path_list *paths_seen(struct paths_finder *pf, const git_oid *tree)
+{
+	size_t i, mask = pf->table_size - 1;
+
+	if (pf->table_size == 0)
+		return NULL;
+
+	for (i = paths_hash(tree) & mask; pf->table[i]; i = (i + 1) & mask) {
+		if (git_oid_equal(&pf->lists[pf->table[i] - 1].tree, tree))
+			return &pf->lists[pf->table[i] - 1];
+	}
+
+	return NULL;
+}
+
+/* Remember the matches of +list+; the list is moved into the finder */
+static int paths_remember(struct paths_finder *pf, struct path_list *list)
+{
+	size_t i, mask;
+
+	if (pf->nr_lists == pf->alloc_lists) {
+		size_t alloc = pf->alloc_lists ? pf->alloc_lists * 2 : 64;
+		struct path_list *lists = realloc(pf->lists, alloc * sizeof(struct path_list));
+
+		if (lists == NULL)
+			goto oom;
+		pf->lists = lists;
+		pf->alloc_lists = alloc;
+	}
+
+	/* Keep the table at most half full */
+	if ((pf->nr_lists + 1) * 2 > pf->table_size) {
+		size_t size = pf->table_size ? pf->table_size * 2 : 128;
+		uint32_t *table = calloc(size, sizeof(uint32_t));
+
+		if (table == NULL)
+			goto oom;
+
+		free(pf->table);
+		pf->table = table;
+		pf->table_size = size;
+
+		mask = size - 1;
+		for (i = 0; i < pf->nr_lists; ++i) {
+			size_t slot = paths_hash(&pf->lists[i].tree) & mask;
+			while (table[slot])
+				slot = (slot + 1) & mask;
+			table[slot] = (uint32_t)(i + 1);
+		}
+	}
+
+	pf->lists[pf->nr_lists] = *list;
+
+	mask = pf->table_size - 1;
+	i = paths_hash(&list->tree) & mask;
+	while (pf->table[i])
+		i = (i + 1) & mask;
+	pf->table[i] = (uint32_t)++pf->nr_lists;
+
+	return 0;
+
+oom:
+	path_list_clear(list);
+	giterr_set_oom();
+	return -1;
+}
+
+/*
+ * Collect the matches in +tree+ into +out+. A subtree that appears in
+ * several places is only read once: its matches are remembered by OID
+ * and prefixed with each of its paths.
+ */
+static int paths_find(struct paths_finder *pf, const git_tree *tree, struct path_list *out)
+{
+	size_t i, j, count = git_tree_entrycount(tree);
+	int error = GIT_OK;
+
+	for (i = 0; i < count && error == GIT_OK; ++i) {
+		const git_tree_entry *entry = git_tree_entry_byindex(tree, i);
+		const git_oid *id = git_tree_entry_id(entry);
+		const char *name = git_tree_entry_name(entry);
+		const struct path_list *sub;
+		int target = paths_target(pf, id);
+
+		if (target >= 0 && path_list_add(out, (uint32_t)target, NULL, name) < 0)
+			return GIT_ERROR;
+
+		if (git_tree_entry_type(entry) != GIT_OBJ_TREE)
+			continue;
+
+		if ((sub = paths_seen(pf, id)) == NULL) {
+			struct path_list list;
+			git_tree *subtree;
+
+			if (pf->interrupted)
+				return GIT_EUSER;
+
+			memset(&list, 0, sizeof(list));
+			git_oid_cpy(&list.tree, id);
+
+			if ((error = git_tree_lookup(&subtree, pf->repo, id)) < 0)
+				return error;
+
+			error = paths_find(pf, subtree, &list);
+			git_tree_free(subtree);
+
+			if (error < 0) {
+				path_list_clear(&list);
+				return error;
+			}
+			if (paths_remember(pf, &list) < 0)
+				return GIT_ERROR;
+
+			sub = &pf->lists[pf->nr_lists - 1];
+		}
+
+		for (j = 0; j < sub->nr && error == GIT_OK; ++j) {
+			if (path_list_add(out, sub->items[j].target, name, sub->items[j].path) < 0)
+				error = GIT_ERROR;
+		}
+	}
+
+	return error;
+}
+
+static void paths_finder_reset(struct paths_finder *pf)
+{
+	size_t i;
+
+	for (i = 0; i < pf->nr_lists; ++i)
+		path_list_clear(&pf->lists[i]);
+	pf->nr_lists = 0;
+
+	if (pf->table)
+		memset(pf->table, 0, pf->table_size * sizeof(uint32_t));
+
+	path_list_clear(&pf->result);
+}
+
+static void *paths_finder_run(void *payload)
+{
+	struct paths_finder *pf = payload;
+
+	pf->error = paths_find(pf, pf->tree, &pf->result);
+	return NULL;
+}
+
+static void paths_finder_interrupt(void *payload)
+{
+	((struct paths_finder *)payload)->interrupted = 1;
+}
+
+static VALUE paths_finder_check_ints(VALUE unused)
+{
+	rb_thread_check_ints();
+	return Qnil;
+}
+
+/*
+ *  call-seq:
+ *    tree.paths_for_oids(oids) -> hash
+ *
+ *  Find every path where each of the given +oids+ appears in the tree
+ *  and its subtrees. Returns a Hash from each OID to the Array of its
+ *  paths, in tree order; OIDs that don't appear map to an empty Array.
+ *  Both blob and tree OIDs can be looked for.
+ *
+ *    tree.paths_for_oids(["d8786bfc97485e8d7b19b21fb88c8ef1f199fc3f"])
+ *    #=> {"d8786bfc97485e8d7b19b21fb88c8ef1f199fc3f" => ["foo.txt", "vendor/foo.txt"]}
+ *
+ *  The tree is traversed once, without holding the GVL, and a subtree
+ *  that appears in several places (by OID) is only read the first time.
+ */
+static VALUE rb_git_tree_paths_for_oids(VALUE self, VALUE rb_oids)
+{
+	struct paths_finder pf;
+	VALUE rb_repo = rugged_owner(self), rb_result = Qnil;
+	VALUE *rb_paths;
+	size_t i, nr;
+	int exception = 0;
+
+	Check_Type(rb_oids, T_ARRAY);
+	for (i = 0; i < (size_t)RARRAY_LEN(rb_oids); ++i) {
+		VALUE rb_oid = rb_ary_entry(rb_oids, i);
+		git_oid oid;
+
+		Check_Type(rb_oid, T_STRING);
+		if (RSTRING_LEN(rb_oid) != GIT_OID_HEXSZ || git_oid_fromstr(&oid, RSTRING_PTR(rb_oid)) < 0)
+			rb_raise(rb_eArgError, "invalid OID: %s", StringValueCStr(rb_oid));
+	}
+
+	memset(&pf, 0, sizeof(pf));
+	Data_Get_Struct(self, git_tree, pf.tree);
+	Data_Get_Struct(rb_repo, git_repository, pf.repo);
+
+	nr = RARRAY_LEN(rb_oids);
+	pf.targets = xmalloc((nr ? nr : 1) * sizeof(git_oid));
+	for (i = 0; i < nr; ++i)
+		git_oid_fromstr(&pf.targets[i], RSTRING_PTR(rb_ary_entry(rb_oids, i)));
+
+	qsort(pf.targets, nr, sizeof(git_oid), paths_oid_cmp);
+	for (i = 0; i < nr; ++i) {
+		if (pf.nr_targets == 0 || !git_oid_equal(&pf.targets[pf.nr_targets - 1], &pf.targets[i]))
+			git_oid_cpy(&pf.targets[pf.nr_targets++], &pf.targets[i]);
+	}
+
+	for (;;) {
+		pf.interrupted = 0;
+		rugged_without_gvl(paths_finder_run, &pf, paths_finder_interrupt, &pf);
+
+		if (pf.error != GIT_EUSER || !pf.interrupted)
+			break;
+
+		/* Raise if there's a pending exception, start over otherwise */
+		rb_protect(paths_finder_check_ints, Qnil, &exception);
+		if (exception)
+			break;
+
+		paths_finder_reset(&pf);
+	}
+
+	if (!exception && pf.error == GIT_OK) {
+		rb_result = rb_hash_new();
+		rb_paths = xmalloc((pf.nr_targets ? pf.nr_targets : 1) * sizeof(VALUE));
+
+		for (i = 0; i < pf.nr_targets; ++i) {
+			rb_paths[i] = rb_ary_new();
+			rb_hash_aset(rb_result, rugged_create_oid(&pf.targets[i]), rb_paths[i]);
+		}
+		for (i = 0; i < pf.result.nr; ++i)
+			rb_ary_push(rb_paths[pf.result.items[i].target], rb_str_new_utf8(pf.result.items[i].path));
+
+		xfree(rb_paths);
+	}
+
+	paths_finder_reset(&pf);
+	free(pf.lists);
+	free(pf.table);
+	xfree(pf.targets);
+	RB_GC_GUARD(rb_repo);
+
+	if (exception)
+		rb_jump_tag(exception);
+	rugged_exception_check(pf.error);
+
+	return rb_result;
+}
+
+/* The literal part of a pathspec pattern, for pruning directories */
+struct walk_prefix {
+	char *str;
+	size_t len;
+	int wild;
+};
+
+struct walk_frame {
+	git_tree *tree;
+	size_t index, count;
+	size_t path_len;
+	int depth;
+};
+
+struct paths_walker {
+	git_repository *repo;
+	git_pathspec *pathspec;
+	struct walk_prefix *prefixes;
+	size_t nr_prefixes;
+
+	unsigned int types;
+	int max_depth;
+	size_t batch;
+
+	struct walk_frame *stack;
+	size_t nr_frames, alloc_frames;
+
+	char *path;
+	size_t path_alloc;
+
+	/* the current batch: NUL-terminated paths packed into one buffer */
+	char *out;
+	size_t out_len, out_alloc;
+	size_t nr_out;
+
+	volatile int interrupted;
+	int error;
+};
+
+static int walk_grow(char **buf, size_t *alloc, size_t needed)
+{
+	size_t new_alloc = *alloc ? *alloc : 256;
+	char *new_buf;
+
+	if (needed <= *alloc)
+		return 0;
+
+	while (new_alloc < needed)
+		new_alloc *= 2;
+
+	if ((new_buf = realloc(*buf, new_alloc)) == NULL) {
+		giterr_set_oom();
+		return -1;
+	}
+
+	*buf = new_buf;
+	*alloc = new_alloc;
+	return 0;
+}
+
+static void walk_prefix_init(struct walk_prefix *prefix, const char *pattern)
+{
+	size_t len = strcspn(pattern, "*?[\\");
+
+	prefix->wild = pattern[len] != '\0';
+
+	/* A rooted or empty pattern could match anywhere; never prune on it */
+	if (pattern[0] == '/' || pattern[0] == '\0') {
+		len = 0;
+		prefix->wild = 1;
+	}
+
+	if (!prefix->wild) {
+		while (len > 0 && pattern[len - 1] == '/')
+			len--;
+	}
+
+	prefix->str = xmalloc(len + 1);
+	memcpy(prefix->str, pattern, len);
+	prefix->str[len] = '\0';
+	prefix->len = len;
+}
+
+/*
+ * Whether anything below the directory +path+ (of length +len+, and
+ * followed by a '/') can be matched by one of the patterns. Wildcards match across slashes, so
+ * only the literal part of each pattern can rule a directory out.
+ */
+static int walk_may_match(const struct paths_walker *w, const char *path, size_t len)
+{
+	size_t i;
+
+	if (!w->pathspec)
+		return 1;
+
+	for (i = 0; i < w->nr_prefixes; ++i) {
+		const struct walk_prefix *prefix = &w->prefixes[i];
+
+		if (prefix->wild) {
+			size_t n = prefix->len < len + 1 ? prefix->len : len + 1;
+
+			if (memcmp(prefix->str, path, n) == 0)
+				return 1;
+		} else if (prefix->len > len) {
+			if (memcmp(prefix->str, path, len) == 0 && prefix->str[len] == '/')
+				return 1;
+		} else {
+			if (memcmp(prefix->str, path, prefix->len) == 0 &&
+				(prefix->len == len || path[prefix->len] == '/'))
+				return 1;
+		}
+	}
+
+	return 0;
+}
+
+static int walk_emit(struct paths_walker *w, const char *path, size_t len)
+{
+	if (walk_grow(&w->out, &w->out_alloc, w->out_len + len + 1) < 0)
+		return -1;
+
+	memcpy(w->out + w->out_len, path, len + 1);
+	w->out_len += len + 1;
+	w->nr_out++;
+	return 0;
+}
+
+static int walk_push(struct paths_walker *w, git_tree *tree, size_t path_len, int depth)
+{
+	struct walk_frame *frame;
+
+	if (w->nr_frames == w->alloc_frames) {
+		size_t alloc = w->alloc_frames ? w->alloc_frames * 2 : 16;
+		struct walk_frame *stack = realloc(w->stack, alloc * sizeof(struct walk_frame));
+
+		if (stack == NULL) {
+			giterr_set_oom();
+			return -1;
+		}
+		w->stack = stack;
+		w->alloc_frames = alloc;
+	}
+
+	frame = &w->stack[w->nr_frames++];
+	frame->tree = tree;
+	frame->index = 0;
+	frame->count = git_tree_entrycount(tree);
+	frame->path_len = path_len;
+	frame->depth = depth;
+	return 0;
+}
+
+static void walk_pop(struct paths_walker *w)
+{
+	/* The root frame is the Ruby object's tree; it's not ours to free */
+	if (--w->nr_frames > 0)
+		git_tree_free(w->stack[w->nr_frames].tree);
+}
+
+/*
+ * Walk the tree in preorder until the batch is full or the walk is
+ * done. All the state lives in the walker, so the walk can be resumed
+ * after yielding the batch or after an interrupt.
+ */
+static int walk_step(struct paths_walker *w)
+{
+	while (w->nr_frames > 0 && w->nr_out < w->batch) {
+		struct walk_frame *frame = &w->stack[w->nr_frames - 1];
+		const git_tree_entry *entry;
+		const char *name;
+		size_t path_len, name_len;
+		git_otype type;
+		int depth;
+
+		if (frame->index == frame->count) {
+			walk_pop(w);
+			continue;
+		}
+
+		if (w->interrupted)
+			return GIT_EUSER;
+
+		entry = git_tree_entry_byindex(frame->tree, frame->index++);
+		name = git_tree_entry_name(entry);
+		name_len = strlen(name);
+		type = git_tree_entry_type(entry);
+		depth = frame->depth;
+
+		/* Leave room for the '/' of a subtree */
+		path_len = frame->path_len + name_len;
+		if (walk_grow(&w->path, &w->path_alloc, path_len + 2) < 0)
+			return GIT_ERROR;
+		memcpy(w->path + frame->path_len, name, name_len + 1);
+
+		if (type > 0 && (w->types & (1u << type)) &&
+			(!w->pathspec || git_pathspec_matches_path(w->pathspec, 0, w->path)) &&
+			walk_emit(w, w->path, path_len) < 0)
+			return GIT_ERROR;
+
+		if (type != GIT_OBJ_TREE || (w->max_depth >= 0 && depth >= w->max_depth))
+			continue;
+
+		w->path[path_len] = '/';
+		w->path[path_len + 1] = '\0';
+
+		if (walk_may_match(w, w->path, path_len)) {
+			git_tree *subtree;
+			int error;
+
+			if ((error = git_tree_lookup(&subtree, w->repo, git_tree_entry_id(entry))) < 0)
+				return error;
+
+			if (walk_push(w, subtree, path_len + 1, depth + 1) < 0) {
+				git_tree_free(subtree);
+				return GIT_ERROR;
+			}
+		}
+	}
+
+	return GIT_OK;
+}
+
+static void *paths_walker_run(void *payload)
+{
+	struct paths_walker *w = payload;
+
+	w->error = walk_step(w);
+	return NULL;
+}
+
+static void paths_walker_interrupt(void *payload)
+{
+	((struct paths_walker *)payload)->interrupted = 1;
+}
+
+static unsigned int walk_parse_type(VALUE rb_type)
+{
+	ID id_type;
+
+	Check_Type(rb_type, T_SYMBOL);
+	id_type = SYM2ID(rb_type);
+
+	if (id_type == rb_intern("blob"))
+		return 1u << GIT_OBJ_BLOB;
+	if (id_type == rb_intern("tree"))
+		return 1u << GIT_OBJ_TREE;
+	if (id_type == rb_intern("commit"))
+		return 1u << GIT_OBJ_COMMIT;
+
+	rb_raise(rb_eArgError, "Invalid type. Expected `:blob`, `:tree` or `:commit`");
+}
+
+static void paths_walker_parse_options(struct paths_walker *w, VALUE rb_options)
+{
+	VALUE rb_value;
+
+	w->types = (1u << GIT_OBJ_BLOB) | (1u << GIT_OBJ_TREE) | (1u << GIT_OBJ_COMMIT);
+	w->max_depth = -1;
+	w->batch = 1000;
+
+	if (NIL_P(rb_options))
+		return;
+
+	rb_value = rb_hash_aref(rb_options, CSTR2SYM("types"));
+	if (!NIL_P(rb_value)) {
+		if (TYPE(rb_value) == T_ARRAY) {
+			long i;
+
+			w->types = 0;
+			for (i = 0; i < RARRAY_LEN(rb_value); ++i)
+				w->types |= walk_parse_type(rb_ary_entry(rb_value, i));
+		} else {
+			w->types = walk_parse_type(rb_value);
+		}
+	}
+
+	rb_value = rb_hash_aref(rb_options, CSTR2SYM("max_depth"));
+	if (!NIL_P(rb_value)) {
+		w->max_depth = NUM2INT(rb_value);
+		if (w->max_depth < 0)
+			rb_raise(rb_eArgError, "max_depth must not be negative");
+	}
+
+	rb_value = rb_hash_aref(rb_options, CSTR2SYM("batch"));
+	if (!NIL_P(rb_value)) {
+		long batch = NUM2LONG(rb_value);
+		if (batch <= 0)
+			rb_raise(rb_eArgError, "batch must be positive");
+		w->batch = (size_t)batch;
+	}
+}
+
+static void paths_walker_free(struct paths_walker *w)
+{
+	size_t i;
+
+	while (w->nr_frames > 0)
+		walk_pop(w);
+
+	for (i = 0; i < w->nr_prefixes; ++i)
+		xfree(w->prefixes[i].str);
+	xfree(w->prefixes);
+
+	git_pathspec_free(w->pathspec);
+	free(w->stack);
+	free(w->path);
+	free(w->out);
+}
+
+/*
+ *  call-seq:
+ *    tree.walk_paths(options = {}) { |paths| block }
+ *    tree.walk_paths(options = {}) -> enumerator
+ *
+ *  Walk +tree+ and all its subtrees in preorder and yield the full paths
+ *  of the matching entries to +block+, in Arrays of up to +:batch+ paths.
+ *
+ *  The following options can be passed in the +options+ Hash:
+ *
+ *  :pathspec ::
+ *    A String or Array of Strings with the pathspecs (globs) to match
+ *    the paths against. Directories that cannot contain a match are
+ *    not descended into. All paths match when not given.
+ *
+ *  :types ::
+ *    A Symbol or Array of Symbols, from +:blob+, +:tree+ and +:commit+,
+ *    with the types of the entries to yield. Defaults to all of them.
+ *
+ *  :max_depth ::
+ *    How many levels of subtrees to descend into; +0+ only looks at the
+ *    entries of +tree+ itself. Unlimited by default.
+ *
+ *  :batch ::
+ *    The largest number of paths to yield at once. Defaults to 1000.
+ *
+ *    tree.walk_paths(pathspec: "lib/*.rb", types: :blob) { |paths| puts paths }
+ *
+ *  generates:
+ *
+ *    lib/rugged.rb
+ *    lib/rugged/blob.rb
+ *    ...
+ *
+ *  The tree is walked without holding the GVL between batches.
+ */
+static VALUE rb_git_tree_walk_paths(int argc, VALUE *argv, VALUE self)
+{
+	struct paths_walker w;
+	VALUE rb_options, rb_pathspec = Qnil, rb_repo = rugged_owner(self);
+	git_tree *tree;
+	int error = GIT_OK, exception = 0;
+
+	RETURN_ENUMERATOR(self, argc, argv);
+	rb_scan_args(argc, argv, "00:", &rb_options);
+
+	memset(&w, 0, sizeof(w));
+	paths_walker_parse_options(&w, rb_options);
+
+	if (!NIL_P(rb_options))
+		rb_pathspec = rb_hash_aref(rb_options, CSTR2SYM("pathspec"));
+
+	if (!NIL_P(rb_pathspec)) {
+		git_strarray pathspec;
+		size_t i;
+
+		rugged_rb_ary_to_strarray(rb_pathspec, &pathspec);
+		error = git_pathspec_new(&w.pathspec, &pathspec);
+
+		if (!error) {
+			w.prefixes = xcalloc(pathspec.count ? pathspec.count : 1, sizeof(struct walk_prefix));
+
+			/* Negative patterns only exclude paths; they don't need a descent */
+			for (i = 0; i < pathspec.count; ++i) {
+				if (pathspec.strings[i][0] != '!')
+					walk_prefix_init(&w.prefixes[w.nr_prefixes++], pathspec.strings[i]);
+			}
+		}
+
+		xfree(pathspec.strings);
+		rugged_exception_check(error);
+	}
+
+	Data_Get_Struct(self, git_tree, tree);
+	Data_Get_Struct(rb_repo, git_repository, w.repo);
+
+	if (walk_push(&w, tree, 0, 0) < 0)
+		w.error = GIT_ERROR;
+
+	while (w.error == GIT_OK) {
+		w.interrupted = 0;
+		rugged_without_gvl(paths_walker_run, &w, paths_walker_interrupt, &w);
+
+		if (w.error == GIT_EUSER && w.interrupted) {
+			/* Raise if there's a pending exception, carry on otherwise */
+			w.error = GIT_OK;
+			rb_protect(paths_finder_check_ints, Qnil, &exception);
+			if (exception)
+				break;
+			continue;
+		}
+
+		if (w.error == GIT_OK && w.nr_out > 0) {
+			VALUE rb_paths = rb_ary_new2(w.nr_out);
+			const char *path = w.out;
+			size_t i;
+
+			for (i = 0; i < w.nr_out; ++i) {
+				size_t len = strlen(path);
+				rb_ary_push(rb_paths, rb_enc_str_new(path, len, rb_utf8_encoding()));
+				path += len + 1;
+			}
+			w.out_len = w.nr_out = 0;
+
+			rb_protect(rb_yield, rb_paths, &exception);
+			if (exception)
+				break;
+		}
+
+		if (w.nr_frames == 0)
+			break;
+	}
+
+	error = w.error;
+	paths_walker_free(&w);
+	RB_GC_GUARD(self);
+	RB_GC_GUARD(rb_repo);
+
+	if (exception)
+		rb_jump_tag(exception);
+	rugged_exception_check(error);
+
+	return Qnil;
+}
+
+void Init_rugged_tree_paths(void)
+{
+	rb_define_method(rb_cRuggedTree, "paths_for_oids", rb_git_tree_paths_for_oids, 1);
+	rb_define_method(rb_cRuggedTree, "walk_paths", rb_git_tree_walk_paths, -1);
+}
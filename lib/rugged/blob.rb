@@ -4,6 +4,14 @@ module Rugged
       WHITESPACE_DEFAULT  = 0
       WHITESPACE_IGNORE   = 1
       WHITESPACE_SMART    = 2
+
+      def _dump(level)
+        dump
+      end
+
+      def self._load(data)
+        load(data)
+      end
     end
 
     def hashsig(options = 0)
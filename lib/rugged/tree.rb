@@ -34,5 +34,40 @@ module Rugged
     def each_tree
       self.each { |e| yield e if e[:type] == :tree }
     end
+
+    # Tree entries used to be plain Hashes. The Hash methods callers relied
+    # on to read them are kept and answer from #to_h; the ones that would
+    # modify an entry are not, since entries are frozen.
+    class Entry
+      def fetch(*args, &block)
+        to_h.fetch(*args, &block)
+      end
+
+      def key?(key)
+        to_h.key?(key)
+      end
+      alias has_key? key?
+      alias include? key?
+      alias member? key?
+
+      def keys
+        to_h.keys
+      end
+
+      def values
+        to_h.values
+      end
+
+      def each(&block)
+        return to_enum(:each) unless block
+        to_h.each(&block)
+        self
+      end
+      alias each_pair each
+
+      def inspect
+        "#<#{self.class.name} #{to_h.inspect}>"
+      end
+    end
   end
 end
@@ -1,4 +1,5 @@
 require "test_helper"
+require "stringio"
 
 class BlobTest < Rugged::TestCase
   def setup
@@ -122,6 +123,28 @@ class BlobTest < Rugged::TestCase
     blob = @repo.lookup(oid)
     assert_equal Encoding::ASCII_8BIT, blob.text(0, Encoding::ASCII_8BIT).encoding
   end
+
+  def test_to_buffers
+    readme = "7771329dfa3002caf8c61a0ceb62a31d09023f37"
+    small = "fa49b077972391ad58037050f2a75f74e3671e92"
+    commit = "8496071c1b46c854b31185ea97743be6a8774479"
+    missing = "1" * 40
+
+    buffers = Rugged::Blob.to_buffers(@repo, [small, missing, readme, commit, small])
+    assert_equal 5, buffers.size
+    assert_equal Rugged::Blob.to_buffer(@repo, small), buffers[0]
+    assert_nil buffers[1]
+    assert_equal Rugged::Blob.to_buffer(@repo, readme), buffers[2]
+    assert_nil buffers[3]
+    assert_equal buffers[0], buffers[4]
+
+    content, size = Rugged::Blob.to_buffers(@repo, [readme], max_bytes: 10)[0]
+    assert_equal @repo.lookup(readme).content(10), content
+    assert_equal @repo.lookup(readme).size, size
+
+    assert_equal [], Rugged::Blob.to_buffers(@repo, [])
+    assert_raises(ArgumentError) { Rugged::Blob.to_buffers(@repo, ["abc"]) }
+  end
 end
 
 class BlobWriteTest < Rugged::TestCase
@@ -173,6 +196,25 @@ class BlobWriteTest < Rugged::TestCase
     text_blob = @repo.lookup(Rugged::Blob.from_disk(@repo, text_file_path))
     refute text_blob.binary?
   end
+
+  def test_hash_files
+    big = "x" * 100_000 + "\n"
+    File.binwrite(File.join(@repo.workdir, "big.txt"), big)
+    archive = File.join(TEST_DIR, "fixtures", "archive.tar.gz")
+
+    oids = @repo.hash_files(["README", "big.txt", archive], write: false)
+    assert_equal '1385f264afb75a56a5bec74243be9b367ba4ca08', oids["README"]
+    assert_equal Rugged::Repository.hash_data(big, :blob), oids["big.txt"]
+    assert_equal Rugged::Repository.hash_file(archive, :blob), oids[archive]
+    refute @repo.exists?(oids["big.txt"])
+
+    assert_equal oids, @repo.hash_files(["README", "big.txt", archive])
+    assert_equal big, @repo.lookup(oids["big.txt"]).content
+    assert_equal({}, @repo.hash_files([]))
+
+    error = assert_raises(SystemCallError) { @repo.hash_files(["README", "missing.txt"]) }
+    assert_match "missing.txt", error.message
+  end
 end
 
 class BlobLOCTest < Rugged::TestCase
@@ -214,6 +256,117 @@ class BlobLOCTest < Rugged::TestCase
     blob = write_blob("hello\nworld\rwhat")
     assert_equal 3, blob.loc
   end
+
+  def test_text_stats
+    blob = write_blob("hello\n\n  \nworld, how are you doing\r\nwhat")
+    stats = blob.text_stats
+
+    assert_equal blob.loc, stats[:loc]
+    assert_equal blob.sloc, stats[:sloc]
+    assert_equal false, stats[:binary]
+    assert_equal :mixed, stats[:line_endings]
+    assert_equal 24, stats[:longest_line]
+    assert_equal Encoding::US_ASCII, stats[:encoding]
+
+    stats = write_blob("h\u00e9llo\r\nw\u00f6rld\r\n").text_stats
+    assert_equal :crlf, stats[:line_endings]
+    assert_equal Encoding::UTF_8, stats[:encoding]
+
+    assert_equal Encoding::ASCII_8BIT, write_blob("caf\xe9\n".b).text_stats[:encoding]
+    assert_nil write_blob("").text_stats[:line_endings]
+  end
+
+  def test_each_chunk
+    content = "0123456789" * 1000
+    blob = write_blob(content)
+
+    chunks = blob.each_chunk(4096).to_a
+    assert_equal [4096, 4096, 1808], chunks.map(&:bytesize)
+    assert_equal content, chunks.join
+    assert_equal Encoding::ASCII_8BIT, chunks[0].encoding
+    assert_equal [content], blob.each_chunk.to_a
+
+    assert_raises(ArgumentError) { blob.each_chunk(0) { } }
+  end
+
+  def test_write_to
+    content = "hello world\n" * 10000
+    blob = write_blob(content)
+
+    io = StringIO.new("".b)
+    assert_equal content.bytesize, blob.write_to(io, 1000)
+    assert_equal content, io.string
+
+    Tempfile.open("rugged-blob") do |file|
+      file.binmode
+      file.write("header\n")
+      assert_equal content.bytesize, blob.write_to(file)
+      file.flush
+      assert_equal "header\n" + content, File.binread(file.path)
+    end
+
+    Dir.mktmpdir("rugged-blob") do |dir|
+      path = File.join(dir, "blob")
+      File.open(path, "wb") do |file|
+        file.write("header\n")
+        assert_equal content.bytesize, blob.write_to(file, 1000)
+      end
+      assert_equal "header\n" + content, File.binread(path)
+    end
+  end
+
+  def test_write_to_pipe
+    # Larger than a pipe buffer, so the writes block (or return EAGAIN)
+    content = "0123456789abcdef" * 64 * 1024
+    blob = write_blob(content)
+
+    reader, writer = IO.pipe
+    read = Thread.new { reader.binmode.read }
+    assert_equal content.bytesize, blob.write_to(writer)
+    writer.close
+    assert_equal content, read.value
+  ensure
+    reader.close if reader && !reader.closed?
+    writer.close if writer && !writer.closed?
+  end
+
+  def test_loc_and_sloc_of_long_lines
+    content = ("x" * 100 + "\n\n") * 1000
+    blob = write_blob(content)
+    assert_equal 2000, blob.loc
+    assert_equal 1000, blob.sloc
+    assert_equal 100, blob.text_stats[:longest_line]
+  end
+
+  def test_line_index_and_lines
+    blob = write_blob("one\ntwo\n\nfour\nfive")
+    index = blob.line_index
+
+    assert index.frozen?
+    assert_equal [0, 4, 8, 9, 14, 18], index.unpack("V*")
+    assert_same index, @repo.lookup(blob.oid).line_index
+
+    assert_equal "one\n", blob.lines(1, 1)
+    assert_equal "two\n\nfour\n", blob.lines(2, 4)
+    assert_equal "four\nfive", blob.lines(4, 100)
+    assert_equal "", blob.lines(3, 2)
+    assert_nil blob.lines(6, 7)
+    assert_equal "five", @repo.lookup(blob.oid).lines(5, 5, index)
+
+    assert_equal [0, 6], write_blob("trail\n").line_index.unpack("V*")
+    assert_equal [0], write_blob("").line_index.unpack("V*")
+
+    # Lines end in LF, CRLF or a bare CR, like for Blob#loc
+    mixed = write_blob("a\rb\r\nc\nd")
+    assert_equal 4, mixed.loc
+    assert_equal [0, 2, 5, 7, 8], mixed.line_index.unpack("V*")
+    assert_equal "b\r\nc\n", mixed.lines(2, 3)
+    cr = write_blob("a\rb\r")
+    assert_equal cr.loc + 1, cr.line_index.unpack("V*").length
+
+    assert_raises(ArgumentError) { blob.lines(0, 1) }
+    assert_raises(ArgumentError) { blob.lines(1, 1, [0, 3].pack("V*")) }
+  end
 end
 
 class BlobDiffTest < Rugged::TestCase
@@ -449,4 +602,42 @@ LOREM
     sig2 = Rugged::Blob::HashSignature.new(LOREM.gsub('ipsum', 'epsen'))
     assert Rugged::Blob::HashSignature.compare(sig1, sig2) > 75
   end
+
+  def test_similarity_matrix
+    blob = @repo.lookup("7771329dfa3002caf8c61a0ceb62a31d09023f37")
+    lorem_sig = Rugged::Blob::HashSignature.new(LOREM)
+    epsen = LOREM.gsub('ipsum', 'epsen')
+    expected = Rugged::Blob::HashSignature.compare(lorem_sig, Rugged::Blob::HashSignature.new(epsen))
+
+    matrix = Rugged::Blob::HashSignature.similarity_matrix([lorem_sig, blob], [blob, epsen, "x"], threshold: 75)
+    assert_equal [[0, 1, expected], [1, 0, 100]], matrix
+
+    assert_equal [[0, 2, expected]],
+      Rugged::Blob::HashSignature.similarity_matrix([LOREM, blob, epsen], threshold: 75)
+    assert_equal [], Rugged::Blob::HashSignature.similarity_matrix([], [blob])
+
+    assert_raises(TypeError) { Rugged::Blob::HashSignature.similarity_matrix([1], [blob]) }
+    assert_raises(ArgumentError) { Rugged::Blob::HashSignature.similarity_matrix([blob], threshold: 101) }
+  end
+
+  def test_dump_and_load
+    blob = @repo.lookup("7771329dfa3002caf8c61a0ceb62a31d09023f37")
+    sig = Rugged::Blob::HashSignature.new(blob)
+    lorem = Rugged::Blob::HashSignature.new(LOREM)
+
+    dump = sig.dump
+    assert_equal Encoding::ASCII_8BIT, dump.encoding
+    loaded = Rugged::Blob::HashSignature.load(dump)
+
+    assert_equal dump, loaded.dump
+    assert_equal 100, Rugged::Blob::HashSignature.compare(sig, loaded)
+    assert_equal Rugged::Blob::HashSignature.compare(lorem, sig),
+      Rugged::Blob::HashSignature.compare(lorem, loaded)
+
+    ignore_ws = Rugged::Blob::HashSignature.new(LOREM, Rugged::Blob::HashSignature::WHITESPACE_IGNORE)
+    assert_equal 100, Rugged::Blob::HashSignature.compare(ignore_ws, Marshal.load(Marshal.dump(ignore_ws)))
+
+    assert_raises(ArgumentError) { Rugged::Blob::HashSignature.load("nope") }
+    assert_raises(ArgumentError) { Rugged::Blob::HashSignature.load(dump[0..-2]) }
+  end
 end
@@ -34,6 +34,148 @@ class TestCommit < Rugged::TestCase
     assert_equal stats[2].author[:email], 'schacon@gmail.com'
   end
 
+  def test_commit_stats_from_several_threads
+    commits = %w[8496071c1b46c854b31185ea97743be6a8774479
+                 5b5b025afb0b4c913b4c338a42934a3863bf3644
+                 36060c58702ed4c2a40832c51758d5344201d89a].map { |rev| Rugged::Commit.lookup(@repo, rev) }
+
+    threads = 4.times.map do
+      Thread.new { Rugged::Commit.stats(@repo, commits).map { |s| [s.oid, s.adds, s.dels] } }
+    end
+
+    threads.each do |thread|
+      assert_equal [
+        ['8496071c1b46c854b31185ea97743be6a8774479', 1, 0],
+        ['5b5b025afb0b4c913b4c338a42934a3863bf3644', 1, 0],
+        ['36060c58702ed4c2a40832c51758d5344201d89a', 4, 0]
+      ], thread.value
+    end
+  end
+
+  def test_commit_stats_with_budget
+    commits = %w[5b5b025afb0b4c913b4c338a42934a3863bf3644
+                 36060c58702ed4c2a40832c51758d5344201d89a].map { |rev| Rugged::Commit.lookup(@repo, rev) }
+    stats = Rugged::Commit.stats(@repo, commits, max_lines: 2)
+
+    refute stats[0].truncated?
+    assert_equal 1, stats[0].adds
+    assert stats[1].truncated?
+    assert_equal 2, stats[1].adds
+
+    assert_raises(ArgumentError) { Rugged::Commit.stats(@repo, commits, max_lines: 0) }
+  end
+
+  def test_commit_stats_cache
+    commits = %w[8496071c1b46c854b31185ea97743be6a8774479
+                 5b5b025afb0b4c913b4c338a42934a3863bf3644
+                 36060c58702ed4c2a40832c51758d5344201d89a].map { |rev| Rugged::Commit.lookup(@repo, rev) }
+    expected = Rugged::Commit.stats(@repo, commits).map { |s| [s.oid, s.adds, s.dels, s.files] }
+
+    refute @repo.stats_cache?
+    @repo.stats_cache = true
+    assert @repo.stats_cache?
+
+    assert_equal expected, Rugged::Commit.stats(@repo, commits).map { |s| [s.oid, s.adds, s.dels, s.files] }
+    assert_equal 3, @repo.stats_cache.count
+    assert File.exist?(File.join(@repo.path, "rugged-stats-cache"))
+
+    # A second handle reads the records written by the first one
+    repo = Rugged::Repository.new(@repo.path)
+    repo.stats_cache = true
+    assert_equal 3, repo.stats_cache.count
+    stats = Rugged::Commit.stats(repo, commits.map { |c| Rugged::Commit.lookup(repo, c.oid) })
+    assert_equal expected, stats.map { |s| [s.oid, s.adds, s.dels, s.files] }
+    assert_equal 3, repo.stats_cache.count
+  end
+
+  def test_commit_numstat
+    commits = %w[8496071c1b46c854b31185ea97743be6a8774479
+                 5b5b025afb0b4c913b4c338a42934a3863bf3644
+                 36060c58702ed4c2a40832c51758d5344201d89a].map { |rev| Rugged::Commit.lookup(@repo, rev) }
+    stats = Rugged::Commit.stats(@repo, commits)
+    numstats = Rugged::Commit.numstat(@repo, commits, renames: true)
+
+    assert_equal 3, numstats.length
+    numstats.zip(stats).each do |rows, stat|
+      refute_empty rows
+      assert_equal stat.adds, rows.map { |row| row[3] }.inject(:+)
+      assert_equal stat.dels, rows.map { |row| row[4] }.inject(:+)
+    end
+
+    old_path, new_path, status, adds, dels, binary = numstats[0][0]
+    assert_equal :added, status
+    assert_equal old_path, new_path
+    assert_equal [1, 0, false], [adds, dels, binary]
+  end
+
+  def test_diff_between_repos_pages
+    base = '41bc8c69075bbdb46c5c6f0566cc8cc5b46e8bd9'
+    upstream_head = '36060c58702ed4c2a40832c51758d5344201d89a'
+    upstream = FixtureRepo.from_rugged("testrepo.git")
+    revs = Rugged::Commit.diff_between_repos(@repo, base, upstream, upstream_head)
+    refute_empty revs
+
+    # Give the fork commits the upstream doesn't have, so the comparison
+    # has to search for the fork point
+    signature = { name: "Forker", email: "forker@example.org", time: Time.at(1_400_000_000) }
+    tip = base
+    3.times do |i|
+      parent = Rugged::Commit.lookup(@repo, tip)
+      tip = Rugged::Commit.create(@repo,
+        tree: parent.tree, parents: [parent], author: signature, committer: signature,
+        message: "fork commit #{i}\n")
+      refute upstream.exists?(tip)
+    end
+
+    args = [@repo, tip, upstream, upstream_head]
+    assert_equal revs, Rugged::Commit.diff_between_repos(*args)
+    assert_equal revs.length, Rugged::Commit.diff_between_repos(*args, count_only: true)
+
+    # Repeated and paged comparisons agree with the first one
+    assert_equal revs[1, 2], Rugged::Commit.diff_between_repos(*args, offset: 1, limit: 2)
+    assert_equal revs[revs.length - 1, 5], Rugged::Commit.diff_between_repos(*args, offset: revs.length - 1, limit: 5)
+    assert_equal [], Rugged::Commit.diff_between_repos(*args, offset: revs.length)
+    assert_equal [], Rugged::Commit.diff_between_repos(*args, limit: 0)
+    assert_equal revs, Rugged::Commit.diff_between_repos(*args)
+
+    # Once the upstream has the fork's commits, the fork point is found
+    # there instead of being remembered as missing from an earlier call
+    3.times.inject(tip) do |oid, _|
+      commit = @repo.read(oid)
+      upstream.write(commit.data, commit.type)
+      Rugged::Commit.lookup(@repo, oid).parent_ids.first
+    end
+    assert upstream.exists?(tip)
+    assert_equal revs, Rugged::Commit.diff_between_repos(*args)
+
+    assert_raises(ArgumentError) { Rugged::Commit.diff_between_repos(*args, offset: -1) }
+    assert_raises(ArgumentError) { Rugged::Commit.diff_between_repos(*args, limit: -1) }
+    assert_raises(ArgumentError) { Rugged::Commit.compare_forks(upstream, upstream_head, [[@repo, tip]], limit: -1) }
+  end
+
+  def test_compare_forks
+    upstream = '36060c58702ed4c2a40832c51758d5344201d89a'
+    forks = %w[41bc8c69075bbdb46c5c6f0566cc8cc5b46e8bd9 8496071c1b46c854b31185ea97743be6a8774479]
+    fork_repo = FixtureRepo.from_rugged("testrepo.git")
+
+    results = Rugged::Commit.compare_forks(@repo, upstream, forks.map { |oid| [fork_repo, oid] }, commits: true)
+    assert_equal 2, results.length
+
+    results.zip(forks).each do |result, fork|
+      ahead = Rugged::Walker.new(@repo).tap { |w| w.push(fork); w.hide(upstream) }.map(&:oid)
+      behind = Rugged::Walker.new(@repo).tap { |w| w.push(upstream); w.hide(fork) }.map(&:oid)
+
+      assert_equal ahead.length, result[:ahead]
+      assert_equal behind.length, result[:behind]
+      assert_equal ahead.sort, result[:ahead_commits].sort
+      assert_equal behind.sort, result[:behind_commits].sort
+    end
+
+    results = Rugged::Commit.compare_forks(@repo, upstream, [[fork_repo, forks[0]]], commits: true, limit: 1)
+    assert_operator results[0][:behind_commits].length, :<=, 1
+    refute Rugged::Commit.compare_forks(@repo, upstream, [[fork_repo, forks[0]]])[0].key?(:ahead_commits)
+  end
+
 #   def test_lookup_raises_error_if_object_type_does_not_match
 #     assert_raises Rugged::InvalidError do
 #       # blob
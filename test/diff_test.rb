@@ -1149,4 +1149,28 @@ EOS
       assert_equal expected_lines, patch.lines
     end
   end
+
+  def test_stats_with_budgets
+    repo = FixtureRepo.from_libgit2("diff")
+
+    a = repo.lookup("d70d245ed97ed2aa596dd1af6536e4bfdb047b69")
+    b = repo.lookup("7a9e0b02e63179929fed24f0a3e0f19168114d10")
+
+    diff = a.tree.diff(b.tree)
+
+    assert_equal [2, 7, 14, false], diff.stat_with_budget(max_files: 2, max_lines: 100, max_bytes: 100_000)
+
+    files, adds, dels, truncated = diff.stat_with_budget(max_files: 1)
+    assert_equal 1, files
+    assert truncated
+
+    files, adds, dels, truncated = diff.stat_with_budget(max_lines: 5)
+    assert_equal 5, adds + dels
+    assert truncated
+
+    assert_equal [2, 7, 14, false], diff.stat_with_budget
+    assert_equal [2, 7, 14], diff.stat
+
+    assert_raises(ArgumentError) { diff.stat_with_budget(max_lines: 0) }
+  end
 end
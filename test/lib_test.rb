@@ -39,6 +39,21 @@ class RuggedTest < Rugged::TestCase
     end
   end
 
+  def test_thread_pool_settings
+    Rugged::Settings['thread_pool_size'] = 2
+    assert_equal 2, Rugged::Settings['thread_pool_size']
+
+    assert Rugged::Settings['thread_pool_workers'] >= 0
+    assert_equal 0, Rugged::Settings['thread_pool_busy_workers']
+    assert_equal 0, Rugged::Settings['thread_pool_queue_depth']
+
+    assert_raises(TypeError) { Rugged::Settings['thread_pool_size'] = nil }
+    assert_raises(ArgumentError) { Rugged::Settings['thread_pool_size'] = -1 }
+    assert_equal 2, Rugged::Settings['thread_pool_size']
+  ensure
+    Rugged::Settings['thread_pool_size'] = 0
+  end
+
   def test_features
     features = Rugged.features
     assert features.is_a? Array
@@ -384,6 +384,69 @@ class RepositoryTest < Rugged::TestCase
   end
 end
 
+class CommitGraphTest < Rugged::TestCase
+  def setup
+    @repo = FixtureRepo.from_libgit2 "testrepo.git"
+  end
+
+  def test_write_commit_graph
+    assert_nil @repo.commit_graph
+
+    count = @repo.write_commit_graph
+    assert_equal count, @repo.commit_graph.count
+    assert File.exist?(File.join(@repo.path, "objects/info/rugged-commit-graph"))
+
+    assert @repo.commit_graph.include?("a65fedf39aefe402d3bb6e24df4d4f5fe4547750")
+    refute @repo.commit_graph.include?("deadbeef" * 5)
+    assert_equal 1, @repo.commit_graph.generation("8496071c1b46c854b31185ea97743be6a8774479")
+    assert_nil @repo.commit_graph.generation("deadbeef" * 5)
+  end
+
+  def test_damaged_commit_graph_is_ignored
+    commit1 = 'a4a7dce85cf63874e984719f4fdd239f5145052f'
+    commit2 = 'a65fedf39aefe402d3bb6e24df4d4f5fe4547750'
+    expected = @repo.ahead_behind(commit1, commit2)
+
+    count = @repo.write_commit_graph
+    path = File.join(@repo.path, "objects/info/rugged-commit-graph")
+
+    # Point the first parent of the first commit past the end of the table
+    File.open(path, "r+b") do |f|
+      f.seek(16 + 256 * 4 + count * 20)
+      f.write([0x7ffffffe].pack("N"))
+    end
+
+    repo = Rugged::Repository.new(@repo.path)
+    assert_nil repo.commit_graph
+    assert_equal expected, repo.ahead_behind(commit1, commit2)
+  end
+
+  def test_queries_with_commit_graph
+    commit1 = 'a4a7dce85cf63874e984719f4fdd239f5145052f'
+    commit2 = 'a65fedf39aefe402d3bb6e24df4d4f5fe4547750'
+
+    expected = [
+      @repo.ahead_behind(commit1, commit2),
+      @repo.merge_base(commit1, commit2),
+      @repo.descendant_of?(commit2, "be3563ae3f795b2b4353bcce3a527ad0a4f7f644"),
+      @repo.descendant_of?("be3563ae3f795b2b4353bcce3a527ad0a4f7f644", commit2),
+      Rugged::Walker.count(@repo, commit2),
+      Rugged::Walker.count(@repo, commit2, commit1)
+    ]
+
+    @repo.write_commit_graph
+
+    assert_equal expected, [
+      @repo.ahead_behind(commit1, commit2),
+      @repo.merge_base(commit1, commit2),
+      @repo.descendant_of?(commit2, "be3563ae3f795b2b4353bcce3a527ad0a4f7f644"),
+      @repo.descendant_of?("be3563ae3f795b2b4353bcce3a527ad0a4f7f644", commit2),
+      Rugged::Walker.count(@repo, commit2),
+      Rugged::Walker.count(@repo, commit2, commit1)
+    ]
+  end
+end
+
 class MergeCommitsRepositoryTest < Rugged::TestCase
   def setup
     @repo = FixtureRepo.from_libgit2("merge-resolve")
@@ -444,6 +507,28 @@ class RepositoryWriteTest < Rugged::TestCase
     assert @repo.exists?("76b1b55ab653581d6f2c7230d34098e837197674")
   end
 
+  def test_sniff
+    text = @repo.write("hello\n" * 5000, :blob)
+    png = @repo.write("\x89PNG\r\n\x1a\n\0\0\0\rIHDR".b + "\0".b * 20_000, :blob)
+
+    assert_equal({ type: :blob, size: 30_000, binary: false, mime: "text/plain" }, @repo.sniff(text))
+    assert_equal({ type: :blob, size: 20_016, binary: true, mime: "image/png" }, @repo.sniff(png, bytes: 100))
+    assert_nil @repo.sniff(png, bytes: 0)[:mime]
+    assert_equal "text/plain", @repo.sniff(@repo.write("", :blob))[:mime]
+
+    commit = @repo.sniff("8496071c1b46c854b31185ea97743be6a8774479")
+    assert_equal :commit, commit[:type]
+    assert_nil commit[:binary]
+
+    packed = @repo.sniff("fa49b077972391ad58037050f2a75f74e3671e92")
+    assert_equal 9, packed[:size]
+    assert_equal false, packed[:binary]
+    # The second lookup goes through the pack indexes cached on the repository
+    assert_equal packed, @repo.sniff("fa49b077972391ad58037050f2a75f74e3671e92")
+
+    assert_raises(Rugged::OdbError) { @repo.sniff("a496071c1b46c854b31185ea97743be6a8774471") }
+  end
+
   def test_no_merge_base_between_unrelated_branches
     info = @repo.rev_parse('HEAD').to_hash
     baseless = Rugged::Commit.create(@repo, info.merge(:parents => []))
@@ -55,6 +55,27 @@ class TreeTest < Rugged::TestCase
     assert_equal "fa49b077972391ad58037050f2a75f74e3671e92", @tree[1][:oid]
   end
 
+  def test_counts
+    files = dirs = bytes = 0
+    @tree.walk(:preorder) do |_, entry|
+      if entry[:type] == :tree
+        dirs += 1
+      else
+        files += 1
+        bytes += @repo.lookup(entry[:oid]).size
+      end
+    end
+
+    expected = { files: files, dirs: dirs, bytes: bytes }
+    assert_equal 6, files
+    assert_equal expected, @tree.counts
+    assert_equal expected, @repo.lookup(@oid).counts
+
+    subtree = @repo.lookup(@tree[2][:oid])
+    assert_equal subtree.count_recursive, subtree.counts[:files]
+    assert_equal 2, @tree.count_recursive(2)
+  end
+
   def test_read_tree_entry_data
     bent = @tree[0]
     tent = @tree[2]
@@ -69,6 +90,48 @@ class TreeTest < Rugged::TestCase
     assert_equal :tree, @repo.lookup(tent[:oid]).type
   end
 
+  def test_entry_object
+    bent = @tree[0]
+
+    assert_instance_of Rugged::Tree::Entry, bent
+    assert bent.frozen?
+    assert_equal "README", bent.name
+    assert_equal "1385f264afb75a56a5bec74243be9b367ba4ca08", bent.oid
+    assert_equal :blob, bent.type
+    assert_equal 0100644, bent.filemode
+    assert_equal 0100644, bent[:filemode]
+    assert_nil bent[:size]
+    assert_nil bent["name"]
+
+    hash = { name: "README", oid: "1385f264afb75a56a5bec74243be9b367ba4ca08", filemode: 0100644, type: :blob }
+    assert_equal hash, bent.to_h
+    assert_equal hash, bent
+    assert_equal bent, @tree["README"]
+    assert bent.eql?(@tree.path("README"))
+    refute_equal bent, @tree[1]
+    assert_equal 1, [bent, @tree["README"]].uniq.size
+
+    builder = Rugged::Tree::Builder.new(@repo)
+    builder << bent
+    assert_equal bent, builder["README"]
+  end
+
+  def test_entry_hash_methods
+    bent = @tree[0]
+
+    assert_equal "README", bent.fetch(:name)
+    assert_equal :default, bent.fetch(:size, :default)
+    assert_raises(KeyError) { bent.fetch(:size) }
+    assert bent.key?(:oid)
+    assert bent.has_key?(:type)
+    refute bent.key?(:size)
+    assert_equal [:name, :oid, :filemode, :type], bent.keys
+    assert_equal bent.to_h.values, bent.values
+    assert_equal bent.to_h.to_a, bent.each.to_a
+    assert_equal bent, bent.each_pair { |_key, _value| }
+    refute_respond_to bent, :[]=
+  end
+
   def test_get_entry_by_oid
     bent = @tree.get_entry_by_oid("1385f264afb75a56a5bec74243be9b367ba4ca08")
     assert_equal "README", bent[:name]
@@ -110,6 +173,53 @@ class TreeTest < Rugged::TestCase
     @tree.each_blob {|tree| assert_equal :blob, tree[:type]}
   end
 
+  def test_walk_paths
+    all = ["README", "new.txt", "subdir", "subdir/README", "subdir/new.txt",
+      "subdir/subdir2", "subdir/subdir2/README", "subdir/subdir2/new.txt"]
+    assert_equal all, @tree.walk_paths.to_a.flatten
+
+    batches = []
+    @tree.walk_paths(batch: 3) { |paths| batches << paths }
+    assert_equal [3, 3, 2], batches.map(&:size)
+    assert_equal all, batches.flatten
+
+    assert_equal ["new.txt", "subdir/new.txt", "subdir/subdir2/new.txt"],
+      @tree.walk_paths(pathspec: "*.txt", types: :blob).to_a.flatten
+    assert_equal ["subdir/subdir2", "subdir/subdir2/README", "subdir/subdir2/new.txt"],
+      @tree.walk_paths(pathspec: "subdir/subdir2").to_a.flatten
+    assert_equal ["subdir/README", "subdir/subdir2/README"],
+      @tree.walk_paths(pathspec: ["subdir/*README", "nope/*"]).to_a.flatten
+    assert_equal ["subdir", "subdir/subdir2"], @tree.walk_paths(types: [:tree]).to_a.flatten
+    assert_equal ["README", "new.txt", "subdir"], @tree.walk_paths(max_depth: 0).to_a.flatten
+    assert_equal ["README", "new.txt", "subdir/README", "subdir/new.txt"],
+      @tree.walk_paths(max_depth: 1, types: :blob).to_a.flatten
+    assert_equal [], @tree.walk_paths(pathspec: "nope").to_a
+
+    assert_raises(ArgumentError) { @tree.walk_paths(types: :tag) { } }
+    assert_raises(ArgumentError) { @tree.walk_paths(batch: 0) { } }
+  end
+
+  def test_last_commits
+    head = @repo.lookup("36060c58702ed4c2a40832c51758d5344201d89a")
+
+    last = @tree.last_commits(head)
+    assert_equal ["README", "new.txt", "subdir"], last.keys
+    assert_equal "8496071c1b46c854b31185ea97743be6a8774479", last["README"].oid
+    assert_equal "5b5b025afb0b4c913b4c338a42934a3863bf3644", last["new.txt"].oid
+    assert_equal head.oid, last["subdir"].oid
+
+    last = @tree.last_commits(head.oid, limit_depth: 2)
+    assert_nil last["README"]
+    assert_equal "5b5b025afb0b4c913b4c338a42934a3863bf3644", last["new.txt"].oid
+
+    subdir = @repo.lookup(@tree["subdir"][:oid])
+    last = subdir.last_commits(head, "subdir")
+    assert_equal ["README", "new.txt", "subdir2"], last.keys
+    assert last.values.all? { |commit| commit.oid == head.oid }
+
+    assert_raises(ArgumentError) { @tree.last_commits(head, limit_depth: 0) }
+  end
+
   def test_path
     assert_equal @tree.path('README'), name: 'README', oid: '1385f264afb75a56a5bec74243be9b367ba4ca08', filemode: 0100644, type: :blob
     assert_equal @tree.path('subdir'), name: 'subdir', oid: '619f9935957e010c419cb9d15621916ddfcc0b96', filemode: 0040000, type: :tree
@@ -158,6 +268,89 @@ class TreeWriteTest < Rugged::TestCase
     obj = @repo.lookup(sha)
     assert_equal 38, obj.read_raw.len
   end
+
+  def test_paths_for_oids
+    readme = "1385f264afb75a56a5bec74243be9b367ba4ca08"
+    subdir2 = "f60079018b664e4e79329a7ef9559c8d9e0378d1"
+    missing = "1" * 40
+
+    builder = Rugged::Tree::Builder.new(@repo)
+    builder << { type: :tree, name: "a", oid: "619f9935957e010c419cb9d15621916ddfcc0b96", filemode: 0040000 }
+    builder << { type: :tree, name: "b", oid: "619f9935957e010c419cb9d15621916ddfcc0b96", filemode: 0040000 }
+    builder << { type: :blob, name: "top", oid: readme, filemode: 0100644 }
+    tree = @repo.lookup(builder.write)
+
+    paths = tree.paths_for_oids([readme, subdir2, missing, readme])
+    assert_equal [readme, subdir2, missing].sort, paths.keys.sort
+    assert_equal ["a/README", "a/subdir2/README", "b/README", "b/subdir2/README", "top"], paths[readme]
+    assert_equal ["a/subdir2", "b/subdir2"], paths[subdir2]
+    assert_equal [], paths[missing]
+
+    assert_raises(ArgumentError) { tree.paths_for_oids(["abc"]) }
+  end
+end
+
+class TreeLanguageStatsTest < Rugged::TestCase
+  def setup
+    @source_repo = FixtureRepo.from_rugged("testrepo.git")
+    @repo = FixtureRepo.clone(@source_repo)
+  end
+
+  def write_tree(files)
+    builder = Rugged::Tree::Builder.new(@repo)
+    files.each do |name, content|
+      oid = content.is_a?(Hash) ? write_tree(content).oid : Rugged::Blob.from_buffer(@repo, content)
+      type = content.is_a?(Hash) ? :tree : :blob
+      builder << { :type => type, :name => name, :oid => oid, :filemode => type == :tree ? 0040000 : 0100644 }
+    end
+    @repo.lookup(builder.write)
+  end
+
+  def test_language_stats
+    tree = write_tree(
+      "main.rb" => "puts 1\n\nputs 2\n",
+      "README" => "hello\n",
+      "lib" => { "util.c" => "int x;\n", "helper.rb" => "x = 1\n" },
+      "vendor" => { "jquery.js" => "var a;\n" },
+      ".gitattributes" => "vendor/** linguist-vendored\n*.c linguist-language=C++\n"
+    )
+
+    stats = tree.language_stats
+    assert_equal ["C++", "Ruby"], stats.keys.sort
+    assert_equal({ :files => 2, :bytes => 21, :lines => 3 }, stats["Ruby"])
+    assert_equal({ :files => 1, :bytes => 7, :lines => 1 }, stats["C++"])
+
+    # Answered from the subtree cache
+    assert_equal stats, tree.language_stats
+  end
+
+  def test_language_stats_of_related_trees
+    files = {
+      "main.rb" => "puts 1\n\nputs 2\n",
+      "lib" => { "util.c" => "int x;\n", "helper.rb" => "x = 1\n" },
+      "vendor" => { "jquery.js" => "var a;\n" },
+      ".gitattributes" => "vendor/** linguist-vendored\n*.c linguist-language=C++\n"
+    }
+    stats = write_tree(files).language_stats
+    assert_equal({ :files => 1, :bytes => 7, :lines => 1 }, stats["C++"])
+
+    # One changed file: the cached vendor subtree is reused, lib is not
+    changed = write_tree(files.merge("lib" => files["lib"].merge("util.c" => "int x;\nint y;\n")))
+    assert_equal({ :files => 1, :bytes => 14, :lines => 2 }, changed.language_stats["C++"])
+    assert_equal stats["Ruby"], changed.language_stats["Ruby"]
+
+    # A nested .gitattributes changes the totals of its own subtree
+    nested = write_tree(files.merge("lib" => files["lib"].merge(".gitattributes" => "helper.rb linguist-generated\n")))
+    assert_equal({ :files => 1, :bytes => 15, :lines => 2 }, nested.language_stats["Ruby"])
+    assert_equal stats["C++"], nested.language_stats["C++"]
+
+    # The same lib subtree under different inherited rules isn't a cache hit
+    relabeled = write_tree(files.merge(".gitattributes" => "vendor/** linguist-vendored\n*.c linguist-language=C\n"))
+    assert_equal ["C", "Ruby"], relabeled.language_stats.keys.sort
+    assert_equal stats["C++"], relabeled.language_stats["C"]
+
+    assert_equal stats, write_tree(files).language_stats
+  end
 end
 
 class TreeUpdateTest < Rugged::TestCase
@@ -60,6 +60,20 @@ class WalkerTest < Rugged::TestCase
     assert_equal ["5b5b025afb0b4c913b4c338a42934a3863bf3644"], oids
   end
 
+  def test_walk_revlist_as_oid_batches
+    @walker.push("9fd738e8f7967c078dceed8190330fc8648ee56a")
+    batches = @walker.each_oid_batch(3).to_a
+    assert_equal [3, 1], batches.map(&:size)
+    assert_equal ["9fd738e8f7967c078dceed8190330fc8648ee56a", "4a202b346bb0fb0db7eff3cffeb3c70babbd2045",
+                  "5b5b025afb0b4c913b4c338a42934a3863bf3644", "8496071c1b46c854b31185ea97743be6a8774479"], batches.flatten
+  end
+
+  def test_walk_revlist_as_oid_batches_with_limit_and_offset
+    @walker.push("9fd738e8f7967c078dceed8190330fc8648ee56a")
+    batches = @walker.each_oid_batch(2, :offset => 1, :limit => 2).to_a
+    assert_equal [["4a202b346bb0fb0db7eff3cffeb3c70babbd2045", "5b5b025afb0b4c913b4c338a42934a3863bf3644"]], batches
+  end
+
   def test_walk_push_range
     @walker.push_range("HEAD~2..HEAD")
     data = @walker.each.to_a
@@ -186,6 +200,29 @@ class WalkerTest2 < Rugged::TestCase
     assert_equal stats[3].dels, 1
   end
 
+  def test_stats_only_keeps_walk_order
+    repo = FixtureRepo.from_libgit2("testrepo")
+    walker = Rugged::Walker.new(repo)
+    walker.push("099fabac3a9ea935598528c27f866e34089c2eff")
+    walker.sorting Rugged::SORT_DATE
+    oids = walker.each(no_merges: true).map(&:oid)
+
+    walker.push("099fabac3a9ea935598528c27f866e34089c2eff")
+    stats = walker.each(stats_only: true).to_a
+    assert_equal oids, stats.map(&:oid)
+
+    walker.push("099fabac3a9ea935598528c27f866e34089c2eff")
+    stats = walker.each(stats_only: true, path_only: 'new.txt').to_a
+    assert_equal 2, stats.length
+
+    walker.push("099fabac3a9ea935598528c27f866e34089c2eff")
+    oids = walker.each(no_merges: true, offset: 1, limit: 3).map(&:oid)
+    walker.reset
+
+    walker.push("099fabac3a9ea935598528c27f866e34089c2eff")
+    assert_equal oids, walker.each(stats_only: true, offset: 1, limit: 3).map(&:oid)
+  end
+
   def test_path_only
     repo = FixtureRepo.from_libgit2("testrepo")
     walker = Rugged::Walker.new(repo)